@@ -0,0 +1,31 @@
+#!/bin/bash -e
+
+# builds the RAM flashing stub (needs arm-none-eabi-gcc) and embeds it,
+# configure with -DEMBED_STUB=1 afterwards
+
+make -C stub
+
+mkdir -p gen/
+OUT_FILE=gen/flashstub.cpp
+OUT_HFILE=gen/flashstub_data.h
+rm -f $OUT_FILE $OUT_HFILE
+
+cat > $OUT_HFILE <<EOT
+#ifndef __FLASHSTUB_DATA_H__
+#define __FLASHSTUB_DATA_H__
+
+extern const unsigned char flashStubData[];
+extern const int flashStubSize;
+
+#endif
+EOT
+
+cat > $OUT_FILE <<EOT
+#include "flashstub_data.h"
+
+EOT
+
+echo -n "const unsigned char flashStubData[] = \"" >> $OUT_FILE
+cat stub/flashstub.bin | hexdump -v -e '/1 "@x%02x"' | tr @ '\\' >> $OUT_FILE
+echo '";' >> $OUT_FILE
+echo "const int flashStubSize = $(stat -c %s stub/flashstub.bin);" >> $OUT_FILE
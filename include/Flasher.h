@@ -0,0 +1,56 @@
+#ifndef __FLASHER_H__
+#define __FLASHER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "ihex.h"
+
+enum EVerifyMode
+{
+	VERIFY_CRC,  // checksum of each sector computed on the chip (flashing stub, XCP BUILD_CHECKSUM)
+	VERIFY_READ, // full readback through the bootloader
+};
+
+typedef void (*ProgressCallback)(uint32_t current, uint32_t total);
+
+// Image handling and the flashing steps shared by the backends, HardFlasher
+// talks to the STM32 ROM bootloader, SoftFlasher to a resident OpenBLT one
+class Flasher
+{
+public:
+	Flasher();
+	virtual ~Flasher() { }
+
+	int load(const string& path);
+	int load(const vector<string>& specs);
+	int loadData(const char* data);
+
+	void setDevice(const string& device) { m_device = device; }
+	void setBaudrate(int baudrate) { m_baudrate = baudrate; }
+	void setCallback(ProgressCallback callback) { m_callback = callback; }
+	// uses an image owned by the caller (e.g. shared between several flashers)
+	void setHexFile(THexFile* hexFile) { m_image = hexFile; }
+
+	THexFile& getHexFile() { return *m_image; }
+
+	virtual int init() = 0;
+	virtual int start(bool initBootloader = true) = 0;
+	virtual int erase() = 0;
+	virtual int flash() = 0;
+	virtual int verify(EVerifyMode mode) = 0;
+	virtual int reset() = 0;
+	virtual int cleanup(bool reset = true) = 0;
+
+protected:
+	THexFile m_hexFile;
+	THexFile* m_image;
+	string m_device;
+	int m_baudrate;
+	ProgressCallback m_callback;
+};
+
+#endif
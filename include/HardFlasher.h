@@ -2,40 +2,65 @@
 #define __HARDFLASHER_H__
 
 #include <string>
+#include <vector>
+#include <map>
 
 using namespace std;
 
+#include "Flasher.h"
 #include "devices.h"
 #include "myFTDI.h"
 #include "TRoboCOREHeader.h"
 #include "ihex.h"
+#include "TDeviceSnapshot.h"
 
-typedef void (*ProgressCallback)(uint32_t current, uint32_t total);
+class FlashStub;
 
-class HardFlasher
+enum ERunMode
 {
-public:
-	int load(const string& path);
-	int loadData(const char* data);
-
-	void setDevice(const string& device) { m_device = device; }
-	void setBaudrate(int baudrate) { m_baudrate = baudrate; }
-	void setCallback(ProgressCallback callback) { m_callback = callback; }
+	RUN_GO,    // bootloader GO command, no reset
+	RUN_RESET, // RST pulse with BOOT0 low
+};
 
-	THexFile& getHexFile() { return m_hexFile; }
+class HardFlasher : public Flasher
+{
+public:
+	HardFlasher();
+
+	// number of connection attempts done by start(), 0 means retry forever
+	void setMaxAttempts(int attempts) { m_maxAttempts = attempts; }
+	// erases and programs through the RAM flashing stub at this baudrate, 0 disables
+	void setFastBaudrate(int baudrate) { m_fastBaudrate = baudrate; }
+	// stub binary to use instead of the embedded one
+	int loadStub(const string& path);
+	bool hasStub();
+	// reserved flash location of the image stamp, must not overlap the image
+	int setStampAddress(uint32_t addr);
 
 	int init();
 	int start(bool initBootloader = true);
+	// enters the bootloader again after the chip has reset itself
+	int reconnect();
 	int erase();
 	int flash();
+	int verify(EVerifyMode mode);
+	// 1 if the stamp on the device matches the image, 0 if not
+	int checkStamp();
+	int writeStamp();
 	int reset();
+	// starts the application and leaves the handle open as a console at this speed
+	int run(ERunMode mode, int consoleBaudrate, uint32_t addr = FLASH_START);
 	int cleanup(bool reset = true);
 
 	int protect();
 	int unprotect();
-	int dump();
+	int dump(bool json = false);
+	int readSnapshot(TDeviceSnapshot& snapshot);
 	int dumpEmulatedEEPROM();
 	int eraseEmulatedEEPROM();
+	int saveEmulatedEEPROM(const string& path);
+	int restoreEmulatedEEPROM(const string& path);
+	// 1 if the option bytes were changed and the chip has to be reconnected
 	int setup(bool noSettingsCheck = false);
 
 	int readHeader(TRoboCOREHeader& header, int headerId = 0);
@@ -43,10 +68,12 @@ public:
 
 private:
 	stm32_dev_t m_dev;
-	THexFile m_hexFile;
-	string m_device;
-	int m_baudrate;
-	ProgressCallback m_callback;
+	int m_maxAttempts;
+	int m_fastBaudrate;
+	vector<uint8_t> m_stubImage;
+	FlashStub* m_stub;
+	uint32_t m_stampAddr;
+	bool m_plugInMsgShown;
 
 	int open();
 	int close(bool reset);
@@ -58,9 +85,21 @@ private:
 	int readMemory(uint32_t addr, void* data, int len);
 	int writeMemory(uint32_t addr, const void* data, int len);
 	int erasePages(const vector<int>& pages);
+	int go(uint32_t addr);
+
+	// bootloader synchronization
+	int resync();
+	// a NACK also means synchronized, unless ackOnly is set
+	int syncBootloader(int attempts, int timeout, bool ackOnly = false);
+
+	// flashing stub
+	int startStub();
+	int stopStub();
 
 	// misc
-	void dumpOptionBytes();
+	int readRange(uint32_t addr, void* data, int len);
+	int readEmulatedEEPROM(map<uint16_t, uint16_t>& values);
+	void invalidateCache();
 
 	// low-level protocol
 	int uart_send_cmd(uint8_t cmd);
@@ -2,26 +2,39 @@
 #define __SOFTFLASHER_H__
 
 #include "Flasher.h"
+#include "xcpmaster.h"
 
+// Updates the application through a resident OpenBLT bootloader over XCP.
+// The device is "ftdi:[serial]" for the FTDI chip of the board, which is
+// reset into the bootloader, or a serial port, then the board has to be
+// reset by hand.
 class SoftFlasher : public Flasher
 {
 public:
+	SoftFlasher();
+
+	// no progress output, for several flashers running in parallel
+	void setQuiet(bool quiet) { m_quiet = quiet; }
+
 	int init();
 	int start(bool initBootloader = true);
 	int erase();
 	int flash();
+	int verify(EVerifyMode mode);
 	int reset();
-	int cleanup(bool reset = true) { return 0; }
-
-	int protect() { return -1; }
-	int unprotect() { return -1; }
-	int dump() { return -1; }
-	int dumpEmulatedEEPROM() { return -1; }
-	int setup() { return -1; }
+	int cleanup(bool reset = true);
 
 private:
+	tXcpSession m_session;
+	bool m_connected;
+	bool m_finished; // final PROGRAM sent, OpenBLT wrote its buffered data
+	bool m_quiet;
+
+	int finish();
+
 	int open();
 	int close();
+	bool isFtdi();
 };
 
 #endif
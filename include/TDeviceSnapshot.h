@@ -0,0 +1,39 @@
+#ifndef __TDEVICE_SNAPSHOT_H__
+#define __TDEVICE_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+using namespace std;
+
+#include "devices.h"
+#include "TRoboCOREHeader.h"
+
+// OTP data blocks followed by the lock bytes, 0x1fff7800-0x1fff7a0f
+const uint32_t OTP_SNAPSHOT_SIZE = OTP_LOCK_START + 16 - OTP_START;
+const uint32_t BOOT_INFO_START = 0x08007f00;
+
+// Everything --dump shows, fetched with a few maximal reads and decoded on the host.
+class TDeviceSnapshot
+{
+public:
+	uint16_t chipId;
+	uint8_t bootVersion;
+	uint8_t otp[OTP_SNAPSHOT_SIZE];
+	uint8_t optionBytes[16];
+	uint8_t bootInfo[32]; // revision and version strings of the software bootloader
+
+	uint32_t getOption1();
+	uint32_t getOption2();
+	bool optionsValid();
+	TRoboCOREHeader getHeader(int headerId);
+	uint8_t getLock(int headerId);
+	string getBootRevision();
+	string getBootVersion();
+
+	void print(FILE* f);
+	string toJson();
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __TIMAGE_STAMP_H__
+#define __TIMAGE_STAMP_H__
+
+#include <stdint.h>
+
+#include "ihex.h"
+
+const uint32_t IMAGE_STAMP_MAGIC = 0x31534643; // "CFS1"
+
+// Fingerprint of the flashed image, written to a reserved flash location after
+// a successful flash so the next run can tell the board is already up to date.
+#pragma pack(1)
+class TImageStamp
+{
+public:
+	uint32_t magic;
+	uint32_t length;
+	uint32_t timestamp;
+	uint8_t digest[20]; // SHA-256 of part addresses, lengths and data, truncated
+
+	void calc(THexFile& image);
+
+	bool isValid();
+	// timestamp is not compared
+	bool matches(const TImageStamp& other);
+};
+#pragma pack()
+
+#endif
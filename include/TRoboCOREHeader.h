@@ -16,6 +16,8 @@ public:
 	bool isValid();
 
 	void calcChecksum();
+	// stores a 16-byte board key with its format byte and CRC
+	void setKey(const uint8_t boardKey[16]);
 };
 #pragma pack()
 
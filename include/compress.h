@@ -0,0 +1,14 @@
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// Compresses data into a single LZ4 block (raw block format, no frame
+// header), which is what the flashing stub decompresses on the target.
+// Erased areas and repeated tables in firmware images shrink a lot.
+void lz4Compress(const uint8_t* data, int len, vector<uint8_t>& out);
+
+#endif
@@ -1,6 +1,23 @@
 #ifndef __CONSOLE_H__
 #define __CONSOLE_H__
 
-int runConsole(int speed);
+struct TConsoleOptions
+{
+	const char* recordPath; // raw stream with timestamps, see recorder.h
+	bool recordText;
+	const char* serveSpec; // unix:/path or tcp:port, see consoleserver.h
+	const char* sendPath; // file or - for stdin, sent instead of the terminal input
+	bool sendPace; // no faster than the line speed
+	bool sendXonXoff;
+	bool rosserial; // text only on the output, per topic rates on stderr
+	const char* rosserialFrames; // raw copy of the rosserial frames
+
+	TConsoleOptions() : recordPath(0), recordText(false), serveSpec(0), sendPath(0), sendPace(false), sendXonXoff(false),
+		rosserial(false), rosserialFrames(0) { }
+};
+
+int runConsole(int speed, const TConsoleOptions& options);
+// streams an already opened handle (e.g. after HardFlasher::run) and closes it on exit
+int attachConsole(const TConsoleOptions& options);
 
 #endif
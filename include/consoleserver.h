@@ -0,0 +1,63 @@
+#ifndef __CONSOLESERVER_H__
+#define __CONSOLESERVER_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifdef UNIX
+#include <thread>
+#elif WIN32
+#include "mingw.thread.h"
+#endif
+
+#include "ringbuffer.h"
+
+typedef void (*ConsoleInputCallback)(const uint8_t* data, int len);
+
+// Shares the console stream with local clients on a unix socket or a
+// localhost TCP port. All clients send from one broadcast ring, a client
+// lagging more than half of it is disconnected. Data received from clients
+// is passed to the input callback. POSIX only.
+class ConsoleServer
+{
+public:
+	ConsoleServer();
+	~ConsoleServer();
+
+	// spec is unix:/path or tcp:port
+	int open(const string& spec, ConsoleInputCallback input);
+	// USB thread, never blocks
+	void push(const uint8_t* data, int len);
+	void close();
+
+private:
+	struct TClient
+	{
+		int fd;
+		uint64_t cursor;
+		int id;
+	};
+
+	TBroadcastRing m_ring;
+	ConsoleInputCallback m_input;
+	thread* m_thread;
+	atomic<bool> m_stop;
+	int m_listenFd;
+	int m_wakeFds[2];
+	atomic<bool> m_wakePending;
+	string m_unixPath;
+	vector<TClient> m_clients;
+	int m_nextId;
+
+	void run();
+	void accept();
+	// false if the client is gone
+	bool sendTo(TClient& client);
+	bool receiveFrom(TClient& client);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __DEVICECACHE_H__
+#define __DEVICECACHE_H__
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+#include "myFTDI.h"
+
+// entries older than this are verified again against the device
+const uint32_t DEVICE_CACHE_MAX_AGE = 7 * 24 * 3600;
+
+// Host-side knowledge about a board, keyed by FTDI serial number. It lets
+// later opens skip the EEPROM read and the bootloader GET/GET_ID round trips.
+struct TDeviceCacheEntry
+{
+	string serial;
+	uint32_t timestamp;
+
+	bool hasGpio;
+	gpio_config_t gpio;
+
+	bool hasCmds;
+	uint8_t bootVersion;
+	uint8_t cmds[11];
+	uint16_t chipId;
+
+	int baudrate, latency;
+
+	TDeviceCacheEntry();
+};
+
+extern int device_cache_enabled;
+
+bool deviceCacheGet(const string& serial, TDeviceCacheEntry& entry);
+// merges the parts of entry that are set and marks the device as verified now
+void deviceCachePut(const TDeviceCacheEntry& entry);
+void deviceCacheInvalidate(const string& serial);
+
+#endif
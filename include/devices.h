@@ -29,6 +29,8 @@ typedef struct
 extern const tFlashSector flashLayout[];
 extern const int flashPages;
 
+const uint32_t FLASH_START = 0x08000000;
+
 const uint32_t OPTION_BYTE_1 = 0x1fffc000;
 const uint32_t OPTION_BYTE_2 = 0x1fffc008;
 
@@ -36,6 +38,11 @@ const uint32_t BOR_MASK = 0x0000000c;
 const uint32_t BOR_BIT = 2;
 const uint32_t BOR_LEVEL = 0b10;
 
+// emulated EEPROM (ST AN3969 layout) in flash sectors 2 and 3
+const uint32_t EEPROM_START = 0x08008000;
+const uint32_t EEPROM_PAGE_SIZE = 0x4000;
+const uint16_t EEPROM_PAGE_VALID = 0x0000;
+
 const uint32_t OTP_START = 0x1fff7800;
 const uint32_t OTP_LOCK_START = 0x1fff7a00;
 
@@ -0,0 +1,60 @@
+#ifndef __FLASHSTUB_H__
+#define __FLASHSTUB_H__
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+#include "ihex.h"
+#include "stubproto.h"
+
+// Byte stream to the stub. HardFlasher drives it over the FTDI UART, the
+// stub-sim debug tool (test/stubsim.cpp) plugs in a model of the stub.
+class StubLink
+{
+public:
+	virtual ~StubLink() { }
+
+	virtual int write(const void* data, int len) = 0;
+	// returns the number of bytes read before the timeout or -1 on error
+	virtual int read(void* data, int len, int timeout) = 0;
+	virtual int flush() = 0;
+	virtual int setBaudrate(int baudrate) = 0;
+};
+
+// Host side of the RAM flashing stub (stub/flashstub.c). Writes are
+// compressed and pipelined, up to STUB_WINDOW bytes are sent ahead of the
+// replies.
+class FlashStub
+{
+public:
+	FlashStub(StubLink& link);
+
+	int connect(int timeout);
+	int setBaudrate(int baudrate);
+	int erase(const vector<int>& sectors);
+	int program(THexFile& image, void (*callback)(uint32_t current, uint32_t total));
+	int crc(uint32_t addr, uint32_t len, uint32_t& crc);
+	int reset();
+
+private:
+	struct TPending
+	{
+		uint8_t seq, cmd;
+		int size, raw;
+	};
+
+	StubLink& m_link;
+	uint8_t m_seq;
+	deque<TPending> m_pending;
+	int m_inFlight;
+	uint32_t m_done;
+
+	int send(uint8_t cmd, uint32_t addr, uint32_t arg, const uint8_t* payload = 0, int len = 0, uint8_t flags = 0, int raw = 0);
+	int waitReply(int timeout, uint32_t* value = 0);
+	int call(uint8_t cmd, uint32_t addr, uint32_t arg, int timeout, uint32_t* value = 0);
+};
+
+#endif
@@ -26,6 +26,15 @@ public:
 	
 	int load(const std::string& path);
 	int loadData(const char* data);
+	int loadBin(const std::string& path, uint32_t addr);
+	// "file.hex" or "file.bin@0x08040000" each, merged into one sparse image
+	int loadImages(const std::vector<std::string>& specs);
+	// moves the parts of other into this image, fails if they overlap,
+	// parts that touch are joined
+	int merge(THexFile& other);
+	// copies the image bytes of [addr, addr + len), bytes outside of all
+	// parts read as erased flash (0xff)
+	void read(uint32_t addr, uint32_t len, uint8_t* data);
 	
 	int totalLength;
 	
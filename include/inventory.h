@@ -0,0 +1,8 @@
+#ifndef __INVENTORY_H__
+#define __INVENTORY_H__
+
+// Reads device info from every attached CORE2 board at once and prints a
+// table or a JSON document keyed by FTDI serial and USB port.
+int runInventory(int speed, bool json);
+
+#endif
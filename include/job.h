@@ -0,0 +1,36 @@
+#ifndef __JOB_H__
+#define __JOB_H__
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "HardFlasher.h"
+#include "TRoboCOREHeader.h"
+
+enum EJobOp
+{
+	JOB_DUMP, JOB_SETUP, JOB_UNPROTECT, JOB_ERASE, JOB_FLASH, JOB_VERIFY, JOB_PROTECT, JOB_REGISTER, JOB_RESET
+};
+
+struct TJobConfig
+{
+	bool json;
+	bool noSettingsCheck;
+	EVerifyMode verifyMode;
+	TRoboCOREHeader header; // for JOB_REGISTER
+	int headerId;
+	// JOB_FLASH also writes the image stamp (see --stamp), JOB_ERASE, JOB_FLASH
+	// and JOB_VERIFY are skipped when the device already has the image
+	bool stamp;
+};
+
+int parseJob(const string& list, vector<EJobOp>& ops);
+bool jobHasOp(const vector<EJobOp>& ops, EJobOp op);
+
+// Runs the operations in order within one bootloader session, reconnecting
+// only after operations that make the chip reset itself.
+int runJob(HardFlasher& flasher, const vector<EJobOp>& ops, const TJobConfig& config);
+
+#endif
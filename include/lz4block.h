@@ -0,0 +1,74 @@
+#ifndef __LZ4BLOCK_H__
+#define __LZ4BLOCK_H__
+
+/*
+ * Decoder of a single LZ4 block (raw block format, no frame header), as
+ * produced by lz4Compress() in compress.h. Used by the flashing stub
+ * (stub/flashstub.c) and by its simulator, so it must stay plain C.
+ *
+ * Returns the number of bytes written to dst or -1 if the block is
+ * malformed or does not fit.
+ */
+
+#include <stdint.h>
+
+static int lz4_decompress_block(const uint8_t* src, int srcLen, uint8_t* dst, int dstLen)
+{
+	const uint8_t* ip = src, *iend = src + srcLen;
+	uint8_t* op = dst, *oend = dst + dstLen;
+
+	while (ip < iend)
+	{
+		uint32_t token = *ip++;
+		uint32_t len = token >> 4;
+		if (len == 15)
+		{
+			uint8_t b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			}
+			while (b == 255);
+		}
+		if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op))
+			return -1;
+		while (len--)
+			*op++ = *ip++;
+
+		if (ip == iend)
+			break; /* last sequence has no match */
+
+		if (iend - ip < 2)
+			return -1;
+		uint32_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (uint32_t)(op - dst))
+			return -1;
+
+		len = token & 15;
+		if (len == 15)
+		{
+			uint8_t b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			}
+			while (b == 255);
+		}
+		len += 4;
+		if (len > (uint32_t)(oend - op))
+			return -1;
+		const uint8_t* match = op - offset;
+		while (len--)
+			*op++ = *match++;
+	}
+	return op - dst;
+}
+
+#endif
@@ -2,6 +2,12 @@
 #define __H_MYFTDI__
 
 #include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct libusb_device;
+struct ftdi_context;
 
 const int IOMODE = 8;
 const int KEEP_AWAKE = 21;
@@ -13,19 +19,73 @@ struct gpio_config_t
 	int cbus0, cbus1, cbus2, cbus3;
 };
 
+// one step of a BOOT0/RST/EDISON waveform, -1 keeps the pin unchanged
+struct gpio_step_t
+{
+	int8_t boot0, rst, edison;
+	uint32_t delay_us; // time to wait after the step is applied
+};
+
+struct uart_device_t
+{
+	std::string serial, port;
+};
+
+// the uart_* state is per thread, every thread can drive its own board
+void uart_select_device(const char* serial);
+// the handle opened by this thread, helper threads attach to it to transmit
+ftdi_context* uart_get_context();
+void uart_attach_context(ftdi_context* context);
+bool uart_describe_device(libusb_device* device, uart_device_t& info);
+int uart_list_devices(std::vector<uart_device_t>& devices);
+
 bool uart_open(int speed, bool showErrors = true);
+// bounds the wait for a manual replug after a settings change, 0 waits forever
+void uart_set_replug_timeout(uint32_t timeout_ms);
 bool uart_open_with_config(int speed, const gpio_config_t& config, bool showErrors);
 int uart_set_gpio_config(const gpio_config_t& config);
+int uart_run_waveform(const gpio_step_t* steps, int count);
 int uart_reset_boot();
+// keeps the handle open and BOOT0 high while the chip resets itself
+int uart_hold_boot();
+// drops BOOT0 without a reset, a later reset of any kind boots from flash
+int uart_release_boot();
 int uart_switch_to_edison(bool resetSTM);
 int uart_switch_to_stm32();
 int uart_switch_to_esp();
 bool uart_is_opened();
+const std::string& uart_get_serial();
+int uart_set_latency(int ms);
+int uart_get_latency();
+// current line speed
+int uart_get_speed();
+// XON/XOFF flow control handled by the FTDI chip for the data sent to the board
+int uart_set_xonxoff(bool enable);
 void uart_reset_normal();
-void uart_setspeed(int speed);
+// changes the line speed until the next reset or mode switch restores the opened one
+int uart_setspeed(int speed);
+int uart_flush_rx();
+// switches the opened handle to 8N1 at this speed, kept by later resets
+int uart_set_console(int speed);
 int uart_tx(const void* data, int len);
 int uart_rx_any(void* data, int len);
 int uart_rx(void* data, int len, uint32_t timeout_ms);
+
+// called from the USB event loop with the payload of each completed transfer
+typedef void (*uart_stream_callback_t)(const uint8_t* data, int len, void* userdata);
+// updated by the streaming thread, may be read from others
+struct uart_stream_stats_t
+{
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint32_t> overruns; // packets flagged with an overrun of the FTDI receive buffer
+};
+// receives through several queued asynchronous transfers until stop is set
+int uart_rx_stream(uart_stream_callback_t callback, void* userdata, const volatile bool& stop, uart_stream_stats_t& stats);
+
+// fills buf with up to len bytes to send, returns 0 at the end of data or -1 on error
+typedef int (*uart_tx_source_t)(uint8_t* buf, int len, void* userdata);
+// sends everything the source provides with up to inFlight transfers queued
+int uart_tx_stream(uart_tx_source_t source, void* userdata, int inFlight, const volatile bool& stop);
 void uart_close();
 
 #endif
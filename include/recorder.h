@@ -0,0 +1,95 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+#ifdef UNIX
+#include <thread>
+#elif WIN32
+#include "mingw.thread.h"
+#endif
+
+#include "ringbuffer.h"
+
+/*
+ * Console recording format
+ *
+ * <path>      TRecordHeader followed by TRecordChunk headers, each followed by
+ *             len bytes exactly as received from the board
+ * <path>.idx  TRecordIndexEntry every RECORD_INDEX_INTERVAL_US of recording,
+ *             pointing at the first chunk at or after that time
+ * <path>.txt  optional text view, every line prefixed with its timestamp
+ *
+ * Times are microseconds of a monotonic clock since the start of the recording.
+ */
+
+#define RECORD_MAGIC "CFREC1\0\0"
+#define RECORD_INDEX_INTERVAL_US 100000
+
+#pragma pack(1)
+struct TRecordHeader
+{
+	char magic[8];
+	uint64_t startTime; // wall clock at the start, microseconds since the epoch
+};
+struct TRecordChunk
+{
+	uint64_t time;
+	uint32_t len;
+	uint32_t dropped; // bytes lost between the previous chunk and this one
+};
+struct TRecordIndexEntry
+{
+	uint64_t time;
+	uint64_t offset;
+};
+#pragma pack()
+
+// Records the console stream. push() is called from the USB thread and never
+// blocks, the file is written by a separate thread through a ring buffer.
+// Every push() is one chunk, the console pushes whole USB transfers.
+class Recorder
+{
+public:
+	Recorder();
+	~Recorder();
+
+	int open(const string& path, bool textView);
+	void push(const uint8_t* data, int len);
+	void close();
+
+	uint32_t getDropped() { return m_dropped; }
+
+private:
+	TRingBuffer m_ring;
+	thread* m_thread;
+	atomic<bool> m_stop;
+	int m_fd;
+	FILE* m_index;
+	FILE* m_text;
+	uint64_t m_startTime;
+	uint32_t m_pendingDrops;
+	atomic<uint32_t> m_dropped;
+
+	// writer thread state
+	uint64_t m_offset, m_allocated;
+	TRecordChunk m_chunk;
+	uint32_t m_chunkFill, m_chunkLeft;
+	uint64_t m_lastIndexTime;
+	bool m_indexed, m_lineStart;
+
+	void run();
+	int writeFile(const uint8_t* data, uint32_t len);
+	void parse(const uint8_t* data, uint32_t len);
+	void writeText(const uint8_t* data, uint32_t len);
+};
+
+// writes the data received between from and to (seconds) to out
+int sliceRecording(const string& path, double from, double to, FILE* out);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+// Lock-free byte ring for exactly one producer and one consumer thread.
+// The size must be a power of two, positions run freely and are masked.
+class TRingBuffer
+{
+public:
+	TRingBuffer(uint32_t size) : m_data(size), m_mask(size - 1), m_head(0), m_tail(0) { }
+
+	uint32_t size() const { return m_mask + 1; }
+	uint32_t used() const { return m_head.load(memory_order_acquire) - m_tail.load(memory_order_acquire); }
+	uint32_t space() const { return size() - used(); }
+
+	// producer, returns the number of bytes stored (less than len when full)
+	uint32_t write(const uint8_t* data, uint32_t len)
+	{
+		uint32_t head = m_head.load(memory_order_relaxed);
+		uint32_t tail = m_tail.load(memory_order_acquire);
+		uint32_t space = size() - (head - tail);
+		if (len > space)
+			len = space;
+
+		uint32_t pos = head & m_mask;
+		uint32_t first = len < size() - pos ? len : size() - pos;
+		memcpy(&m_data[pos], data, first);
+		memcpy(&m_data[0], data + first, len - first);
+		m_head.store(head + len, memory_order_release);
+		return len;
+	}
+
+	// consumer, contiguous readable span, valid until consume()
+	uint32_t peek(const uint8_t*& data) const
+	{
+		uint32_t tail = m_tail.load(memory_order_relaxed);
+		uint32_t avail = m_head.load(memory_order_acquire) - tail;
+		uint32_t pos = tail & m_mask;
+		data = &m_data[pos];
+		return avail < size() - pos ? avail : size() - pos;
+	}
+	void consume(uint32_t len)
+	{
+		m_tail.store(m_tail.load(memory_order_relaxed) + len, memory_order_release);
+	}
+
+private:
+	vector<uint8_t> m_data;
+	uint32_t m_mask;
+	atomic<uint32_t> m_head, m_tail;
+};
+
+// Ring with one producer that never waits and any number of readers keeping
+// their own cursors (absolute stream positions). A reader has to check
+// lost() after using the data, the producer may have overwritten it meanwhile.
+class TBroadcastRing
+{
+public:
+	TBroadcastRing(uint32_t size) : m_data(size), m_mask(size - 1), m_head(0) { }
+
+	uint32_t size() const { return m_mask + 1; }
+	uint64_t head() const { return m_head.load(memory_order_acquire); }
+
+	void write(const uint8_t* data, uint32_t len)
+	{
+		uint64_t head = m_head.load(memory_order_relaxed);
+		// a single write never reaches data younger than half of the ring
+		while (len)
+		{
+			uint32_t pos = head & m_mask;
+			uint32_t n = len < size() - pos ? len : size() - pos;
+			if (n > size() / 2)
+				n = size() / 2;
+			memcpy(&m_data[pos], data, n);
+			head += n;
+			data += n;
+			len -= n;
+			m_head.store(head, memory_order_release);
+		}
+	}
+
+	// contiguous span from cursor up to the head
+	uint32_t peek(uint64_t cursor, const uint8_t*& data) const
+	{
+		uint64_t avail = head() - cursor;
+		uint32_t pos = cursor & m_mask;
+		data = &m_data[pos];
+		return avail < size() - pos ? avail : size() - pos;
+	}
+	// true if data at cursor may have been overwritten, readers lagging more
+	// than half of the ring are considered lost
+	bool lost(uint64_t cursor) const { return head() - cursor > size() / 2; }
+
+private:
+	vector<uint8_t> m_data;
+	uint32_t m_mask;
+	atomic<uint64_t> m_head;
+};
+
+#endif
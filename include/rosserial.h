@@ -0,0 +1,71 @@
+#ifndef __ROSSERIAL_H__
+#define __ROSSERIAL_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+// rosserial (protocol version 2) framing:
+//   0xff 0xfe len_lo len_hi len_chk topic_lo topic_hi data[len] chk
+#define ROSSERIAL_SYNC          0xff
+#define ROSSERIAL_VERSION       0xfe
+#define ROSSERIAL_MAX_DATA      65535
+#define ROSSERIAL_HEADER_SIZE   7
+
+#define ROSSERIAL_ID_PUBLISHER  0
+#define ROSSERIAL_ID_SUBSCRIBER 1
+#define ROSSERIAL_ID_LOG        7
+
+struct TTopicStats
+{
+	string name;
+	uint64_t frames, bytes;
+	uint64_t lastFrames, lastBytes; // at the previous report
+};
+
+// Splits the console stream into debug text and rosserial frames. Text is
+// passed on as slices of the input where possible, a frame is assembled in
+// a buffer allocated once. Log messages of the board go to the text output.
+class RosserialDemux
+{
+public:
+	typedef void (*TextCallback)(const uint8_t* data, int len, void* userdata);
+
+	RosserialDemux(TextCallback text, void* userdata);
+	~RosserialDemux();
+
+	// raw copy of every valid frame, none by default
+	void setFrameOutput(FILE* f) { m_frames = f; }
+	void process(const uint8_t* data, int len);
+
+	// one line with the rates since the previous call
+	void printRates(FILE* f, double interval);
+	void printSummary(FILE* f);
+
+private:
+	enum EState
+	{
+		ST_TEXT, ST_VERSION, ST_LEN_LO, ST_LEN_HI, ST_LEN_CHK, ST_TOPIC_LO, ST_TOPIC_HI, ST_DATA, ST_CHK
+	};
+
+	TextCallback m_text;
+	void* m_userdata;
+	FILE* m_frames;
+	EState m_state;
+	uint8_t* m_frame; // header and data of the frame being received
+	uint32_t m_fill, m_len;
+	uint16_t m_topic;
+	uint8_t m_sum;
+	map<uint16_t, TTopicStats> m_topics;
+	uint64_t m_badFrames;
+
+	void frameDone();
+	void dropFrame();
+	void parseTopicInfo(const uint8_t* data, uint32_t len);
+	void parseLog(const uint8_t* data, uint32_t len);
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __SOFTBATCH_H__
+#define __SOFTBATCH_H__
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "ihex.h"
+
+// Updates several boards with one image through their OpenBLT bootloaders.
+// Every board gets its own XCP session on its own device (see --soft), at
+// most workers boards are flashed at the same time. verifyMode is an
+// EVerifyMode or -1 to skip the verification. Returns 0 if all boards
+// were updated.
+int runSoftBatch(THexFile& image, const vector<string>& devices, int baudrate, int workers, int verifyMode);
+
+#endif
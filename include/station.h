@@ -0,0 +1,62 @@
+#ifndef __STATION_H__
+#define __STATION_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <pthread.h>
+
+#include "ihex.h"
+
+enum EStationStage
+{
+	STAGE_SETUP, STAGE_ERASE, STAGE_PROGRAM, STAGE_PROTECT, STAGE_RESET, STAGE_REGISTER
+};
+
+struct TStationJob;
+class HardFlasher;
+
+// one board identity of a registration manifest
+struct TIdentity
+{
+	int serial;
+	uint8_t key[16];
+	bool used;
+};
+
+// Production station: stays resident with one parsed image and runs the
+// configured pipeline on every newly attached CORE2 board, several at once.
+class Station
+{
+public:
+	Station(THexFile& image, int baudrate);
+
+	int setPipeline(const string& pipeline);
+	int setLog(const string& path);
+	// identities for the register stage, claimed ones are kept in <path>.claims
+	int setManifest(const string& path, uint32_t version, int type, int headerId);
+
+	int run();
+
+private:
+	THexFile& m_image;
+	int m_baudrate;
+	vector<EStationStage> m_stages;
+	FILE* m_log;
+
+	vector<TIdentity> m_identities;
+	FILE* m_claims;
+	pthread_mutex_t m_claimMutex;
+	uint32_t m_regVersion;
+	int m_regType, m_regHeaderId;
+
+	void runBoard(TStationJob* job);
+	int runStage(HardFlasher& flasher, EStationStage stage, TStationJob* job);
+	int registerBoard(HardFlasher& flasher, TStationJob* job);
+	TIdentity* claimIdentity(const string& board);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __STUBPROTO_H__
+#define __STUBPROTO_H__
+
+/*
+ * Protocol spoken between the host and the RAM-resident flashing stub
+ * (stub/flashstub.c). Shared by both sides, so it must stay plain C.
+ *
+ * The stub is uploaded with WRITE_MEMORY to STUB_LOAD_ADDR and started with
+ * GO. It does not rely on anything the bootloader set up: it runs from HSI
+ * and opens the bootloader USARTs (8E1) at the baudrate the host writes to
+ * STUB_BAUDRATE_OFFSET of the image before the upload. It receives through a
+ * circular DMA buffer, so the host may keep up to STUB_WINDOW bytes of
+ * commands in flight and collect the replies later.
+ *
+ * Every command is a stub_cmd_t header followed by len payload bytes, padded
+ * with zeros to a multiple of 4, followed by a CRC over header and padded
+ * payload. Every command is answered with one stub_reply_t. All CRCs are the
+ * ones computed by the STM32 CRC unit (see crc32_stm32 in utils.h).
+ */
+
+#include <stdint.h>
+
+#define STUB_LOAD_ADDR   0x20003000 /* the system bootloader uses the RAM below */
+#define STUB_VERSION     2
+#define STUB_BAUDRATE_OFFSET 8      /* uint32_t after the stack pointer and entry point */
+#define STUB_MAX_BAUDRATE 2000000   /* 16 MHz HSI with oversampling by 8 */
+
+#define STUB_SOF         0xa5
+#define STUB_BLOCK_SIZE  4096       /* max uncompressed WRITE length */
+#define STUB_RING_SIZE   16384      /* stub DMA receive buffer */
+#define STUB_WINDOW      (STUB_RING_SIZE - 1024)
+
+enum
+{
+	STUB_CMD_PING  = 0x01, /* reply value: STUB_VERSION */
+	STUB_CMD_BAUD  = 0x02, /* arg: new baud, reply sent before switching */
+	STUB_CMD_ERASE = 0x03, /* arg: sector number */
+	STUB_CMD_WRITE = 0x04, /* addr, arg: uncompressed length, payload: data */
+	STUB_CMD_CRC   = 0x05, /* addr, arg: length, reply value: CRC of the flash range */
+	STUB_CMD_RESET = 0x06, /* no reply, system reset */
+};
+
+#define STUB_FLAG_COMPRESSED 0x01 /* WRITE payload is an LZ4 block */
+
+enum
+{
+	STUB_OK = 0,
+	STUB_ERR_CRC,
+	STUB_ERR_CMD,
+	STUB_ERR_ARG,
+	STUB_ERR_DECOMPRESS,
+	STUB_ERR_FLASH,
+	STUB_ERR_VERIFY,
+};
+
+#pragma pack(1)
+typedef struct
+{
+	uint8_t sof, cmd, seq, flags;
+	uint32_t addr;
+	uint32_t arg;
+	uint16_t len;
+	uint16_t reserved;
+} stub_cmd_t;
+
+typedef struct
+{
+	uint8_t sof, cmd, seq, status;
+	uint32_t value;
+	uint32_t crc; /* over the first 8 bytes */
+} stub_reply_t;
+#pragma pack()
+
+#endif
@@ -8,7 +8,30 @@
 using namespace std;
 
 uint16_t crc16_calc(const uint8_t* data, int len);
+// CRC-32 as computed by the STM32 CRC unit: little-endian words fed MSB first,
+// polynomial 0x04C11DB7, no reflection, no final xor; len must be a multiple of 4
+uint32_t crc32_stm32(const uint8_t* data, int len, uint32_t crc = 0xffffffff);
+class TSha256
+{
+public:
+	TSha256();
+
+	void update(const void* data, size_t len);
+	void final(uint8_t digest[32]);
+
+private:
+	uint32_t m_state[8];
+	uint64_t m_length;
+	uint8_t m_buf[64];
+	size_t m_bufLen;
+
+	void transform(const uint8_t* block);
+};
+
 vector<string> splitString(const string& str, const string& delim, size_t maxCount = 0, size_t start = 0);
+string jsonEscape(const string& str);
+// decodes exactly len bytes from 2*len hex digits
+bool hexDecode(const string& str, uint8_t* data, int len);
 
 extern int log_debug;
 #define LOG_NICE(x,...) \
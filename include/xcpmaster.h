@@ -53,18 +53,43 @@
 #include "xcptransport.h"                             /* XCP transport layer           */
 
 
+/****************************************************************************************
+* Type definitions
+****************************************************************************************/
+/** \brief Connection to one XCP slave. Sessions are independent of each other, so each
+ *         board can be flashed from its own thread.
+ */
+typedef struct
+{
+  tXcpTransport *transport;       /**< transport layer, NULL when not initialized      */
+  uint8_t slaveIsIntel;           /**< byte ordering of the slave                       */
+  uint8_t maxCto;                 /**< max bytes in a command packet (master->slave)    */
+  uint8_t maxProgCto;             /**< max bytes in a command packet while programming  */
+  uint8_t maxDto;                 /**< max bytes in a data packet (slave->master)       */
+  uint8_t slaveBlockMode;         /**< slave answers an upload with several packets     */
+  uint8_t maxProgBlock;           /**< max bytes of a PROGRAM block, 0 if not supported */
+  uint8_t minStPgm;               /**< separation time of block packets in 100 us units */
+} tXcpSession;
+
+
 /****************************************************************************************
 * Function prototypes
 ****************************************************************************************/
-uint8_t XcpMasterInit(const char *device, uint32_t baudrate);
-void    XcpMasterDeinit(void);
-uint8_t XcpMasterConnect(void);
-uint8_t XcpMasterDisconnect(void);
-uint8_t XcpMasterStartProgrammingSession(void);
-uint8_t XcpMasterStopProgrammingSession(void);
-uint8_t XcpMasterClearMemory(uint32_t addr, uint32_t len);
-uint8_t XcpMasterReadData(uint32_t addr, uint32_t len, uint8_t data[]);
-uint8_t XcpMasterProgramData(uint32_t addr, uint32_t len, uint8_t data[]);
+uint8_t XcpMasterInit(tXcpSession *session, const char *device, uint32_t baudrate);
+void    XcpMasterDeinit(tXcpSession *session);
+uint8_t XcpMasterConnect(tXcpSession *session);
+uint8_t XcpMasterDisconnect(tXcpSession *session);
+uint8_t XcpMasterStartProgrammingSession(tXcpSession *session);
+uint8_t XcpMasterStopProgrammingSession(tXcpSession *session);
+uint8_t XcpMasterFinishProgramming(tXcpSession *session);
+uint8_t XcpMasterClearMemory(tXcpSession *session, uint32_t addr, uint32_t len);
+uint8_t XcpMasterReadData(tXcpSession *session, uint32_t addr, uint32_t len, uint8_t data[]);
+uint8_t XcpMasterProgramData(tXcpSession *session, uint32_t addr, uint32_t len,
+                             uint8_t data[]);
+uint8_t XcpMasterVerifyData(tXcpSession *session, uint32_t addr, uint32_t len,
+                            uint8_t data[]);
+uint8_t XcpMasterCompareData(tXcpSession *session, uint32_t addr, uint32_t len,
+                             uint8_t data[]);
 
 
 #endif /* XCPMASTER_H */
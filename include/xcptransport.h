@@ -38,6 +38,16 @@
 #include <string>
 using namespace std;
 
+/****************************************************************************************
+* Macro definitions
+****************************************************************************************/
+/** \brief Devices starting with this prefix are reached through the FTDI chip of the
+ *         board with libftdi instead of a serial port. The rest of the name is the
+ *         optional serial number of the chip.
+ */
+#define XCP_TRANSPORT_FTDI_PREFIX      "ftdi:"
+
+
 /****************************************************************************************
 * Type definitions
 ****************************************************************************************/
@@ -47,15 +57,31 @@ typedef struct
   uint8_t len;
 } tXcpTransportResponsePacket;
 
+/** \brief State of one opened communication channel, defined by the port. Channels
+ *         are independent, so several can be used from different threads at once.
+ *         An FTDI channel belongs to the thread that opened it.
+ */
+typedef struct tXcpTransport tXcpTransport;
+
 
 /****************************************************************************************
 * EFunction prototypes
 ****************************************************************************************/
-uint8_t XcpTransportInit(const char *device, uint32_t baudrate);
-uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs);
-tXcpTransportResponsePacket *XcpTransportReadResponsePacket(void);
-void XcpTransportClose(void);
+tXcpTransport *XcpTransportInit(const char *device, uint32_t baudrate);
+uint8_t XcpTransportSendPacket(tXcpTransport *transport, uint8_t *data, uint8_t len,
+                               uint16_t timeOutMs);
+uint8_t XcpTransportWritePacket(tXcpTransport *transport, uint8_t *data, uint8_t len);
+uint8_t XcpTransportReceivePacket(tXcpTransport *transport, uint16_t timeOutMs);
+tXcpTransportResponsePacket *XcpTransportReadResponsePacket(tXcpTransport *transport);
+void XcpTransportClose(tXcpTransport *transport);
+/* error of the last failed call in the calling thread */
 const string& XcpTransportGetLastError();
 
+/* FTDI transport, shared by the ports */
+uint8_t XcpFtdiInit(const char *serial, uint32_t baudrate, uint8_t *ownsHandle);
+uint8_t XcpFtdiWritePacket(uint8_t *data, uint8_t len);
+uint8_t XcpFtdiReceivePacket(tXcpTransportResponsePacket *packet, uint16_t timeOutMs);
+void    XcpFtdiClose(uint8_t ownsHandle);
+
 #endif /* XCPTRANSPORT_H */
 /*********************************** end of xcptransport.h *****************************/
@@ -40,7 +40,15 @@
 #include <unistd.h>                                   /* UNIX standard functions       */
 #include <fcntl.h>                                    /* file control definitions      */
 #include <errno.h>                                    /* error number definitions      */
+#include <poll.h>                                     /* waiting for I/O with timeout  */
+#include <sys/ioctl.h>                                /* device control                */
+#include <sys/uio.h>                                  /* scatter/gather I/O            */
+#ifdef __linux__
+#include <asm/termbits.h>                             /* termios2 with any baudrate    */
+#include <linux/serial.h>                             /* low latency serial flag       */
+#else
 #include <termios.h>                                  /* POSIX terminal control        */
+#endif
 #include "xcpmaster.h"                                /* XCP master protocol module    */
 #include "timeutil.h"                                 /* time utility module           */
 
@@ -52,28 +60,47 @@
 /** \brief Invalid UART device/file handle. */
 #define UART_INVALID_HANDLE      (-1)
 
-/** \brief maximum number of bytes in a transmit/receive XCP packet in UART. */
-#define XCP_MASTER_UART_MAX_DATA ((XCP_MASTER_TX_MAX_DATA>XCP_MASTER_RX_MAX_DATA) ? \
-                                  (XCP_MASTER_TX_MAX_DATA+1) : (XCP_MASTER_RX_MAX_DATA+1))
+/** \brief Size of the reception buffer, holds a few packets of a block upload. */
+#define UART_RX_BUFFER_SIZE      (4 * (XCP_MASTER_RX_MAX_DATA + 1))
+
+/** \brief Added to every reception timeout. Covers one 16 ms latency timer period of
+ *         USB serial adapters that ignore ASYNC_LOW_LATENCY plus the turnaround, so
+ *         short timeouts such as the one of CONNECT still see the response.
+ */
+#define UART_RX_TIMEOUT_MARGIN_MS (20)
+
 
-/** \brief The smallest time in millisecond that the UART is configured for. */
-#define UART_RX_TIMEOUT_MIN_MS   (100)
+/****************************************************************************************
+* Type definitions
+****************************************************************************************/
+struct tXcpTransport
+{
+	tXcpTransportResponsePacket responsePacket;
+	int32_t hUart;
+	uint8_t useFtdi;
+	uint8_t ownsFtdi;
+	/** \brief Bytes read from the device but not yet consumed by a packet. */
+	uint8_t rxBuffer[UART_RX_BUFFER_SIZE];
+	uint16_t rxStart;
+	uint16_t rxEnd;
+};
 
 
 /****************************************************************************************
 * Function prototypes
 ****************************************************************************************/
-static speed_t   XcpTransportGetBaudrateMask(uint32_t baudrate);
+static uint8_t XcpTransportConfigure(tXcpTransport *transport, uint32_t baudrate);
+static uint8_t XcpTransportWait(tXcpTransport *transport, short events, uint32_t timeoutTime);
+static uint8_t XcpTransportReadBytes(tXcpTransport *transport, uint8_t *data, uint16_t len,
+                                     uint32_t timeoutTime);
 
 
 /****************************************************************************************
 * Local data declarations
 ****************************************************************************************/
-static tXcpTransportResponsePacket responsePacket;
-static int32_t hUart = UART_INVALID_HANDLE;
+static thread_local string error;
 
-string error;
-void setError()
+static void setError()
 {
 	char buf[256];
 	error = strerror_r(errno, (char*)&buf, 256);
@@ -84,70 +111,50 @@ const string& XcpTransportGetLastError()
 }
 /************************************************************************************//**
 ** \brief     Initializes the communication interface used by this transport layer.
-** \param     device Serial communication device name. For example "COM4".
+** \param     device Serial communication device name. For example "/dev/ttyUSB0".
 ** \param     baudrate Communication speed in bits/sec.
 ** \return    true if successful, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
+tXcpTransport *XcpTransportInit(const char *device, uint32_t baudrate)
 {
-	struct termios options;
+	tXcpTransport *transport = new tXcpTransport();
 	
-	/* open the port */
-	hUart = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
-	/* verify the result */
-	if (hUart == UART_INVALID_HANDLE)
-	{
-		setError();
-		return false;
-	}
-	/* configure the device to block during read operations */
-	if (fcntl(hUart, F_SETFL, 0) == -1)
-	{
-		XcpTransportClose();
-		return false;
-	}
-	/* get the current options for the port */
-	if (tcgetattr(hUart, &options) == -1)
-	{
-		XcpTransportClose();
-		return false;
-	}
-	/* configure the baudrate */
-	if (cfsetispeed(&options, XcpTransportGetBaudrateMask(baudrate)) == -1)
+	transport->hUart = UART_INVALID_HANDLE;
+	transport->useFtdi = false;
+	transport->rxStart = 0;
+	transport->rxEnd = 0;
+	
+	/* the FTDI chip of the board is driven directly, without a tty */
+	if (strncmp(device, XCP_TRANSPORT_FTDI_PREFIX, strlen(XCP_TRANSPORT_FTDI_PREFIX)) == 0)
 	{
-		XcpTransportClose();
-		return false;
+		if (XcpFtdiInit(device + strlen(XCP_TRANSPORT_FTDI_PREFIX), baudrate, &transport->ownsFtdi) == false)
+		{
+			error = "unable to open FTDI device";
+			delete transport;
+			return 0;
+		}
+		transport->useFtdi = true;
+		return transport;
 	}
-	if (cfsetospeed(&options, XcpTransportGetBaudrateMask(baudrate)) == -1)
+	
+	/* open the port, all waiting is done with poll() */
+	transport->hUart = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	/* verify the result */
+	if (transport->hUart == UART_INVALID_HANDLE)
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		delete transport;
+		return 0;
 	}
-	/* enable the receiver and set local mode */
-	options.c_cflag |= (CLOCAL | CREAD);
-	/* configure 8-n-1 */
-	options.c_cflag &= ~PARENB;
-	options.c_cflag &= ~CSTOPB;
-	options.c_cflag &= ~CSIZE;
-	options.c_cflag |= CS8;
-	/* disable hardware flow control */
-	options.c_cflag &= ~CRTSCTS;
-	/* configure raw input */
-	options.c_lflag &= ~(ICANON | ISIG);
-	/* configure raw output */
-	options.c_oflag &= ~OPOST;
-	/* configure timeouts */
-	options.c_cc[VMIN]  = 0;
-	options.c_cc[VTIME] = UART_RX_TIMEOUT_MIN_MS / 100; /* 1/10th of a second */
-	/* set the new options for the port */
-	if (tcsetattr(hUart, TCSAFLUSH, &options) == -1)
+	if (XcpTransportConfigure(transport, baudrate) == false)
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	/* success */
-	return true;
+	return transport;
 } /*** end of XcpTransportInit ***/
 
 
@@ -160,85 +167,119 @@ uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
 **            false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
+uint8_t XcpTransportSendPacket(tXcpTransport *transport, uint8_t *data, uint8_t len,
+                               uint16_t timeOutMs)
 {
-	uint16_t cnt;
-	static uint8_t xcpUartBuffer[XCP_MASTER_UART_MAX_DATA]; /* static to lower stack load */
-	uint16_t xcpUartLen;
-	int32_t bytesSent;
-	int32_t bytesToRead;
-	int32_t bytesRead;
-	uint8_t *uartReadDataPtr;
-	uint32_t timeoutTime;
-	// uint32_t nowTime;
-	ssize_t result;
-	
-	/* ------------------------ XCP packet transmission -------------------------------- */
-	/* prepare the XCP packet for transmission on UART. this is basically the same as the
-	 * xcp packet data but just the length of the packet is added to the first byte.
-	 */
-	xcpUartLen = len + 1;
-	xcpUartBuffer[0] = len;
-	for (cnt = 0; cnt < len; cnt++)
+	if (XcpTransportWritePacket(transport, data, len) == false)
 	{
-		xcpUartBuffer[cnt + 1] = data[cnt];
+		return false;
 	}
+	return XcpTransportReceivePacket(transport, timeOutMs);
+} /*** end of XcpMasterTpSendPacket ***/
+
+
+/************************************************************************************//**
+** \brief     Transmits an XCP packet on the transport layer without waiting for a
+**            response. Used for packets the slave does not respond to, such as all but
+**            the last packet of a block transfer.
+** \return    true if the packet was transmitted, false otherwise.
+**
+****************************************************************************************/
+uint8_t XcpTransportWritePacket(tXcpTransport *transport, uint8_t *data, uint8_t len)
+{
+	struct iovec iov[2];
+	int iovIdx = 0;
+	ssize_t result;
+	uint32_t timeoutTime;
 	
-	bytesSent = write(hUart, xcpUartBuffer, xcpUartLen);
-	
-	if (bytesSent != xcpUartLen)
+	if (transport->useFtdi == true)
 	{
-		return false;
+		return XcpFtdiWritePacket(data, len);
 	}
 	
-	/* ------------------------ XCP packet reception ----------------------------------- */
-	/* determine timeout time */
-	timeoutTime = TimeUtilGetSystemTimeMs() + timeOutMs + UART_RX_TIMEOUT_MIN_MS;
+	/* the length byte and the packet data go out with a single system call, without
+	 * copying the packet
+	 */
+	iov[0].iov_base = &len;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
 	
-	/* read the first byte, which contains the length of the xcp packet that follows */
-	bytesToRead = 1;
-	uartReadDataPtr = &responsePacket.len;
-	while (bytesToRead > 0)
+	/* a full transmit buffer drains within a few character times */
+	timeoutTime = TimeUtilGetSystemTimeMs() + XCP_MASTER_TX_MAX_DATA + 100;
+	while (iovIdx < 2)
 	{
-		result = read(hUart, uartReadDataPtr, bytesToRead);
-		if (result != -1)
+		result = writev(transport->hUart, &iov[iovIdx], 2 - iovIdx);
+		if (result < 0)
 		{
-			bytesRead = result;
-			/* update the bytes that were already read */
-			uartReadDataPtr += bytesRead;
-			bytesToRead -= bytesRead;
+			if ((errno != EAGAIN) && (errno != EINTR))
+			{
+				setError();
+				return false;
+			}
+			if (XcpTransportWait(transport, POLLOUT, timeoutTime) == false)
+			{
+				return false;
+			}
+			continue;
 		}
-		/* check for timeout if not yet done */
-		if ((bytesToRead > 0) && (TimeUtilGetSystemTimeMs() >= timeoutTime))
+		/* skip what was written, a partial write continues where it stopped */
+		while ((iovIdx < 2) && ((size_t)result >= iov[iovIdx].iov_len))
 		{
-			/* timeout occurred */
-			return false;
+			result -= iov[iovIdx].iov_len;
+			iovIdx++;
+		}
+		if (iovIdx < 2)
+		{
+			iov[iovIdx].iov_base = (uint8_t *)iov[iovIdx].iov_base + result;
+			iov[iovIdx].iov_len -= result;
 		}
 	}
+	return true;
+} /*** end of XcpTransportWritePacket ***/
+
+
+/************************************************************************************//**
+** \brief     Attempts to receive the next XCP packet within the given timeout. The data
+**            is stored like the response of XcpTransportSendPacket(). Used to collect
+**            the further response packets of a block upload.
+** \return    true is the packet was successfully received and stored, false otherwise.
+**
+****************************************************************************************/
+uint8_t XcpTransportReceivePacket(tXcpTransport *transport, uint16_t timeOutMs)
+{
+	tXcpTransportResponsePacket *packet = &transport->responsePacket;
+	uint32_t timeoutTime;
 	
-	/* read the rest of the packet */
-	bytesToRead = responsePacket.len;
-	uartReadDataPtr = &responsePacket.data[0];
-	while (bytesToRead > 0)
+	if (transport->useFtdi == true)
 	{
-		result = read(hUart, uartReadDataPtr, bytesToRead);
-		if (result != -1)
-		{
-			bytesRead = result;
-			/* update the bytes that were already read */
-			uartReadDataPtr += bytesRead;
-			bytesToRead -= bytesRead;
-		}
-		/* check for timeout if not yet done */
-		if ((bytesToRead > 0) && (TimeUtilGetSystemTimeMs() >= timeoutTime))
-		{
-			/* timeout occurred */
-			return false;
-		}
+		return XcpFtdiReceivePacket(packet, timeOutMs);
+	}
+	
+	/* determine timeout time */
+	timeoutTime = TimeUtilGetSystemTimeMs() + timeOutMs + UART_RX_TIMEOUT_MARGIN_MS;
+	
+	/* read the first byte, which contains the length of the xcp packet that follows,
+	 * then the rest of the packet
+	 */
+	if ( (XcpTransportReadBytes(transport, &packet->len, 1, timeoutTime) == false) ||
+	     (XcpTransportReadBytes(transport, packet->data, packet->len, timeoutTime) == false) )
+	{
+		/* timeout occurred, drop the partial packet and whatever already arrived of a
+		 * late response, so the next read does not take it for a new packet
+		 */
+		transport->rxStart = 0;
+		transport->rxEnd = 0;
+#ifdef __linux__
+		ioctl(transport->hUart, TCFLSH, TCIFLUSH);
+#else
+		tcflush(transport->hUart, TCIFLUSH);
+#endif
+		return false;
 	}
 	/* still here so the complete packet was received */
 	return true;
-} /*** end of XcpMasterTpSendPacket ***/
+} /*** end of XcpTransportReceivePacket ***/
 
 
 /************************************************************************************//**
@@ -248,9 +289,9 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 ** \return    Pointer to the response packet data.
 **
 ****************************************************************************************/
-tXcpTransportResponsePacket *XcpTransportReadResponsePacket(void)
+tXcpTransportResponsePacket *XcpTransportReadResponsePacket(tXcpTransport *transport)
 {
-	return &responsePacket;
+	return &transport->responsePacket;
 } /*** end of XcpTransportReadResponsePacket ***/
 
 
@@ -259,61 +300,196 @@ tXcpTransportResponsePacket *XcpTransportReadResponsePacket(void)
 ** \return    none.
 **
 ****************************************************************************************/
-void XcpTransportClose(void)
+void XcpTransportClose(tXcpTransport *transport)
 {
+	if (transport->useFtdi == true)
+	{
+		XcpFtdiClose(transport->ownsFtdi);
+	}
+	
 	/* close the COM port handle if valid */
-	if (hUart != UART_INVALID_HANDLE)
+	if (transport->hUart != UART_INVALID_HANDLE)
 	{
-		close(hUart);
+		close(transport->hUart);
 	}
 	
-	/* set handles to invalid */
-	hUart = UART_INVALID_HANDLE;
+	delete transport;
 } /*** end of XcpTransportClose ***/
 
 
 /************************************************************************************//**
-** \brief     Converts the baudrate value to a bitmask value used by termios. Currently
-**            supports the most commonly used baudrates.
-** \return    none.
+** \brief     Configures the opened device for raw 8-n-1 communication. On Linux any
+**            baudrate the driver can generate is accepted and the low latency mode of
+**            the driver is requested, which lowers the latency timer of USB serial
+**            adapters.
+** \param     baudrate Communication speed in bits/sec.
+** \return    true if successful, false otherwise.
 **
 ****************************************************************************************/
-static speed_t XcpTransportGetBaudrateMask(uint32_t baudrate)
+static uint8_t XcpTransportConfigure(tXcpTransport *transport, uint32_t baudrate)
 {
-	speed_t result;
+	int32_t hUart = transport->hUart;
+#ifdef __linux__
+	struct termios2 options;
+	struct serial_struct serial;
+	
+	/* get the current options for the port */
+	if (ioctl(hUart, TCGETS2, &options) == -1)
+	{
+		return false;
+	}
+	/* configure the baudrate directly instead of through a Bxxx constant */
+	options.c_cflag &= ~CBAUD;
+	options.c_cflag |= BOTHER;
+	options.c_ispeed = baudrate;
+	options.c_ospeed = baudrate;
+#else
+	struct termios options;
 	
-	switch (baudrate)
+	/* get the current options for the port */
+	if (tcgetattr(hUart, &options) == -1)
+	{
+		return false;
+	}
+	/* configure the baudrate */
+	if (cfsetspeed(&options, baudrate) == -1)
 	{
-#ifndef __APPLE__
-	case 921600:
-		result = B921600;
-		break;
-	case 460800:
-		result = B460800;
-		break;
+		return false;
+	}
 #endif
-	case 230400:
-		result = B230400;
-		break;
-	case 115200:
-		result = B115200;
-		break;
-	case 57600:
-		result = B57600;
-		break;
-	case 38400:
-		result = B38400;
-		break;
-	case 19200:
-		result = B19200;
-		break;
-	case 9600:
-	default:
-		result = B9600;
-		break;
+	/* enable the receiver and set local mode */
+	options.c_cflag |= (CLOCAL | CREAD);
+	/* configure 8-n-1 */
+	options.c_cflag &= ~PARENB;
+	options.c_cflag &= ~CSTOPB;
+	options.c_cflag &= ~CSIZE;
+	options.c_cflag |= CS8;
+	/* disable hardware and software flow control */
+	options.c_cflag &= ~CRTSCTS;
+	options.c_iflag &= ~(IXON | IXOFF | IXANY);
+	/* configure raw input */
+	options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+	options.c_lflag &= ~(ICANON | ISIG | ECHO | ECHONL | IEXTEN);
+	/* configure raw output */
+	options.c_oflag &= ~OPOST;
+	/* reads never block, poll() does the waiting */
+	options.c_cc[VMIN]  = 0;
+	options.c_cc[VTIME] = 0;
+#ifdef __linux__
+	/* set the new options for the port */
+	if (ioctl(hUart, TCSETS2, &options) == -1)
+	{
+		return false;
 	}
-	return result;
-} /*** end of XcpTransportGetBaudrateMask ***/
+	/* request low latency, not every driver supports it */
+	if (ioctl(hUart, TIOCGSERIAL, &serial) == 0)
+	{
+		serial.flags |= ASYNC_LOW_LATENCY;
+		ioctl(hUart, TIOCSSERIAL, &serial);
+	}
+	/* discard anything received before */
+	ioctl(hUart, TCFLSH, TCIOFLUSH);
+#else
+	/* set the new options for the port */
+	if (tcsetattr(hUart, TCSAFLUSH, &options) == -1)
+	{
+		return false;
+	}
+#endif
+	return true;
+} /*** end of XcpTransportConfigure ***/
+
+
+/************************************************************************************//**
+** \brief     Waits until the device is ready for the given poll events.
+** \param     events Poll events to wait for.
+** \param     timeoutTime System time in milliseconds at which to give up.
+** \return    true if the device is ready, false on timeout or error.
+**
+****************************************************************************************/
+static uint8_t XcpTransportWait(tXcpTransport *transport, short events, uint32_t timeoutTime)
+{
+	struct pollfd pfd;
+	int32_t remaining;
+	int result;
+	
+	pfd.fd = transport->hUart;
+	pfd.events = events;
+	for (;;)
+	{
+		remaining = (int32_t)(timeoutTime - TimeUtilGetSystemTimeMs());
+		if (remaining <= 0)
+		{
+			return false;
+		}
+		result = poll(&pfd, 1, remaining);
+		if (result > 0)
+		{
+			/* a hangup or error is reported to the following read or write */
+			return true;
+		}
+		if ((result < 0) && (errno != EINTR))
+		{
+			setError();
+			return false;
+		}
+	}
+} /*** end of XcpTransportWait ***/
+
+
+/************************************************************************************//**
+** \brief     Reads bytes from the reception buffer, refilling it from the device with
+**            everything available as needed.
+** \param     data Destination buffer.
+** \param     len Number of bytes to read.
+** \param     timeoutTime System time in milliseconds at which to give up.
+** \return    true if all bytes were read, false on timeout or error.
+**
+****************************************************************************************/
+static uint8_t XcpTransportReadBytes(tXcpTransport *transport, uint8_t *data, uint16_t len,
+                                     uint32_t timeoutTime)
+{
+	uint16_t cnt;
+	ssize_t result;
+	
+	while (len > 0)
+	{
+		if (transport->rxStart == transport->rxEnd)
+		{
+			transport->rxStart = 0;
+			transport->rxEnd = 0;
+			result = read(transport->hUart, transport->rxBuffer, sizeof(transport->rxBuffer));
+			if (result > 0)
+			{
+				transport->rxEnd = result;
+			}
+			else if ((result == 0) || (errno == EAGAIN) || (errno == EINTR))
+			{
+				if (XcpTransportWait(transport, POLLIN, timeoutTime) == false)
+				{
+					return false;
+				}
+				continue;
+			}
+			else
+			{
+				setError();
+				return false;
+			}
+		}
+		/* take what is buffered */
+		cnt = transport->rxEnd - transport->rxStart;
+		if (cnt > len)
+		{
+			cnt = len;
+		}
+		memcpy(data, &transport->rxBuffer[transport->rxStart], cnt);
+		transport->rxStart += cnt;
+		data += cnt;
+		len -= cnt;
+	}
+	return true;
+} /*** end of XcpTransportReadBytes ***/
 
 
 /*********************************** end of xcptransport.c *****************************/
@@ -55,14 +55,24 @@
 #define UART_RX_TIMEOUT_MIN_MS   (100)
 
 
+/****************************************************************************************
+* Type definitions
+****************************************************************************************/
+struct tXcpTransport
+{
+	tXcpTransportResponsePacket responsePacket;
+	HANDLE hUart;
+	uint8_t useFtdi;
+	uint8_t ownsFtdi;
+};
+
+
 /****************************************************************************************
 * Local data declarations
 ****************************************************************************************/
-static tXcpTransportResponsePacket responsePacket;
-static HANDLE hUart = INVALID_HANDLE_VALUE;
+static thread_local string error;
 
-string error;
-void setError()
+static void setError()
 {
 	DWORD dwLastError = ::GetLastError();
 	TCHAR lpBuffer[256] = TEXT("?");
@@ -87,11 +97,29 @@ const string& XcpTransportGetLastError()
 ** \return    true if successful, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
+tXcpTransport *XcpTransportInit(const char *device, uint32_t baudrate)
 {
 	COMMTIMEOUTS timeouts = { 0 };
 	DCB dcbSerialParams = { 0 };
 	char portStr[64] = "\\\\.\\\0";
+	tXcpTransport *transport = new tXcpTransport();
+	HANDLE hUart;
+	
+	transport->hUart = INVALID_HANDLE_VALUE;
+	transport->useFtdi = false;
+	
+	/* the FTDI chip of the board is driven directly, without a COM port */
+	if (strncmp(device, XCP_TRANSPORT_FTDI_PREFIX, strlen(XCP_TRANSPORT_FTDI_PREFIX)) == 0)
+	{
+		if (XcpFtdiInit(device + strlen(XCP_TRANSPORT_FTDI_PREFIX), baudrate, &transport->ownsFtdi) == false)
+		{
+			error = "unable to open FTDI device";
+			delete transport;
+			return 0;
+		}
+		transport->useFtdi = true;
+		return transport;
+	}
 	
 	/* construct the COM port name as a string */
 	strncat(portStr, device, 59);
@@ -104,15 +132,18 @@ uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
 	if (hUart == INVALID_HANDLE_VALUE)
 	{
 		setError();
-		return false;
+		delete transport;
+		return 0;
 	}
+	transport->hUart = hUart;
 	
 	/* get current COM port configuration */
 	dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
 	if (!GetCommState(hUart, &dcbSerialParams))
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	
 	/* configure the baudrate and 8,n,1 */
@@ -122,8 +153,9 @@ uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
 	dcbSerialParams.Parity = NOPARITY;
 	if (!SetCommState(hUart, &dcbSerialParams))
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	
 	/* set communication timeout parameters */
@@ -134,25 +166,28 @@ uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
 	timeouts.WriteTotalTimeoutMultiplier = 1;
 	if (!SetCommTimeouts(hUart, &timeouts))
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	
 	/* set transmit and receive buffer sizes */
 	if (!SetupComm(hUart, UART_RX_BUFFER_SIZE, UART_TX_BUFFER_SIZE))
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	
 	/* empty the transmit and receive buffers */
 	if (!FlushFileBuffers(hUart))
 	{
-		XcpTransportClose();
-		return false;
+		setError();
+		XcpTransportClose(transport);
+		return 0;
 	}
 	/* successfully connected to the serial device */
-	return true;
+	return transport;
 } /*** end of XcpTransportInit ***/
 
 
@@ -165,18 +200,36 @@ uint8_t XcpTransportInit(const char *device, uint32_t baudrate)
 **            false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
+uint8_t XcpTransportSendPacket(tXcpTransport *transport, uint8_t *data, uint8_t len,
+                               uint16_t timeOutMs)
+{
+	if (XcpTransportWritePacket(transport, data, len) == false)
+	{
+		return false;
+	}
+	return XcpTransportReceivePacket(transport, timeOutMs);
+} /*** end of XcpMasterTpSendPacket ***/
+
+
+/************************************************************************************//**
+** \brief     Transmits an XCP packet on the transport layer without waiting for a
+**            response. Used for packets the slave does not respond to, such as all but
+**            the last packet of a block transfer.
+** \return    true if the packet was transmitted, false otherwise.
+**
+****************************************************************************************/
+uint8_t XcpTransportWritePacket(tXcpTransport *transport, uint8_t *data, uint8_t len)
 {
 	DWORD dwWritten = 0;
-	DWORD dwRead = 0;
-	uint32_t dwToRead;
 	uint16_t cnt;
-	static unsigned char xcpUartBuffer[XCP_MASTER_UART_MAX_DATA]; /* static to lower stack load */
+	unsigned char xcpUartBuffer[XCP_MASTER_UART_MAX_DATA]; /* per call, channels may run in parallel */
 	uint16_t xcpUartLen;
-	uint8_t *uartReadDataPtr;
-	uint32_t timeoutTime;
 	
-	/* ------------------------ XCP packet transmission -------------------------------- */
+	if (transport->useFtdi == true)
+	{
+		return XcpFtdiWritePacket(data, len);
+	}
+	
 	/* prepare the XCP packet for transmission on UART. this is basically the same as the
 	 * xcp packet data but just the length of the packet is added to the first byte.
 	 */
@@ -188,7 +241,7 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 	}
 	
 	/* first submit the XCP packet for transmission */
-	if (!WriteFile(hUart, xcpUartBuffer, xcpUartLen, &dwWritten, 0))
+	if (!WriteFile(transport->hUart, xcpUartBuffer, xcpUartLen, &dwWritten, 0))
 	{
 		return false;
 	}
@@ -197,18 +250,40 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 	{
 		return false;
 	}
+	return true;
+} /*** end of XcpTransportWritePacket ***/
+
+
+/************************************************************************************//**
+** \brief     Attempts to receive the next XCP packet within the given timeout. The data
+**            is stored like the response of XcpTransportSendPacket(). Used to collect
+**            the further response packets of a block upload.
+** \return    true is the packet was successfully received and stored, false otherwise.
+**
+****************************************************************************************/
+uint8_t XcpTransportReceivePacket(tXcpTransport *transport, uint16_t timeOutMs)
+{
+	tXcpTransportResponsePacket *packet = &transport->responsePacket;
+	DWORD dwRead = 0;
+	uint32_t dwToRead;
+	uint8_t *uartReadDataPtr;
+	uint32_t timeoutTime;
+	
+	if (transport->useFtdi == true)
+	{
+		return XcpFtdiReceivePacket(packet, timeOutMs);
+	}
 	
-	/* ------------------------ XCP packet reception ----------------------------------- */
 	/* determine timeout time */
 	timeoutTime = TimeUtilGetSystemTimeMs() + timeOutMs + UART_RX_TIMEOUT_MIN_MS;
 	
 	/* read the first byte, which contains the length of the xcp packet that follows */
 	dwToRead = 1;
-	uartReadDataPtr = &responsePacket.len;
+	uartReadDataPtr = &packet->len;
 	while (dwToRead > 0)
 	{
 		dwRead = 0;
-		if (ReadFile(hUart, uartReadDataPtr, dwToRead, &dwRead, NULL))
+		if (ReadFile(transport->hUart, uartReadDataPtr, dwToRead, &dwRead, NULL))
 		{
 			/* update the bytes that were already read */
 			uartReadDataPtr += dwRead;
@@ -223,12 +298,12 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 	}
 	
 	/* read the rest of the packet */
-	dwToRead = responsePacket.len;
-	uartReadDataPtr = &responsePacket.data[0];
+	dwToRead = packet->len;
+	uartReadDataPtr = &packet->data[0];
 	while (dwToRead > 0)
 	{
 		dwRead = 0;
-		if (ReadFile(hUart, uartReadDataPtr, dwToRead, &dwRead, NULL))
+		if (ReadFile(transport->hUart, uartReadDataPtr, dwToRead, &dwRead, NULL))
 		{
 			/* update the bytes that were already read */
 			uartReadDataPtr += dwRead;
@@ -243,7 +318,7 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 	}
 	/* still here so the complete packet was received */
 	return true;
-} /*** end of XcpMasterTpSendPacket ***/
+} /*** end of XcpTransportReceivePacket ***/
 
 
 /************************************************************************************//**
@@ -253,9 +328,9 @@ uint8_t XcpTransportSendPacket(uint8_t *data, uint8_t len, uint16_t timeOutMs)
 ** \return    Pointer to the response packet data.
 **
 ****************************************************************************************/
-tXcpTransportResponsePacket *XcpTransportReadResponsePacket(void)
+tXcpTransportResponsePacket *XcpTransportReadResponsePacket(tXcpTransport *transport)
 {
-	return &responsePacket;
+	return &transport->responsePacket;
 } /*** end of XcpTransportReadResponsePacket ***/
 
 
@@ -264,16 +339,20 @@ tXcpTransportResponsePacket *XcpTransportReadResponsePacket(void)
 ** \return    none.
 **
 ****************************************************************************************/
-void XcpTransportClose(void)
+void XcpTransportClose(tXcpTransport *transport)
 {
+	if (transport->useFtdi == true)
+	{
+		XcpFtdiClose(transport->ownsFtdi);
+	}
+	
 	/* close the COM port handle if valid */
-	if (hUart != INVALID_HANDLE_VALUE)
+	if (transport->hUart != INVALID_HANDLE_VALUE)
 	{
-		CloseHandle(hUart);
+		CloseHandle(transport->hUart);
 	}
 	
-	/* set handles to invalid */
-	hUart = INVALID_HANDLE_VALUE;
+	delete transport;
 } /*** end of XcpTransportClose ***/
 
 
@@ -0,0 +1,22 @@
+#include "Flasher.h"
+
+Flasher::Flasher()
+	: m_image(&m_hexFile), m_baudrate(460800), m_callback(0)
+{
+}
+
+int Flasher::load(const string& path)
+{
+	m_image = &m_hexFile;
+	return m_hexFile.load(path) ? 0 : -1;
+}
+int Flasher::load(const vector<string>& specs)
+{
+	m_image = &m_hexFile;
+	return m_hexFile.loadImages(specs) ? 0 : -1;
+}
+int Flasher::loadData(const char* data)
+{
+	m_image = &m_hexFile;
+	return m_hexFile.loadData(data) ? 0 : -1;
+}
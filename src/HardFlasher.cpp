@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 
 #include <vector>
 #include <map>
@@ -13,26 +14,88 @@ using namespace std;
 #include "myFTDI.h"
 #include "timeutil.h"
 #include "TRoboCOREHeader.h"
+#include "TImageStamp.h"
+#include "TDeviceSnapshot.h"
 #include "utils.h"
+#include "devicecache.h"
+#include "flashstub.h"
+
+#ifdef EMBED_STUB
+#include "flashstub_data.h"
+#endif
 
 #define ACK 0x79
 #define NACK 0x1f
 
 #define TIMEOUT (1000)
 
+// FTDI latency timer, the default 16 ms would be added to every ACK
+#define LATENCY_MS (1)
+
+// the system bootloader takes a few ms to start after the stub resets the chip
+#define BOOTLOADER_SYNC_ATTEMPTS 10
+// write protect, write unprotect and option byte changes reset the chip
+// a few ms after the final ACK
+#define RESYNC_DELAY_MS 20
+#define RESYNC_PROBE_TIMEOUT 20
+#define RESYNC_ATTEMPTS 25
+
+class UartStubLink : public StubLink
+{
+public:
+	int write(const void* data, int len) { return uart_tx(data, len); }
+	int read(void* data, int len, int timeout) { return uart_rx(data, len, timeout); }
+	int flush() { return uart_flush_rx(); }
+	int setBaudrate(int baudrate) { return uart_setspeed(baudrate); }
+};
+static UartStubLink uartStubLink;
+
 uint32_t SWAP32(uint32_t v)
 {
 	return ((v & 0x000000ff) << 24) | ((v & 0x0000ff00) << 8) |
 	       ((v & 0x00ff0000) >> 8) | ((v & 0xff000000) >> 24);
 }
 
-int HardFlasher::load(const string& path)
+HardFlasher::HardFlasher()
+	: m_maxAttempts(0), m_fastBaudrate(0), m_stub(0), m_stampAddr(0), m_plugInMsgShown(false)
+{
+}
+
+int HardFlasher::loadStub(const string& path)
 {
-	return m_hexFile.load(path) ? 0 : -1;
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+		return -1;
+	uint8_t buf[4096];
+	int r;
+	m_stubImage.clear();
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		m_stubImage.insert(m_stubImage.end(), buf, buf + r);
+	fclose(f);
+	return m_stubImage.empty() ? -1 : 0;
+}
+bool HardFlasher::hasStub()
+{
+#ifdef EMBED_STUB
+	return true;
+#else
+	return !m_stubImage.empty();
+#endif
 }
-int HardFlasher::loadData(const char* data)
+int HardFlasher::setStampAddress(uint32_t addr)
 {
-	return m_hexFile.loadData(data) ? 0 : -1;
+	uint32_t end = addr + sizeof(TImageStamp);
+	if (addr & 3 || addr < flashLayout[0].sector_start ||
+	    end > flashLayout[flashPages - 1].sector_start + flashLayout[flashPages - 1].sector_size)
+		return -1;
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
+		if (addr <= part->getEndAddr() && end > part->getStartAddr())
+			return -1;
+	}
+	m_stampAddr = addr;
+	return 0;
 }
 
 int HardFlasher::init()
@@ -47,10 +110,23 @@ int HardFlasher::open()
 	config.cbus1 = IOMODE;
 	config.cbus2 = KEEP_AWAKE;
 	config.cbus3 = DRIVE_0;
-	return uart_open_with_config(m_baudrate, config, false);
+	uart_select_device(m_device.c_str());
+	int res = uart_open_with_config(m_baudrate, config, false);
+	if (res == 0)
+	{
+		// the latency the bootloader was last verified with at this speed
+		TDeviceCacheEntry entry;
+		int latency = LATENCY_MS;
+		if (deviceCacheGet(uart_get_serial(), entry) && entry.baudrate == m_baudrate && entry.latency > 0)
+			latency = entry.latency;
+		uart_set_latency(latency);
+	}
+	return res;
 }
 int HardFlasher::close(bool reset)
 {
+	delete m_stub;
+	m_stub = 0;
 	if (uart_is_opened())
 	{
 		if (reset)
@@ -64,17 +140,23 @@ int HardFlasher::start(bool initBootloader)
 {
 	LOG_NICE("Connecting to the Husarion device...");
 
+	int attempts = 0;
 retry_uart_open:
 	// uart opening loop
 	LOG_DEBUG("trying to open uart...");
 	for (;;)
 	{
+		if (m_maxAttempts && attempts++ >= m_maxAttempts)
+		{
+			LOG_NICE(" failed\r\n");
+			LOG_DEBUG("no device after %d attempts", m_maxAttempts);
+			return -1;
+		}
 		if (open())
 		{
-			static bool plugInMsgShown = false;
-			if (!plugInMsgShown)
+			if (!m_plugInMsgShown)
 			{
-				plugInMsgShown = true;
+				m_plugInMsgShown = true;
 				LOG_NICE(" plug in Husarion device..");
 			}
 			else
@@ -119,10 +201,38 @@ retry_uart_open:
 			// if (getVersion())
 			// return -1;
 			LOG_NICE(" ");
-			if (getCommand())
-				return -1;
-			// if (getID())
-			// return -1;
+
+			TDeviceCacheEntry entry;
+			if (deviceCacheGet(uart_get_serial(), entry) && entry.hasCmds && entry.baudrate == m_baudrate)
+			{
+				LOG_DEBUG("bootloader commands from device cache");
+				m_dev.bootVersion = entry.bootVersion;
+				memcpy(m_dev.cmds, entry.cmds, sizeof(m_dev.cmds));
+				m_dev.id = entry.chipId;
+				// the bootloader answered as cached, keep the entry fresh
+				deviceCachePut(entry);
+			}
+			else
+			{
+				if (getCommand())
+				{
+					invalidateCache();
+					return -1;
+				}
+				if (getID())
+				{
+					invalidateCache();
+					return -1;
+				}
+
+				entry.hasCmds = true;
+				entry.bootVersion = m_dev.bootVersion;
+				memcpy(entry.cmds, m_dev.cmds, sizeof(entry.cmds));
+				entry.chipId = m_dev.id;
+				entry.baudrate = m_baudrate;
+				entry.latency = uart_get_latency();
+				deviceCachePut(entry);
+			}
 
 			LOG_DEBUG("OK");
 			LOG_NICE("OK\n");
@@ -137,18 +247,37 @@ retry_uart_open:
 	}
 
 	LOG_DEBUG("no bootloader response after %d retries, resetting uart...", tries);
+	invalidateCache();
 	LOG_NICE(" UNABLE (restarting)\n");
 	LOG_NICE("Connecting to the Husarion device...");
 	uart_close();
 	goto retry_uart_open;
 }
+int HardFlasher::reconnect()
+{
+	// the stub does not survive the reset
+	delete m_stub;
+	m_stub = 0;
+
+	if (uart_is_opened())
+	{
+		uint32_t startTime = TimeUtilGetSystemTimeMs();
+		if (resync() == 0)
+		{
+			LOG_DEBUG("bootloader resynchronized in %u ms", TimeUtilGetSystemTimeMs() - startTime);
+			return 0;
+		}
+		LOG_DEBUG("unable to resynchronize, reconnecting...");
+	}
+	return start();
+}
 int HardFlasher::erase()
 {
 	map<int, int> pages;
 
-	for (int i = 0; i < (int)m_hexFile.parts.size(); i++)
+	for (int i = 0; i < (int)m_image->parts.size(); i++)
 	{
-		TPart* part = m_hexFile.parts[i];
+		TPart* part = m_image->parts[i];
 		for (uint32_t addr = part->getStartAddr(); addr <= part->getEndAddr(); addr += 256)
 		{
 			for (int j = 0; j < flashPages; j++)
@@ -161,10 +290,30 @@ int HardFlasher::erase()
 		}
 	}
 
+	// the stamp is rewritten after flashing
+	for (int j = 0; m_stampAddr && j < flashPages; j++)
+		if (m_stampAddr >= flashLayout[j].sector_start && m_stampAddr - flashLayout[j].sector_start < flashLayout[j].sector_size)
+			pages[flashLayout[j].sector_num] = 1;
+
 	vector<int> pagesV;
 	for (map<int, int>::iterator it = pages.begin(); it != pages.end(); it++)
 		pagesV.push_back(it->first);
 
+	if (m_fastBaudrate)
+	{
+		if (startStub())
+			return -1;
+		for (size_t i = 0; i < pagesV.size(); i++)
+			LOG_NICE("%d ", pagesV[i]);
+		if (m_stub->erase(pagesV))
+		{
+			LOG_NICE("ERROR\n");
+			return -1;
+		}
+		LOG_NICE("OK\n");
+		return 0;
+	}
+
 	return erasePages(pagesV);
 }
 int HardFlasher::eraseEmulatedEEPROM()
@@ -174,16 +323,107 @@ int HardFlasher::eraseEmulatedEEPROM()
 	pagesV.push_back(3);
 
 	int res = erasePages(pagesV);
-	res = writeMemory(0x08008000, "\x00\x00\xff\xff", 4);
+	res = writeMemory(EEPROM_START, "\x00\x00\xff\xff", 4);
 	return  res;
 }
+int HardFlasher::saveEmulatedEEPROM(const string& path)
+{
+	map<uint16_t, uint16_t> values;
+	if (readEmulatedEEPROM(values))
+		return -1;
+
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f)
+	{
+		LOG_NICE("ERROR (unable to open %s)\n", path.c_str());
+		return -1;
+	}
+	fprintf(f, "# CORE2 emulated EEPROM, virtual address and value\n");
+	for (map<uint16_t, uint16_t>::iterator it = values.begin(); it != values.end(); it++)
+		fprintf(f, "0x%04x 0x%04x\n", it->first, it->second);
+	fclose(f);
+
+	LOG_NICE("OK (%d values)\n", (int)values.size());
+	return 0;
+}
+int HardFlasher::restoreEmulatedEEPROM(const string& path)
+{
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+	{
+		LOG_NICE("ERROR (unable to open %s)\n", path.c_str());
+		return -1;
+	}
+	// page header and one 4-byte record (value, virtual address) per variable
+	vector<uint8_t> page;
+	page.push_back(EEPROM_PAGE_VALID & 0xff);
+	page.push_back(EEPROM_PAGE_VALID >> 8);
+	page.push_back(0xff);
+	page.push_back(0xff);
+	char line[128];
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#')
+			continue;
+		unsigned int addr, value;
+		if (sscanf(line, "%x %x", &addr, &value) != 2 || addr >= 0xffff || value > 0xffff)
+		{
+			fclose(f);
+			LOG_NICE("ERROR (invalid line: %s)\n", line);
+			return -1;
+		}
+		uint8_t record[] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)addr, (uint8_t)(addr >> 8) };
+		page.insert(page.end(), record, record + 4);
+	}
+	fclose(f);
+	if (page.size() > EEPROM_PAGE_SIZE)
+	{
+		LOG_NICE("ERROR (too many values)\n");
+		return -1;
+	}
+
+	vector<int> pagesV;
+	pagesV.push_back(2);
+	pagesV.push_back(3);
+	if (erasePages(pagesV))
+		return -1;
+
+	LOG_NICE("Writing %d values... ", (int)(page.size() - 4) / 4);
+	for (uint32_t off = 0; off < page.size(); off += 256)
+	{
+		int len = page.size() - off < 256 ? page.size() - off : 256;
+		if (writeMemory(EEPROM_START + off, page.data() + off, len))
+			return -1;
+	}
+	LOG_NICE("OK\n");
+	return 0;
+}
 int HardFlasher::flash()
 {
 	uint32_t sent = 0;
 
-	for (unsigned int i = 0; i < m_hexFile.parts.size(); i++)
+	if (m_fastBaudrate)
 	{
-		TPart* part = m_hexFile.parts[i];
+		if (startStub())
+			return -1;
+		// the stub keeps running for a CRC verify, the next bootloader
+		// command stops it
+		int res = m_stub->program(*m_image, m_callback);
+		if (m_callback)
+			m_callback(-1, -1);
+		if (res != 0)
+		{
+			LOG_NICE("ERROR\n");
+			return -1;
+		}
+		LOG_NICE("OK\n");
+		LOG_DEBUG("OK");
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
 
 		uint32_t curAddr = part->getStartAddr();
 		uint8_t* data = part->data.data();
@@ -203,7 +443,7 @@ int HardFlasher::flash()
 				data += len;
 
 				if (m_callback)
-					m_callback(sent, m_hexFile.totalLength);
+					m_callback(sent, m_image->totalLength);
 			}
 			else
 			{
@@ -220,6 +460,124 @@ int HardFlasher::flash()
 
 	return 0;
 }
+int HardFlasher::verify(EVerifyMode mode)
+{
+	vector<int> badSectors;
+
+	if (mode == VERIFY_CRC && startStub())
+	{
+		LOG_NICE("ERROR\n");
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
+		uint32_t start = part->getStartAddr();
+		uint32_t end = part->getEndAddr() + 1;
+
+		// one range per sector, so a mismatch tells which sectors differ
+		for (uint32_t addr = start; addr < end;)
+		{
+			int sector = -1;
+			uint32_t rangeEnd = end;
+			for (int j = 0; j < flashPages; j++)
+			{
+				const tFlashSector& s = flashLayout[j];
+				if (addr >= s.sector_start && addr - s.sector_start < s.sector_size)
+				{
+					sector = s.sector_num;
+					if (s.sector_start + s.sector_size < rangeEnd)
+						rangeEnd = s.sector_start + s.sector_size;
+				}
+			}
+
+			bool ok = true;
+			if (mode == VERIFY_CRC)
+			{
+				// whole words, taken from the whole image as a neighbouring
+				// part can share the first or the last word
+				uint32_t first = addr & ~3, last = (rangeEnd + 3) & ~3;
+				vector<uint8_t> expected(last - first);
+				m_image->read(first, last - first, expected.data());
+
+				uint32_t crc;
+				if (m_stub->crc(first, last - first, crc))
+				{
+					LOG_NICE("ERROR\n");
+					return -1;
+				}
+				ok = crc == crc32_stm32(expected.data(), expected.size());
+				LOG_DEBUG("crc 0x%08x-0x%08x: 0x%08x %s", first, last, crc, ok ? "OK" : "MISMATCH");
+			}
+			else
+			{
+				for (uint32_t cur = addr; cur < rangeEnd && ok; cur += 256)
+				{
+					uint8_t buf[256];
+					int len = rangeEnd - cur < sizeof(buf) ? rangeEnd - cur : sizeof(buf);
+					if (readMemory(cur, buf, len))
+					{
+						LOG_NICE("ERROR\n");
+						return -1;
+					}
+					ok = memcmp(buf, part->data.data() + (cur - start), len) == 0;
+				}
+			}
+
+			if (!ok && (badSectors.empty() || badSectors.back() != sector))
+				badSectors.push_back(sector);
+			addr = rangeEnd;
+		}
+	}
+
+	if (!badSectors.empty())
+	{
+		LOG_NICE("MISMATCH (sectors");
+		for (size_t i = 0; i < badSectors.size(); i++)
+			LOG_NICE(" %d", badSectors[i]);
+		LOG_NICE(")\n");
+		LOG_DEBUG("verification failed");
+		return -1;
+	}
+	LOG_NICE("OK\n");
+	LOG_DEBUG("OK");
+	return 0;
+}
+int HardFlasher::checkStamp()
+{
+	TImageStamp stamp, current;
+	if (readMemory(m_stampAddr, &current, sizeof(current)))
+	{
+		LOG_NICE("ERROR\n");
+		return -1;
+	}
+	stamp.calc(*m_image);
+	if (!current.isValid() || !current.matches(stamp))
+	{
+		LOG_NICE("outdated\n");
+		return 0;
+	}
+	time_t t = current.timestamp;
+	char timeStr[32];
+	strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	LOG_NICE("up to date (flashed %s)\n", timeStr);
+	LOG_DEBUG("image stamp matches, flashed %s", timeStr);
+	return 1;
+}
+int HardFlasher::writeStamp()
+{
+	TImageStamp stamp;
+	stamp.calc(*m_image);
+	if (writeMemory(m_stampAddr, &stamp, sizeof(stamp)))
+	{
+		LOG_NICE("ERROR\n");
+		return -1;
+	}
+	LOG_NICE("OK\n");
+	LOG_DEBUG("OK");
+	return 0;
+}
 int HardFlasher::reset()
 {
 	close(true);
@@ -227,6 +585,41 @@ int HardFlasher::reset()
 	LOG_DEBUG("OK");
 	return 0;
 }
+int HardFlasher::run(ERunMode mode, int consoleBaudrate, uint32_t addr)
+{
+	int res = 0;
+	if (mode == RUN_GO)
+	{
+		// the stub resets into the bootloader only while BOOT0 is still high
+		if (m_stub)
+			res = stopStub();
+		// BOOT0 goes low first, so a watchdog or software reset of the
+		// application does not end up in the bootloader again
+		if (res == 0)
+			res = uart_release_boot();
+		if (res == 0)
+			res = go(addr);
+		if (res == 0)
+			res = uart_set_console(consoleBaudrate);
+	}
+	else
+	{
+		delete m_stub;
+		m_stub = 0;
+		// the line is switched before the reset, nothing printed while booting is lost
+		res = uart_set_console(consoleBaudrate);
+		if (res == 0)
+			uart_reset_normal();
+	}
+	if (res != 0)
+	{
+		LOG_NICE("ERROR\n");
+		return -1;
+	}
+	LOG_NICE("OK\n");
+	LOG_DEBUG("OK");
+	return 0;
+}
 int HardFlasher::cleanup(bool reset)
 {
 	close(reset);
@@ -288,9 +681,27 @@ int HardFlasher::unprotect()
 	LOG_NICE("OK\n");
 	return 0;
 }
-int HardFlasher::dump()
+int HardFlasher::dump(bool json)
 {
-	dumpOptionBytes();
+	TDeviceSnapshot snapshot;
+	if (readSnapshot(snapshot))
+		return -1;
+	if (json)
+		printf("%s\n", snapshot.toJson().c_str());
+	else
+		snapshot.print(stdout);
+	return 0;
+}
+int HardFlasher::readSnapshot(TDeviceSnapshot& snapshot)
+{
+	snapshot.chipId = m_dev.id;
+	snapshot.bootVersion = m_dev.bootVersion;
+	if (readRange(OPTION_BYTE_1, snapshot.optionBytes, sizeof(snapshot.optionBytes)))
+		return -1;
+	if (readRange(BOOT_INFO_START, snapshot.bootInfo, sizeof(snapshot.bootInfo)))
+		return -1;
+	if (readRange(OTP_START, snapshot.otp, sizeof(snapshot.otp)))
+		return -1;
 	return 0;
 }
 int HardFlasher::setup(bool noSettingsCheck)
@@ -317,7 +728,8 @@ int HardFlasher::setup(bool noSettingsCheck)
 			if (writeMemory(OPTION_BYTE_1, &op1, 2))
 				return -1;
 			LOG_NICE("CHANGED\r\n");
-			return -1;
+			// the chip resets after an option byte change
+			return 1;
 		}
 		else
 		{
@@ -343,23 +755,21 @@ int HardFlasher::writeHeader(TRoboCOREHeader& header, int headerId)
 
 	header.calcChecksum();
 
-	writeMemory(OTP_BASE, &header, sizeof(header));
-	printf("header version 0x%02x\r\ntype = %d\r\nversion = 0x%08x\r\nid = %d\r\n",
-	       header.headerVersion, header.type, header.version, header.id);
+	if (writeMemory(OTP_BASE, &header, sizeof(header)))
+		return -1;
 
 	uint8_t data[sizeof(header)];
-	readMemory(OTP_BASE, data, sizeof(header));
+	if (readMemory(OTP_BASE, data, sizeof(header)))
+		return -1;
 
 	if (memcmp(data, &header, sizeof(header)) != 0)
 	{
-		printf("unable to register\r\n");
+		LOG_DEBUG("header readback mismatch");
 		return -2;
 	}
 
 	uint8_t d[] = { 0x00 };
-	writeMemory(OTP_LOCK, d, 1);
-
-	return 0;
+	return writeMemory(OTP_LOCK, d, 1);
 }
 
 // commands
@@ -455,7 +865,7 @@ int HardFlasher::getID()
 {
 	int res;
 
-	printf(">>> get id\n");
+	LOG_DEBUG("get id");
 
 	uart_send_cmd(m_dev.cmds[GET_ID]);
 
@@ -467,15 +877,15 @@ int HardFlasher::getID()
 	}
 
 	int len = uart_read_byte() + 1;
-	printf("get id: length: %d\n", len);
+	LOG_DEBUG("get id: length: %d", len);
 
 	char d[50];
 	memset(d, 0, 50);
 	uart_read_data(d, len);
 
-	m_dev.id = (d[0] << 8) | d[1];
+	m_dev.id = ((uint8_t)d[0] << 8) | (uint8_t)d[1];
 
-	printf("Device ID: 0x%04x\n", m_dev.id);
+	LOG_DEBUG("device ID: 0x%04x", m_dev.id);
 
 	res = uart_read_ack_nack();
 	if (res != ACK)
@@ -494,6 +904,7 @@ int HardFlasher::readMemory(uint32_t addr, void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR1\n");
+		invalidateCache();
 		return -1;
 	}
 	uint32_t tmp = SWAP32(addr);
@@ -503,10 +914,11 @@ int HardFlasher::readMemory(uint32_t addr, void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR2\n");
+		invalidateCache();
 		return -1;
 	}
 	uint8_t outbuf[2];
-	assert(len < 256 && len >= 0);
+	assert(len <= 256 && len > 0);
 	outbuf[0] = len - 1;
 	outbuf[1] = 0xff - outbuf[0];
 
@@ -516,6 +928,7 @@ int HardFlasher::readMemory(uint32_t addr, void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR3\n");
+		invalidateCache();
 		return -1;
 	}
 
@@ -532,6 +945,7 @@ int HardFlasher::writeMemory(uint32_t addr, const void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR\n");
+		invalidateCache();
 		return -1;
 	}
 	uint32_t tmp = SWAP32(addr);
@@ -541,6 +955,7 @@ int HardFlasher::writeMemory(uint32_t addr, const void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR\n");
+		invalidateCache();
 		return -1;
 	}
 	buf[0] = len - 1;
@@ -552,6 +967,7 @@ int HardFlasher::writeMemory(uint32_t addr, const void* data, int len)
 	if (res != ACK)
 	{
 		printf("ERROR\n");
+		invalidateCache();
 		return -1;
 	}
 
@@ -655,162 +1071,216 @@ int HardFlasher::erasePages(const vector<int>& pages)
 	{
 		LOG_NICE("ERROR (unknown command)\n");
 		LOG_DEBUG("ERROR (unknown command)");
+		invalidateCache();
 		return -2;
 	}
 }
-
-// misc
-void HardFlasher::dumpOptionBytes()
+int HardFlasher::go(uint32_t addr)
 {
-	uint32_t op1, op2;
+	uart_send_cmd(0x21);
 
-	readMemory(OPTION_BYTE_1, &op1, 4);
-	readMemory(OPTION_BYTE_2, &op2, 4);
-	// printf("0x1fffc000 = 0x%08x\r\n", op1);
-	// printf("0x1fffc008 = 0x%08x\r\n", op2);
+	int res = uart_read_ack_nack();
+	if (res != ACK)
+	{
+		printf("go: NACK(1)\n");
+		return -1;
+	}
+	uint32_t tmp = SWAP32(addr);
+	uart_write_data_checksum((char*)&tmp, 4);
 
-	// validating
-	if ((~(op1 & 0xffff0000) >> 16) != (op1 & 0x0000ffff))
+	res = uart_read_ack_nack();
+	if (res != ACK)
 	{
-		printf("er\r\n");
-		return;
+		printf("go: NACK(2)\n");
+		return -1;
 	}
-	if ((~(op2 & 0xffff0000) >> 16) != (op2 & 0x0000ffff))
+	return 0;
+}
+
+// flashing stub
+int HardFlasher::startStub()
+{
+	if (m_stub)
+		return 0;
+
+	vector<uint8_t> image = m_stubImage;
+#ifdef EMBED_STUB
+	if (image.empty())
+		image.assign(flashStubData, flashStubData + flashStubSize);
+#endif
+	if (image.size() < STUB_BAUDRATE_OFFSET + 4)
+		return -1;
+	// the stub opens the USART itself, at the speed of this session
+	uint32_t sessionBaudrate = m_baudrate;
+	memcpy(image.data() + STUB_BAUDRATE_OFFSET, &sessionBaudrate, 4);
+	const uint8_t* data = image.data();
+	int size = image.size();
+
+	LOG_DEBUG("uploading flashing stub (%d bytes)...", size);
+	for (int off = 0; off < size; off += 256)
 	{
-		printf("er\r\n");
-		return;
+		uint8_t buf[256];
+		int len = size - off;
+		if (len > 256)
+			len = 256;
+		// the bootloader writes whole words
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, data + off, len);
+		if (writeMemory(STUB_LOAD_ADDR + off, buf, (len + 3) & ~3))
+			return -1;
 	}
+	if (go(STUB_LOAD_ADDR))
+		return -1;
 
-	printf("\r\n");
-	printf("===== Option bytes =====\r\n");
-	uint8_t RDP = (op1 & 0x0000ff00) >> 8;
-	printf("RDP        = 0x%02x - ", RDP);
-	switch (RDP)
+	m_stub = new FlashStub(uartStubLink);
+	int baudrate = m_fastBaudrate ? m_fastBaudrate : m_baudrate;
+	if (m_stub->connect(1000) || (baudrate != m_baudrate && m_stub->setBaudrate(baudrate)))
 	{
-	case 0xaa: printf("Level 0, no protection"); break;
-	case 0xcc: printf("Level 2, chip protection (debug and boot from RAM features disabled)"); break;
-	default: printf("Level 1, read protection of memories (debug features limited)"); break;
+		LOG_DEBUG("flashing stub not responding");
+		delete m_stub;
+		m_stub = 0;
+		uart_setspeed(m_baudrate);
+		return -1;
 	}
-	printf("\r\n");
-	printf("nRST_STDBY = %d\r\n", !!(op1 & 0x80));
-	printf("nRST_STOP  = %d\r\n", !!(op1 & 0x40));
-	printf("WDG_SW     = %d\r\n", !!(op1 & 0x20));
-	uint8_t curBOR = (op1 & BOR_MASK) >> BOR_BIT;
-	switch (curBOR)
+	LOG_DEBUG("flashing stub running at %d baud", baudrate);
+	return 0;
+}
+int HardFlasher::stopStub()
+{
+	// the chip restarts into the system bootloader as BOOT0 is still high,
+	// so the remaining steps (e.g. protect) work as usual
+	m_stub->reset();
+	delete m_stub;
+	m_stub = 0;
+
+	TimeUtilDelayMs(10);
+	if (uart_setspeed(m_baudrate) || uart_flush_rx())
+		return -1;
+	if (syncBootloader(BOOTLOADER_SYNC_ATTEMPTS, 100) == 0)
+		return 0;
+	LOG_DEBUG("no bootloader response after the stub reset");
+	return -1;
+}
+
+// bootloader synchronization
+int HardFlasher::resync()
+{
+	if (uart_hold_boot())
+		return -1;
+	TimeUtilDelayMs(RESYNC_DELAY_MS);
+	// drop anything sent by the old session before the reset
+	if (uart_flush_rx())
+		return -1;
+	// a bootloader that is still running reads two probes as a command and
+	// NACKs it, only the ACK of a new session counts
+	return syncBootloader(RESYNC_ATTEMPTS, RESYNC_PROBE_TIMEOUT, true);
+}
+int HardFlasher::syncBootloader(int attempts, int timeout, bool ackOnly)
+{
+	for (int i = 0; i < attempts; i++)
 	{
-	case 0b00: printf("BOR_LEV    = 0b00 - Reset threshold level from 2.70 to 3.60 V\r\n"); break;
-	case 0b01: printf("BOR_LEV    = 0b01 - Reset threshold level from 2.40 to 2.70 V\r\n"); break;
-	case 0b10: printf("BOR_LEV    = 0b10 - Reset threshold level from 2.10 to 2.40 V\r\n"); break;
-	case 0b11: printf("BOR_LEV    = 0b11 - Reset threshold level from 1.8 to 2.10 V\r\n"); break;
+		if (uart_tx("\x7f", 1) == -1)
+			return -1;
+		int res = uart_read_ack_nack(timeout);
+		if (res == ACK || (res == NACK && !ackOnly))
+			return 0;
 	}
+	return -1;
+}
 
-	printf("Protected pages:");
-	uint16_t wrpr = op2 & 0xfff;
-	for (int i = 0; i <= 11; i++)
+// misc
+int HardFlasher::readRange(uint32_t addr, void* data, int len)
+{
+	uint8_t* _data = (uint8_t*)data;
+	while (len > 0)
 	{
-		if (!(wrpr & (1 << i)))
-			printf(" %d", i);
+		int n = len > 256 ? 256 : len;
+		if (readMemory(addr, _data, n))
+			return -1;
+		addr += n;
+		_data += n;
+		len -= n;
 	}
-	printf("\r\n");
+	return 0;
+}
 
-	printf("\r\n");
-	printf("===== Software bootloader =====\r\n");
-	char rev[16], ver[16];
-	readMemory(0x08007f00, rev, sizeof(rev));
-	readMemory(0x08007f00 + sizeof(rev), ver, sizeof(rev));
-	if (memcmp(rev, "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", sizeof(rev)) == 0 ||
-	    memcmp(rev, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", sizeof(rev)) == 0)
+int HardFlasher::readEmulatedEEPROM(map<uint16_t, uint16_t>& values)
+{
+	// during a page transfer the old page stays valid until the new one is complete
+	uint32_t page = 0;
+	for (uint32_t i = 0; i < 2 && !page; i++)
 	{
-		printf("No bootloader present or no info\r\n");
+		uint16_t status;
+		if (readMemory(EEPROM_START + i * EEPROM_PAGE_SIZE, &status, 2))
+			return -1;
+		if (status == EEPROM_PAGE_VALID)
+			page = EEPROM_START + i * EEPROM_PAGE_SIZE;
 	}
-	else
+	if (!page)
 	{
-		printf("Version: %s\r\nRevision: %s\r\n", ver, rev);
+		LOG_DEBUG("no valid EEPROM page");
+		return 0;
 	}
 
-	printf("\r\n");
-	printf("===== Registration data =====");
-	printf("\r\n");
-
-	for (int block_i = 0; block_i < 4; block_i ++)
+	// records are appended, the last one of each address wins; stop at the first erased one
+	uint8_t buf[256];
+	for (uint32_t off = 0; off < EEPROM_PAGE_SIZE; off += sizeof(buf))
 	{
-		printf("Block %d:", block_i);
-		const uint32_t OTP_BASE = OTP_START + 32 * block_i;
-		const uint32_t OTP_LOCK = OTP_LOCK_START + block_i;
-
-		TRoboCOREHeader header;
-		readMemory(OTP_BASE, &header, sizeof(header));
-
-		uint8_t lock;
-		readMemory(OTP_LOCK, &lock, 1);
-		switch (lock)
-		{
-		case 0x00: printf(" (LOCKED)"); break;
-		case 0xff: printf(" (UNLOCKED)"); break;
-		default: printf(" (INVALID LOCK 0x%02x)", lock); break;
-		}
-
-		printf("\r\n");
-
-		if (header.isClear())
-		{
-			printf("UNREGISTERED\r\n");
-		}
-		else
+		if (readMemory(page + off, buf, sizeof(buf)))
+			return -1;
+		for (uint32_t i = off ? 0 : 4; i < sizeof(buf); i += 4)
 		{
-			int a, b, c, d;
-			parseVersion(header.version, a, b, c, d);
-
-			printf("Header version = 0x%02x %s\r\n", header.headerVersion, header.isValid() ? "(CHECKSUM VALID)" : "(!! CHECKSUM INVALID !!)");
-			switch (header.type)
-			{
-			case 1:  printf("Type           = ROBOCORE MINI\r\n"); break;
-			case 2:  printf("Type           = ROBOCORE BIG\r\n"); break;
-			case 3:  printf("Type           = CORE2\r\n"); break;
-			case 4:  printf("Type           = CORE2-MINI\r\n"); break;
-			default: printf("Type           = (unknown %d)\r\n", header.type); break;
-			}
-			printf("Version        = %d.%d.%d.%d\r\n", a, b, c, d);
-			if (header.type <= 2)
-				printf("Serial         = RC%d%d%d %04d\r\n", a, b, c, header.id);
-			else
-				printf("Serial         = CORE2_%04d\r\n", header.id);
-
-			printf("Key            = ");
-			for (int i = 0; i < 16; i++)
-				printf("%02x", header.key[i + 1]);
-			printf("\r\n");
+			uint16_t value = buf[i] | (buf[i + 1] << 8);
+			uint16_t addr = buf[i + 2] | (buf[i + 3] << 8);
+			if (addr == 0xffff && value == 0xffff)
+				return 0;
+			values[addr] = value;
 		}
 	}
+	return 0;
 }
 
 int HardFlasher::dumpEmulatedEEPROM()
 {
-	const uint32_t EEPROM_BASE = 0x08008000;
-	const int EEPROM_SIZE = 0x8000;
-	const int READOUT_SIZE = 128;
+	const int EEPROM_SIZE = EEPROM_PAGE_SIZE * 2;
+	const int READOUT_SIZE = 256;
 	const int ROW_SIZE = 32;
-	char data[EEPROM_SIZE];
+	uint8_t data[EEPROM_SIZE];
 
 	printf("Emulated EEPROM:\n");
 
 	for (int i = 0; i < EEPROM_SIZE; i += READOUT_SIZE)
 	{
-		readMemory(EEPROM_BASE + i, data + i, READOUT_SIZE);
+		if (readMemory(EEPROM_START + i, data + i, READOUT_SIZE))
+			return -1;
 	}
 
-	for (int i = 0; i < EEPROM_SIZE; i ++)
+	// stdout is unbuffered, print whole rows
+	char row[ROW_SIZE * 2 + 2];
+	for (int i = 0; i < EEPROM_SIZE; i += ROW_SIZE)
 	{
-		printf("%02x", (int)((uint8_t)data[i]));
-		if ((i % ROW_SIZE) == ROW_SIZE - 1)
-			printf("\n");
+		for (int j = 0; j < ROW_SIZE; j++)
+			sprintf(row + j * 2, "%02x", data[i + j]);
+		strcat(row, "\n");
+		fputs(row, stdout);
 	}
 	return 0;
 }
 
+void HardFlasher::invalidateCache()
+{
+	// something did not go as the cached data predicted, verify everything on next open
+	if (uart_is_opened())
+		deviceCacheInvalidate(uart_get_serial());
+}
+
 // low-level protocol
 int HardFlasher::uart_send_cmd(uint8_t cmd)
 {
+	// a stub left running by erase, flash or verify hands the chip back
+	// to the bootloader first
+	if (m_stub && stopStub())
+		return -1;
 	uint8_t buf[] = { cmd, (uint8_t)~cmd };
 	return uart_tx(buf, 2);
 }
@@ -0,0 +1,301 @@
+#include "SoftFlasher.h"
+
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#include "myFTDI.h"
+#include "devices.h"
+#include "timeutil.h"
+#include "utils.h"
+
+// OpenBLT waits this long for a connection after a reset before starting
+// the application (BOOT_BACKDOOR_ENTRY_TIMEOUT_MS)
+#define BACKDOOR_WINDOW_MS 500
+#define CONNECT_RESETS 8
+// progress is reported after every chunk, each one costs a SET_MTA
+#define PROGRAM_CHUNK 8192
+// OpenBLT stores the two's complement of the sum of the first 7 vectors at
+// this offset of the application's vector table (STM32F4 port)
+#define OPENBLT_CHECKSUM_OFFSET 0x188
+#define OPENBLT_CHECKSUM_VECTORS 7
+
+#define LOG_PROGRESS(x,...) \
+	do { if (!m_quiet) LOG_NICE(x, ##__VA_ARGS__); } while (0)
+
+SoftFlasher::SoftFlasher()
+	: m_connected(false), m_finished(false), m_quiet(false)
+{
+	m_device = XCP_TRANSPORT_FTDI_PREFIX;
+	memset(&m_session, 0, sizeof(m_session));
+}
+
+bool SoftFlasher::isFtdi()
+{
+	return m_device.compare(0, strlen(XCP_TRANSPORT_FTDI_PREFIX), XCP_TRANSPORT_FTDI_PREFIX) == 0;
+}
+
+int SoftFlasher::init()
+{
+	return 0;
+}
+int SoftFlasher::open()
+{
+	close();
+	if (isFtdi())
+	{
+		// the same CBUS setup as for the ROM bootloader, RST is driven for the reset
+		gpio_config_t config;
+		config.cbus0 = IOMODE;
+		config.cbus1 = IOMODE;
+		config.cbus2 = KEEP_AWAKE;
+		config.cbus3 = DRIVE_0;
+		uart_select_device(m_device.c_str() + strlen(XCP_TRANSPORT_FTDI_PREFIX));
+		if (uart_open_with_config(m_baudrate, config, false))
+			return -1;
+	}
+	if (!XcpMasterInit(&m_session, m_device.c_str(), m_baudrate))
+	{
+		LOG_DEBUG("xcp: unable to open %s (%s)", m_device.c_str(), XcpTransportGetLastError().c_str());
+		close();
+		return -1;
+	}
+	return 0;
+}
+int SoftFlasher::close()
+{
+	m_connected = false;
+	m_finished = false;
+	XcpMasterDeinit(&m_session);
+	if (uart_is_opened())
+		uart_close();
+	return 0;
+}
+
+int SoftFlasher::start(bool initBootloader)
+{
+	LOG_PROGRESS("Connecting to the Husarion device...");
+	LOG_DEBUG("trying to open %s...", m_device.c_str());
+	if (open())
+	{
+		LOG_PROGRESS(" failed\r\n");
+		return -1;
+	}
+	if (!isFtdi())
+		LOG_PROGRESS(" OK\r\n");
+
+	if (!initBootloader)
+		return 0;
+
+	LOG_PROGRESS("Connecting to bootloader..");
+	LOG_DEBUG("trying to connect to OpenBLT...");
+	if (!isFtdi())
+		LOG_PROGRESS(" reset the board..");
+	for (int tries = 0; tries < CONNECT_RESETS; tries++)
+	{
+		// no BOOT0 involved, the bootloader runs after every reset
+		if (isFtdi())
+			uart_reset_normal();
+
+		uint32_t startTime = TimeUtilGetSystemTimeMs();
+		while (TimeUtilGetSystemTimeMs() - startTime < BACKDOOR_WINDOW_MS)
+		{
+			if (isFtdi())
+				uart_flush_rx();
+			if (XcpMasterConnect(&m_session) && XcpMasterStartProgrammingSession(&m_session))
+			{
+				m_connected = true;
+				LOG_DEBUG("OK");
+				LOG_PROGRESS(" OK\n");
+				return 0;
+			}
+		}
+		LOG_PROGRESS(".");
+	}
+
+	LOG_DEBUG("no XCP response after %d attempts", CONNECT_RESETS);
+	LOG_PROGRESS(" failed\r\n");
+	close();
+	return -1;
+}
+int SoftFlasher::erase()
+{
+	// one CLEAR for every sector the image touches, sorted by address
+	map<uint32_t, int> sectors;
+	for (int i = 0; i < (int)m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
+		for (int j = 0; j < flashPages; j++)
+		{
+			uint32_t start = flashLayout[j].sector_start;
+			uint32_t end = start + flashLayout[j].sector_size - 1;
+			if (part->getStartAddr() <= end && part->getEndAddr() >= start)
+				sectors[start] = j;
+		}
+	}
+
+	for (map<uint32_t, int>::iterator it = sectors.begin(); it != sectors.end(); it++)
+	{
+		const tFlashSector& sector = flashLayout[it->second];
+		LOG_PROGRESS("%d ", sector.sector_num);
+		LOG_DEBUG("clearing sector %d at 0x%08x", sector.sector_num, sector.sector_start);
+		if (!XcpMasterClearMemory(&m_session, sector.sector_start, sector.sector_size))
+		{
+			LOG_PROGRESS("ERROR\n");
+			return -1;
+		}
+	}
+	LOG_PROGRESS("OK\n");
+	return 0;
+}
+int SoftFlasher::flash()
+{
+	uint32_t sent = 0;
+
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
+
+		uint32_t curAddr = part->getStartAddr();
+		uint8_t* data = part->data.data();
+
+		while (curAddr <= part->getEndAddr())
+		{
+			// xcpmaster splits it into the largest packets or blocks the slave allows
+			uint32_t len = part->getEndAddr() - curAddr + 1;
+			if (len > PROGRAM_CHUNK)
+				len = PROGRAM_CHUNK;
+
+			if (!XcpMasterProgramData(&m_session, curAddr, len, data))
+			{
+				if (m_callback)
+					m_callback(-1, -1);
+				LOG_PROGRESS("ERROR\n");
+				return -1;
+			}
+			sent += len;
+			curAddr += len;
+			data += len;
+
+			if (m_callback)
+				m_callback(sent, m_image->totalLength);
+		}
+	}
+	if (m_callback)
+		m_callback(-1, -1);
+	LOG_PROGRESS("OK\n");
+	LOG_DEBUG("OK");
+
+	return 0;
+}
+int SoftFlasher::finish()
+{
+	// the final empty PROGRAM lets OpenBLT write its buffered data and checksum
+	if (!m_finished)
+	{
+		if (!XcpMasterFinishProgramming(&m_session))
+			return -1;
+		m_finished = true;
+	}
+	return 0;
+}
+int SoftFlasher::verify(EVerifyMode mode)
+{
+	vector<int> badSectors;
+
+	if (finish())
+	{
+		LOG_PROGRESS("ERROR\n");
+		return -1;
+	}
+
+	// the application's vector table is at the start of the image
+	uint32_t vectors = 0xffffffff;
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+		if (m_image->parts[i]->getStartAddr() < vectors)
+			vectors = m_image->parts[i]->getStartAddr();
+
+	for (unsigned int i = 0; i < m_image->parts.size(); i++)
+	{
+		TPart* part = m_image->parts[i];
+		uint32_t start = part->getStartAddr();
+		uint32_t end = part->getEndAddr() + 1;
+
+		vector<uint8_t> expected(part->data.begin(), part->data.begin() + (end - start));
+		if (start == vectors && end - start >= OPENBLT_CHECKSUM_OFFSET + 4)
+		{
+			uint32_t sum = 0;
+			for (int j = 0; j < OPENBLT_CHECKSUM_VECTORS; j++)
+				sum += *(uint32_t*)&expected[j * 4];
+			uint32_t checksum = ~sum + 1;
+			memcpy(&expected[OPENBLT_CHECKSUM_OFFSET], &checksum, 4);
+		}
+
+		// one range per sector, so a mismatch tells which sectors differ
+		for (uint32_t addr = start; addr < end;)
+		{
+			int sector = -1;
+			uint32_t rangeEnd = end;
+			for (int j = 0; j < flashPages; j++)
+			{
+				const tFlashSector& s = flashLayout[j];
+				if (addr >= s.sector_start && addr - s.sector_start < s.sector_size)
+				{
+					sector = s.sector_num;
+					if (s.sector_start + s.sector_size < rangeEnd)
+						rangeEnd = s.sector_start + s.sector_size;
+				}
+			}
+
+			uint8_t* data = expected.data() + (addr - start);
+			bool ok;
+			if (mode == VERIFY_CRC)
+				ok = XcpMasterVerifyData(&m_session, addr, rangeEnd - addr, data);
+			else
+				ok = XcpMasterCompareData(&m_session, addr, rangeEnd - addr, data);
+			LOG_DEBUG("verify 0x%08x-0x%08x: %s", addr, rangeEnd, ok ? "OK" : "MISMATCH");
+
+			if (!ok && (badSectors.empty() || badSectors.back() != sector))
+				badSectors.push_back(sector);
+			addr = rangeEnd;
+		}
+	}
+
+	if (!badSectors.empty())
+	{
+		LOG_PROGRESS("MISMATCH (sectors");
+		for (size_t i = 0; i < badSectors.size(); i++)
+			LOG_PROGRESS(" %d", badSectors[i]);
+		LOG_PROGRESS(")\n");
+		LOG_DEBUG("verification failed");
+		return -1;
+	}
+	LOG_PROGRESS("OK\n");
+	LOG_DEBUG("OK");
+	return 0;
+}
+int SoftFlasher::reset()
+{
+	// the reset starts the application
+	int res = finish() == 0 && XcpMasterDisconnect(&m_session) ? 0 : -1;
+	m_connected = false;
+	close();
+	if (res != 0)
+	{
+		LOG_PROGRESS("ERROR\n");
+		return -1;
+	}
+	LOG_PROGRESS("OK\n");
+	LOG_DEBUG("OK");
+	return 0;
+}
+int SoftFlasher::cleanup(bool reset)
+{
+	if (m_connected && reset && finish() == 0)
+		XcpMasterDisconnect(&m_session);
+	close();
+	return 0;
+}
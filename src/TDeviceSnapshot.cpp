@@ -0,0 +1,238 @@
+#include "TDeviceSnapshot.h"
+
+#include <string.h>
+
+#include "utils.h"
+
+static bool isFilled(const uint8_t* data, int len, uint8_t value)
+{
+	for (int i = 0; i < len; i++)
+		if (data[i] != value)
+			return false;
+	return true;
+}
+static string hexString(const uint8_t* data, int len)
+{
+	string res;
+	for (int i = 0; i < len; i++)
+	{
+		char buf[3];
+		sprintf(buf, "%02x", data[i]);
+		res += buf;
+	}
+	return res;
+}
+static const char* typeName(uint8_t type)
+{
+	switch (type)
+	{
+	case 1: return "ROBOCORE MINI";
+	case 2: return "ROBOCORE BIG";
+	case 3: return "CORE2";
+	case 4: return "CORE2-MINI";
+	default: return 0;
+	}
+}
+static string serialString(TRoboCOREHeader& header)
+{
+	int a, b, c, d;
+	parseVersion(header.version, a, b, c, d);
+	char buf[32];
+	if (header.type <= 2)
+		sprintf(buf, "RC%d%d%d %04d", a, b, c, header.id);
+	else
+		sprintf(buf, "CORE2_%04d", header.id);
+	return buf;
+}
+
+uint32_t TDeviceSnapshot::getOption1()
+{
+	uint32_t v;
+	memcpy(&v, optionBytes, 4);
+	return v;
+}
+uint32_t TDeviceSnapshot::getOption2()
+{
+	uint32_t v;
+	memcpy(&v, optionBytes + 8, 4);
+	return v;
+}
+bool TDeviceSnapshot::optionsValid()
+{
+	uint32_t op1 = getOption1(), op2 = getOption2();
+	return (~(op1 & 0xffff0000) >> 16) == (op1 & 0x0000ffff) &&
+	       (~(op2 & 0xffff0000) >> 16) == (op2 & 0x0000ffff);
+}
+TRoboCOREHeader TDeviceSnapshot::getHeader(int headerId)
+{
+	TRoboCOREHeader header;
+	memcpy(&header, otp + 32 * headerId, sizeof(header));
+	return header;
+}
+uint8_t TDeviceSnapshot::getLock(int headerId)
+{
+	return otp[OTP_LOCK_START - OTP_START + headerId];
+}
+string TDeviceSnapshot::getBootRevision()
+{
+	const char* s = (const char*)bootInfo;
+	return string(s, strnlen(s, 16));
+}
+string TDeviceSnapshot::getBootVersion()
+{
+	const char* s = (const char*)bootInfo + 16;
+	return string(s, strnlen(s, 16));
+}
+
+void TDeviceSnapshot::print(FILE* f)
+{
+	uint32_t op1 = getOption1(), op2 = getOption2();
+	if (!optionsValid())
+	{
+		fprintf(f, "er\r\n");
+		return;
+	}
+
+	fprintf(f, "\r\n");
+	fprintf(f, "===== Option bytes =====\r\n");
+	uint8_t RDP = (op1 & 0x0000ff00) >> 8;
+	fprintf(f, "RDP        = 0x%02x - ", RDP);
+	switch (RDP)
+	{
+	case 0xaa: fprintf(f, "Level 0, no protection"); break;
+	case 0xcc: fprintf(f, "Level 2, chip protection (debug and boot from RAM features disabled)"); break;
+	default: fprintf(f, "Level 1, read protection of memories (debug features limited)"); break;
+	}
+	fprintf(f, "\r\n");
+	fprintf(f, "nRST_STDBY = %d\r\n", !!(op1 & 0x80));
+	fprintf(f, "nRST_STOP  = %d\r\n", !!(op1 & 0x40));
+	fprintf(f, "WDG_SW     = %d\r\n", !!(op1 & 0x20));
+	uint8_t curBOR = (op1 & BOR_MASK) >> BOR_BIT;
+	switch (curBOR)
+	{
+	case 0b00: fprintf(f, "BOR_LEV    = 0b00 - Reset threshold level from 2.70 to 3.60 V\r\n"); break;
+	case 0b01: fprintf(f, "BOR_LEV    = 0b01 - Reset threshold level from 2.40 to 2.70 V\r\n"); break;
+	case 0b10: fprintf(f, "BOR_LEV    = 0b10 - Reset threshold level from 2.10 to 2.40 V\r\n"); break;
+	case 0b11: fprintf(f, "BOR_LEV    = 0b11 - Reset threshold level from 1.8 to 2.10 V\r\n"); break;
+	}
+
+	fprintf(f, "Protected pages:");
+	uint16_t wrpr = op2 & 0xfff;
+	for (int i = 0; i <= 11; i++)
+	{
+		if (!(wrpr & (1 << i)))
+			fprintf(f, " %d", i);
+	}
+	fprintf(f, "\r\n");
+
+	fprintf(f, "\r\n");
+	fprintf(f, "===== Software bootloader =====\r\n");
+	if (isFilled(bootInfo, 16, 0x00) || isFilled(bootInfo, 16, 0xff))
+		fprintf(f, "No bootloader present or no info\r\n");
+	else
+		fprintf(f, "Version: %s\r\nRevision: %s\r\n", getBootVersion().c_str(), getBootRevision().c_str());
+
+	fprintf(f, "\r\n");
+	fprintf(f, "===== Registration data =====");
+	fprintf(f, "\r\n");
+
+	for (int block_i = 0; block_i < 4; block_i ++)
+	{
+		fprintf(f, "Block %d:", block_i);
+
+		TRoboCOREHeader header = getHeader(block_i);
+		uint8_t lock = getLock(block_i);
+		switch (lock)
+		{
+		case 0x00: fprintf(f, " (LOCKED)"); break;
+		case 0xff: fprintf(f, " (UNLOCKED)"); break;
+		default: fprintf(f, " (INVALID LOCK 0x%02x)", lock); break;
+		}
+
+		fprintf(f, "\r\n");
+
+		if (header.isClear())
+		{
+			fprintf(f, "UNREGISTERED\r\n");
+		}
+		else
+		{
+			int a, b, c, d;
+			parseVersion(header.version, a, b, c, d);
+
+			fprintf(f, "Header version = 0x%02x %s\r\n", header.headerVersion, header.isValid() ? "(CHECKSUM VALID)" : "(!! CHECKSUM INVALID !!)");
+			if (typeName(header.type))
+				fprintf(f, "Type           = %s\r\n", typeName(header.type));
+			else
+				fprintf(f, "Type           = (unknown %d)\r\n", header.type);
+			fprintf(f, "Version        = %d.%d.%d.%d\r\n", a, b, c, d);
+			fprintf(f, "Serial         = %s\r\n", serialString(header).c_str());
+			fprintf(f, "Key            = %s\r\n", hexString(header.key + 1, 16).c_str());
+		}
+	}
+}
+
+string TDeviceSnapshot::toJson()
+{
+	uint32_t op1 = getOption1(), op2 = getOption2();
+	char buf[256];
+	string res;
+
+	sprintf(buf, "{\"chip_id\":\"0x%04x\",\"bootloader_version\":\"%d.%d\"", chipId, bootVersion >> 4, bootVersion & 0x0f);
+	res += buf;
+
+	if (optionsValid())
+	{
+		sprintf(buf, ",\"option_bytes\":{\"raw\":[\"0x%08x\",\"0x%08x\"],\"rdp\":\"0x%02x\",\"nrst_stdby\":%d,\"nrst_stop\":%d,\"wdg_sw\":%d,\"bor_lev\":%d,\"protected_sectors\":[",
+		        op1, op2, (op1 >> 8) & 0xff, !!(op1 & 0x80), !!(op1 & 0x40), !!(op1 & 0x20), (op1 & BOR_MASK) >> BOR_BIT);
+		res += buf;
+		bool first = true;
+		for (int i = 0; i <= 11; i++)
+		{
+			if (!(op2 & (1 << i)))
+			{
+				sprintf(buf, "%s%d", first ? "" : ",", i);
+				res += buf;
+				first = false;
+			}
+		}
+		res += "]}";
+	}
+	else
+	{
+		res += ",\"option_bytes\":null";
+	}
+
+	if (isFilled(bootInfo, 16, 0x00) || isFilled(bootInfo, 16, 0xff))
+		res += ",\"software_bootloader\":null";
+	else
+		res += ",\"software_bootloader\":{\"version\":\"" + jsonEscape(getBootVersion()) +
+		       "\",\"revision\":\"" + jsonEscape(getBootRevision()) + "\"}";
+
+	res += ",\"headers\":[";
+	for (int block_i = 0; block_i < 4; block_i++)
+	{
+		TRoboCOREHeader header = getHeader(block_i);
+		uint8_t lock = getLock(block_i);
+		const char* lockName = lock == 0x00 ? "locked" : lock == 0xff ? "unlocked" : "invalid";
+
+		sprintf(buf, "%s{\"block\":%d,\"lock\":\"%s\"", block_i ? "," : "", block_i, lockName);
+		res += buf;
+		if (header.isClear())
+		{
+			res += ",\"registered\":false}";
+			continue;
+		}
+
+		int a, b, c, d;
+		parseVersion(header.version, a, b, c, d);
+		sprintf(buf, ",\"registered\":true,\"header_version\":%d,\"checksum_valid\":%s,\"type\":%d,\"version\":\"%d.%d.%d.%d\"",
+		        header.headerVersion, header.isValid() ? "true" : "false", header.type, a, b, c, d);
+		res += buf;
+		if (typeName(header.type))
+			res += string(",\"type_name\":\"") + typeName(header.type) + "\"";
+		res += ",\"serial\":\"" + serialString(header) + "\",\"key\":\"" + hexString(header.key + 1, 16) + "\"}";
+	}
+	res += "]}";
+	return res;
+}
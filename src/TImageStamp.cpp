@@ -0,0 +1,33 @@
+#include "TImageStamp.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+
+void TImageStamp::calc(THexFile& image)
+{
+	TSha256 sha;
+	for (unsigned int i = 0; i < image.parts.size(); i++)
+	{
+		TPart* part = image.parts[i];
+		uint32_t range[2] = { part->getStartAddr(), part->getLen() };
+		sha.update(range, sizeof(range));
+		sha.update(part->data.data(), part->data.size());
+	}
+	uint8_t d[32];
+	sha.final(d);
+
+	magic = IMAGE_STAMP_MAGIC;
+	length = image.totalLength;
+	timestamp = time(0);
+	memcpy(digest, d, sizeof(digest));
+}
+bool TImageStamp::isValid()
+{
+	return magic == IMAGE_STAMP_MAGIC;
+}
+bool TImageStamp::matches(const TImageStamp& other)
+{
+	return magic == other.magic && length == other.length && memcmp(digest, other.digest, sizeof(digest)) == 0;
+}
@@ -1,5 +1,7 @@
 #include "TRoboCOREHeader.h"
 
+#include <string.h>
+
 #include "utils.h"
 
 bool TRoboCOREHeader::isClear()
@@ -27,3 +29,10 @@ void TRoboCOREHeader::calcChecksum()
 {
 	checksum = crc16_calc((uint8_t*)this, sizeof(TRoboCOREHeader) - 2);
 }
+void TRoboCOREHeader::setKey(const uint8_t boardKey[16])
+{
+	key[0] = 0x01;
+	memcpy(key + 1, boardKey, 16);
+	uint16_t crc = crc16_calc(boardKey, 16);
+	memcpy(key + 17, &crc, 2);
+}
@@ -0,0 +1,82 @@
+#include "compress.h"
+
+#include <string.h>
+
+#define MIN_MATCH 4
+// the format requires the last 5 bytes to be literals and the last match to
+// start at least 12 bytes before the end of the block
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static uint32_t read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+static uint32_t lzHash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+static void writeLength(vector<uint8_t>& out, int len)
+{
+	while (len >= 255)
+	{
+		out.push_back(255);
+		len -= 255;
+	}
+	out.push_back(len);
+}
+static void writeSequence(vector<uint8_t>& out, const uint8_t* literals, int litLen, int offset, int matchLen)
+{
+	int ml = matchLen - MIN_MATCH;
+	uint8_t token = (litLen >= 15 ? 15 : litLen) << 4;
+	if (matchLen)
+		token |= ml >= 15 ? 15 : ml;
+	out.push_back(token);
+	if (litLen >= 15)
+		writeLength(out, litLen - 15);
+	out.insert(out.end(), literals, literals + litLen);
+	if (!matchLen)
+		return;
+	out.push_back(offset & 0xff);
+	out.push_back(offset >> 8);
+	if (ml >= 15)
+		writeLength(out, ml - 15);
+}
+
+void lz4Compress(const uint8_t* data, int len, vector<uint8_t>& out)
+{
+	int table[1 << HASH_BITS];
+	for (int i = 0; i < (1 << HASH_BITS); i++)
+		table[i] = -1;
+
+	out.clear();
+	out.reserve(len + len / 255 + 16);
+
+	int anchor = 0, pos = 0;
+	while (pos < len - MATCH_LIMIT)
+	{
+		uint32_t seq = read32(data + pos);
+		uint32_t h = lzHash(seq);
+		int ref = table[h];
+		table[h] = pos;
+
+		if (ref < 0 || pos - ref > MAX_OFFSET || read32(data + ref) != seq)
+		{
+			pos++;
+			continue;
+		}
+
+		int matchLen = MIN_MATCH;
+		while (pos + matchLen < len - LAST_LITERALS && data[ref + matchLen] == data[pos + matchLen])
+			matchLen++;
+
+		writeSequence(out, data + anchor, pos - anchor, pos - ref, matchLen);
+		pos += matchLen;
+		anchor = pos;
+	}
+	writeSequence(out, data + anchor, len - anchor, 0, 0);
+}
@@ -1,9 +1,17 @@
 #include "console.h"
 
 #include <stdio.h>
+#include <string.h>
 #include "myFTDI.h"
+#include "consoleserver.h"
+#include "recorder.h"
+#include "rosserial.h"
+#include "ringbuffer.h"
+#include "utils.h"
+#include "timeutil.h"
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #ifdef UNIX
 #include <termios.h>
@@ -16,15 +24,115 @@
 
 #include <pthread.h>
 
-static bool stop = false;
+// about 10 s of data at 3 Mbaud
+#define RX_RING_SIZE (4 * 1024 * 1024)
+#define WRITER_IDLE_US 1000
+#define SEND_TRANSFERS 4
+// replies to the end of the sent data are still shown
+#define SEND_LINGER_MS 200
+#define ROSSERIAL_RATES_INTERVAL_MS 5000
+
+static volatile bool stop = false;
+static volatile bool rxDone = false;
+static TRingBuffer* rxRing = 0;
+static std::atomic<uint32_t> droppedBytes(0);
+static uart_stream_stats_t rxStats;
+static Recorder* recorder = 0;
+static ConsoleServer* server = 0;
+static RosserialDemux* demux = 0;
+static ftdi_context* uartContext = 0;
+static pthread_mutex_t txMutex = PTHREAD_MUTEX_INITIALIZER;
 
 void sigHandler(int num)
 {
 	stop = true;
 }
 
-#include <sys/time.h>
-void thread()
+// stdin and clients of the server transmit from their own threads
+static void consoleTx(const uint8_t* data, int len)
+{
+	pthread_mutex_lock(&txMutex);
+	uart_attach_context(uartContext);
+	uart_tx(data, len);
+	pthread_mutex_unlock(&txMutex);
+}
+
+struct TSendState
+{
+	FILE* f;
+	bool pace;
+	int baudrate;
+	uint64_t sent;
+	uint64_t startUs;
+};
+
+static uint64_t nowUs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000ull + tv.tv_usec;
+}
+
+static int sendSource(uint8_t* buf, int len, void* userdata)
+{
+	TSendState* state = (TSendState*)userdata;
+	if (state->pace)
+	{
+		// 10 bits per byte with 8N1
+		for (;;)
+		{
+			uint64_t allowed = (nowUs() - state->startUs) * state->baudrate / 10 / 1000000;
+			if (allowed > state->sent)
+			{
+				if ((uint64_t)len > allowed - state->sent)
+					len = allowed - state->sent;
+				break;
+			}
+			if (stop)
+				return 0;
+			usleep(1000);
+		}
+	}
+	int r = fread(buf, 1, len, state->f);
+	if (r <= 0)
+		return ferror(state->f) ? -1 : 0;
+	state->sent += r;
+	return r;
+}
+
+// the line settings are per thread in myFTDI, the speed is read by the
+// thread that opened the handle
+static void sendThread(const TConsoleOptions* options, int baudrate)
+{
+	uart_attach_context(uartContext);
+
+	TSendState state;
+	state.f = strcmp(options->sendPath, "-") == 0 ? stdin : fopen(options->sendPath, "rb");
+	state.pace = options->sendPace;
+	state.baudrate = baudrate;
+	state.sent = 0;
+	state.startUs = nowUs();
+	if (!state.f)
+	{
+		fprintf(stderr, "[console: unable to open %s]\r\n", options->sendPath);
+		stop = true;
+		return;
+	}
+
+	int res = uart_tx_stream(&sendSource, &state, SEND_TRANSFERS, stop);
+	double time = (nowUs() - state.startUs) / 1e6;
+	if (state.f != stdin)
+		fclose(state.f);
+
+	fprintf(stderr, "\r\n[console: %s %llu bytes in %.2f s, %.1f kB/s, line rate %.1f kB/s]\r\n",
+	        res == 0 ? "sent" : "send failed after", (unsigned long long)state.sent, time,
+	        time > 0 ? state.sent / time / 1024.0 : 0.0, state.baudrate / 10 / 1024.0);
+
+	TimeUtilDelayMs(SEND_LINGER_MS);
+	stop = true;
+}
+
+static void inputThread()
 {
 #ifdef UNIX
 	struct termios oldt, newt;
@@ -54,9 +162,10 @@ void thread()
 
 		if (res > 0)
 		{
-			char data[100];
+			uint8_t data[100];
 			int r = read(fileno(stdin), data, 100);
-			uart_tx(data, r);
+			if (r > 0)
+				consoleTx(data, r);
 		}
 	}
 
@@ -67,34 +176,175 @@ void thread()
 #endif
 }
 
-int runConsole(int speed)
+// USB event loop, never blocks on the output
+static void onReceive(const uint8_t* data, int len, void*)
+{
+	uint32_t written = rxRing->write(data, len);
+	if (written < (uint32_t)len)
+		droppedBytes += len - written;
+	// independent of the terminal, a slow disk only costs recorded data
+	if (recorder)
+		recorder->push(data, len);
+	if (server)
+		server->push(data, len);
+}
+
+static int writeAll(int fd, const uint8_t* data, uint32_t len)
+{
+	while (len)
+	{
+		int r = write(fd, data, len);
+		if (r <= 0)
+			return -1;
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static void writeText(const uint8_t* data, int len, void*)
+{
+	writeAll(fileno(stdout), data, len);
+}
+
+static void writerThread()
+{
+	uint32_t reportedDrops = 0, reportedOverruns = 0;
+	uint32_t lastRates = TimeUtilGetSystemTimeMs();
+	for (;;)
+	{
+		if (demux && TimeUtilGetSystemTimeMs() - lastRates >= ROSSERIAL_RATES_INTERVAL_MS)
+		{
+			demux->printRates(stderr, (TimeUtilGetSystemTimeMs() - lastRates) / 1000.0);
+			lastRates = TimeUtilGetSystemTimeMs();
+		}
+
+		const uint8_t* data;
+		uint32_t len = rxRing->peek(data);
+		if (len)
+		{
+			if (demux)
+				demux->process(data, len);
+			else
+				writeAll(fileno(stdout), data, len);
+			rxRing->consume(len);
+			continue;
+		}
+
+		uint32_t drops = droppedBytes, overruns = rxStats.overruns;
+		if (drops != reportedDrops)
+		{
+			fprintf(stderr, "\r\n[console: output too slow, %u bytes dropped]\r\n", drops - reportedDrops);
+			reportedDrops = drops;
+		}
+		if (overruns != reportedOverruns)
+		{
+			fprintf(stderr, "\r\n[console: FTDI receive overrun, data lost]\r\n");
+			reportedOverruns = overruns;
+		}
+		if (rxDone)
+			break;
+		usleep(WRITER_IDLE_US);
+	}
+}
+
+int runConsole(int speed, const TConsoleOptions& options)
 {
 	bool res = uart_open(speed, true);
 	if (!res)
 		return 1;
 
-	signal(SIGINT, &sigHandler);
+	return attachConsole(options);
+}
 
-	std::thread th(thread);
+int attachConsole(const TConsoleOptions& options)
+{
+	if (options.recordPath)
+	{
+		recorder = new Recorder();
+		if (recorder->open(options.recordPath, options.recordText) != 0)
+		{
+			uart_close();
+			return 1;
+		}
+	}
 
-	while (!stop)
+	if (options.serveSpec)
 	{
-		int res;
-		char data[1024];
-		res = uart_rx_any(data, 1024);
-		if (res == -1) {
-			exit(1);
+		server = new ConsoleServer();
+		if (server->open(options.serveSpec, &consoleTx) != 0)
+		{
+			uart_close();
+			return 1;
 		}
-		if (res)
+	}
+
+	FILE* framesFile = 0;
+	if (options.rosserial)
+	{
+		demux = new RosserialDemux(&writeText, 0);
+		if (options.rosserialFrames)
 		{
-			for (int i = 0; i < res; i++)
-				putchar(data[i]);
+			framesFile = fopen(options.rosserialFrames, "wb");
+			if (!framesFile)
+			{
+				fprintf(stderr, "unable to create %s\r\n", options.rosserialFrames);
+				uart_close();
+				return 1;
+			}
+			demux->setFrameOutput(framesFile);
 		}
 	}
 
+	if (options.sendXonXoff && uart_set_xonxoff(true) != 0)
+	{
+		uart_close();
+		return 1;
+	}
+
+	uartContext = uart_get_context();
+	signal(SIGINT, &sigHandler);
+
+	rxRing = new TRingBuffer(RX_RING_SIZE);
+	// the data to send replaces the terminal input
+	std::thread th = options.sendPath ? std::thread(sendThread, &options, uart_get_speed()) : std::thread(inputThread);
+	std::thread writer(writerThread);
+
+	// reads through queued USB transfers, the writer thread batches the output
+	int res = uart_rx_stream(&onReceive, 0, stop, rxStats);
+	rxDone = true;
+	writer.join();
+	if (recorder)
+	{
+		recorder->close();
+		if (recorder->getDropped())
+			fprintf(stderr, "[console: recording lost %u bytes, disk too slow]\r\n", recorder->getDropped());
+		delete recorder;
+		recorder = 0;
+	}
+	if (server)
+	{
+		server->close();
+		delete server;
+		server = 0;
+	}
+	if (demux)
+	{
+		demux->printSummary(stderr);
+		delete demux;
+		demux = 0;
+		if (framesFile)
+			fclose(framesFile);
+	}
+	if (res != 0)
+		exit(1);
+
 	th.join();
 
 	uart_close();
+	LOG_DEBUG("console: %llu bytes received, %u dropped, %u FTDI overruns",
+	          (unsigned long long)rxStats.bytes, (uint32_t)droppedBytes, (uint32_t)rxStats.overruns);
+	delete rxRing;
 
 	return 0;
 }
@@ -0,0 +1,281 @@
+#include "consoleserver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "utils.h"
+
+#define SERVE_RING_SIZE (4 * 1024 * 1024)
+
+ConsoleServer::ConsoleServer()
+	: m_ring(SERVE_RING_SIZE), m_input(0), m_thread(0), m_stop(false), m_listenFd(-1),
+	  m_wakePending(false), m_nextId(1)
+{
+	m_wakeFds[0] = m_wakeFds[1] = -1;
+}
+ConsoleServer::~ConsoleServer()
+{
+	close();
+}
+
+#ifdef UNIX
+int ConsoleServer::open(const string& spec, ConsoleInputCallback input)
+{
+	m_input = input;
+	if (spec.compare(0, 5, "unix:") == 0)
+	{
+		m_unixPath = spec.substr(5);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (m_unixPath.empty() || m_unixPath.size() >= sizeof(addr.sun_path))
+		{
+			LOG("invalid socket path %s\r\n", m_unixPath.c_str());
+			return -1;
+		}
+		strcpy(addr.sun_path, m_unixPath.c_str());
+		// a socket left by a previous run is replaced, anything else is kept
+		struct stat st;
+		if (lstat(m_unixPath.c_str(), &st) == 0)
+		{
+			if (!S_ISSOCK(st.st_mode))
+			{
+				LOG("unable to bind %s: address in use\r\n", m_unixPath.c_str());
+				m_unixPath.clear();
+				return -1;
+			}
+			unlink(m_unixPath.c_str());
+		}
+
+		m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_listenFd == -1 || bind(m_listenFd, (sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			LOG("unable to bind %s\r\n", m_unixPath.c_str());
+			// close() must not remove what is at the path now
+			m_unixPath.clear();
+			return -1;
+		}
+	}
+	else if (spec.compare(0, 4, "tcp:") == 0)
+	{
+		int port = atoi(spec.c_str() + 4);
+		if (port <= 0 || port > 65535)
+		{
+			LOG("invalid port %s\r\n", spec.c_str() + 4);
+			return -1;
+		}
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		if (m_listenFd == -1)
+		{
+			LOG("unable to create a socket\r\n");
+			return -1;
+		}
+		int one = 1;
+		setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(m_listenFd, (sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			LOG("unable to bind port %d\r\n", port);
+			return -1;
+		}
+	}
+	else
+	{
+		LOG("invalid --serve address %s (unix:/path or tcp:port)\r\n", spec.c_str());
+		return -1;
+	}
+
+	if (listen(m_listenFd, 8) != 0 || pipe(m_wakeFds) != 0)
+		return -1;
+	fcntl(m_listenFd, F_SETFL, O_NONBLOCK);
+	fcntl(m_wakeFds[0], F_SETFL, O_NONBLOCK);
+	fcntl(m_wakeFds[1], F_SETFL, O_NONBLOCK);
+
+	m_stop = false;
+	m_thread = new thread(&ConsoleServer::run, this);
+	return 0;
+}
+
+void ConsoleServer::push(const uint8_t* data, int len)
+{
+	m_ring.write(data, len);
+	// one wakeup per batch, the server thread drains everything that arrived meanwhile
+	if (!m_wakePending.exchange(true))
+	{
+		char c = 0;
+		if (write(m_wakeFds[1], &c, 1) != 1)
+			m_wakePending = false;
+	}
+}
+
+void ConsoleServer::close()
+{
+	if (m_thread)
+	{
+		m_stop = true;
+		char c = 0;
+		if (write(m_wakeFds[1], &c, 1) != 1)
+			LOG_DEBUG("serve: unable to wake the server thread");
+		m_thread->join();
+		delete m_thread;
+		m_thread = 0;
+	}
+	for (size_t i = 0; i < m_clients.size(); i++)
+		::close(m_clients[i].fd);
+	m_clients.clear();
+	if (m_listenFd != -1)
+	{
+		::close(m_listenFd);
+		m_listenFd = -1;
+		if (!m_unixPath.empty())
+			unlink(m_unixPath.c_str());
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		if (m_wakeFds[i] != -1)
+			::close(m_wakeFds[i]);
+		m_wakeFds[i] = -1;
+	}
+}
+
+void ConsoleServer::run()
+{
+	vector<pollfd> fds;
+	while (!m_stop)
+	{
+		uint64_t head = m_ring.head();
+		fds.resize(2 + m_clients.size());
+		fds[0].fd = m_listenFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = m_wakeFds[0];
+		fds[1].events = POLLIN;
+		for (size_t i = 0; i < m_clients.size(); i++)
+		{
+			fds[2 + i].fd = m_clients[i].fd;
+			fds[2 + i].events = POLLIN | (m_clients[i].cursor != head ? POLLOUT : 0);
+		}
+
+		if (poll(fds.data(), fds.size(), 1000) < 0)
+			continue;
+
+		if (fds[1].revents & POLLIN)
+		{
+			char buf[64];
+			m_wakePending = false;
+			while (read(m_wakeFds[0], buf, sizeof(buf)) > 0)
+				;
+		}
+
+		// clients are removed while iterating, fds keeps the poll order
+		size_t count = m_clients.size();
+		for (size_t i = 0, c = 0; i < count; i++)
+		{
+			TClient& client = m_clients[c];
+			short revents = fds[2 + i].revents;
+			bool alive = true;
+			if (revents & (POLLIN | POLLHUP | POLLERR))
+				alive = receiveFrom(client);
+			if (alive)
+				alive = sendTo(client);
+			if (alive)
+			{
+				c++;
+			}
+			else
+			{
+				::close(client.fd);
+				m_clients.erase(m_clients.begin() + c);
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+			accept();
+	}
+}
+
+void ConsoleServer::accept()
+{
+	for (;;)
+	{
+		int fd = ::accept(m_listenFd, 0, 0);
+		if (fd == -1)
+			return;
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		// new clients get the live stream from now on
+		TClient client = { fd, m_ring.head(), m_nextId++ };
+		m_clients.push_back(client);
+		LOG_DEBUG("serve: client %d connected", client.id);
+	}
+}
+
+bool ConsoleServer::sendTo(TClient& client)
+{
+	while (client.cursor != m_ring.head())
+	{
+		if (m_ring.lost(client.cursor))
+		{
+			fprintf(stderr, "\r\n[console: client %d too slow, disconnected]\r\n", client.id);
+			return false;
+		}
+
+		const uint8_t* data;
+		uint32_t len = m_ring.peek(client.cursor, data);
+		// sent straight from the shared ring, no copy per client
+		int r = send(client.fd, data, len, MSG_NOSIGNAL);
+		if (r < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		if (m_ring.lost(client.cursor))
+		{
+			fprintf(stderr, "\r\n[console: client %d too slow, disconnected]\r\n", client.id);
+			return false;
+		}
+		client.cursor += r;
+		if ((uint32_t)r < len)
+			break;
+	}
+	return true;
+}
+
+bool ConsoleServer::receiveFrom(TClient& client)
+{
+	uint8_t buf[4096];
+	int r = recv(client.fd, buf, sizeof(buf), 0);
+	if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+	{
+		LOG_DEBUG("serve: client %d disconnected", client.id);
+		return false;
+	}
+	if (r > 0 && m_input)
+		m_input(buf, r);
+	return true;
+}
+#else
+int ConsoleServer::open(const string& spec, ConsoleInputCallback input)
+{
+	LOG("--serve is not supported on this platform\r\n");
+	return -1;
+}
+void ConsoleServer::push(const uint8_t* data, int len)
+{
+}
+void ConsoleServer::close()
+{
+}
+#endif
@@ -0,0 +1,207 @@
+#include "devicecache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+
+#include <pthread.h>
+
+#include "utils.h"
+
+int device_cache_enabled = 1;
+
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+TDeviceCacheEntry::TDeviceCacheEntry()
+	: timestamp(0), hasGpio(false), hasCmds(false), bootVersion(0), chipId(0), baudrate(0), latency(0)
+{
+	memset(&gpio, 0, sizeof(gpio));
+	memset(cmds, 0, sizeof(cmds));
+}
+
+static string getCachePath()
+{
+#ifdef WIN32
+	const char* dir = getenv("APPDATA");
+	if (!dir)
+		return "";
+	return string(dir) + "\\core2-flasher-devices";
+#else
+	const char* dir = getenv("HOME");
+	if (!dir)
+		return "";
+	return string(dir) + "/.core2-flasher-devices";
+#endif
+}
+
+// one line per device: "<serial> <timestamp> key=value..."
+static void loadCache(map<string, TDeviceCacheEntry>& entries)
+{
+	string path = getCachePath();
+	if (path.empty())
+		return;
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+		return;
+
+	char line[512];
+	while (fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		vector<string> parts = splitString(line, " ");
+		if (parts.size() < 2)
+			continue;
+
+		TDeviceCacheEntry entry;
+		entry.serial = parts[0];
+		entry.timestamp = strtoul(parts[1].c_str(), 0, 10);
+		for (size_t i = 2; i < parts.size(); i++)
+		{
+			vector<string> kv = splitString(parts[i], "=", 2);
+			if (kv.size() != 2)
+				continue;
+			const char* val = kv[1].c_str();
+			if (kv[0] == "gpio")
+			{
+				gpio_config_t& g = entry.gpio;
+				entry.hasGpio = sscanf(val, "%d,%d,%d,%d", &g.cbus0, &g.cbus1, &g.cbus2, &g.cbus3) == 4;
+			}
+			else if (kv[0] == "cmds" && kv[1].size() == 2 * (1 + sizeof(entry.cmds)))
+			{
+				unsigned int b;
+				sscanf(val, "%2x", &b);
+				entry.bootVersion = b;
+				for (size_t j = 0; j < sizeof(entry.cmds); j++)
+				{
+					sscanf(val + 2 + j * 2, "%2x", &b);
+					entry.cmds[j] = b;
+				}
+				entry.hasCmds = true;
+			}
+			else if (kv[0] == "id")
+			{
+				entry.chipId = strtoul(val, 0, 16);
+			}
+			else if (kv[0] == "baud")
+			{
+				entry.baudrate = atoi(val);
+			}
+			else if (kv[0] == "latency")
+			{
+				entry.latency = atoi(val);
+			}
+		}
+		entries[entry.serial] = entry;
+	}
+	fclose(f);
+}
+
+static void saveCache(const map<string, TDeviceCacheEntry>& entries)
+{
+	string path = getCachePath();
+	if (path.empty())
+		return;
+	string tmpPath = path + ".tmp";
+	FILE* f = fopen(tmpPath.c_str(), "w");
+	if (!f)
+		return;
+
+	for (map<string, TDeviceCacheEntry>::const_iterator it = entries.begin(); it != entries.end(); it++)
+	{
+		const TDeviceCacheEntry& e = it->second;
+		fprintf(f, "%s %u", e.serial.c_str(), e.timestamp);
+		if (e.hasGpio)
+			fprintf(f, " gpio=%d,%d,%d,%d", e.gpio.cbus0, e.gpio.cbus1, e.gpio.cbus2, e.gpio.cbus3);
+		if (e.hasCmds)
+		{
+			fprintf(f, " cmds=%02x", e.bootVersion);
+			for (size_t j = 0; j < sizeof(e.cmds); j++)
+				fprintf(f, "%02x", e.cmds[j]);
+			fprintf(f, " id=%04x", e.chipId);
+		}
+		if (e.baudrate)
+			fprintf(f, " baud=%d latency=%d", e.baudrate, e.latency);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+
+#ifdef WIN32
+	remove(path.c_str());
+#endif
+	rename(tmpPath.c_str(), path.c_str());
+}
+
+bool deviceCacheGet(const string& serial, TDeviceCacheEntry& entry)
+{
+	entry = TDeviceCacheEntry();
+	entry.serial = serial;
+	if (!device_cache_enabled || serial.empty())
+		return false;
+
+	map<string, TDeviceCacheEntry> entries;
+	pthread_mutex_lock(&cacheMutex);
+	loadCache(entries);
+	pthread_mutex_unlock(&cacheMutex);
+
+	map<string, TDeviceCacheEntry>::iterator it = entries.find(serial);
+	if (it == entries.end())
+		return false;
+	uint32_t now = time(0);
+	if (now - it->second.timestamp > DEVICE_CACHE_MAX_AGE)
+	{
+		LOG_DEBUG("device cache entry for %s is stale", serial.c_str());
+		return false;
+	}
+	entry = it->second;
+	return true;
+}
+void deviceCachePut(const TDeviceCacheEntry& entry)
+{
+	if (!device_cache_enabled || entry.serial.empty())
+		return;
+
+	map<string, TDeviceCacheEntry> entries;
+	pthread_mutex_lock(&cacheMutex);
+	loadCache(entries);
+	// only the parts known to the caller are replaced, the rest is kept
+	TDeviceCacheEntry& e = entries[entry.serial];
+	e.serial = entry.serial;
+	e.timestamp = time(0);
+	if (entry.hasGpio)
+	{
+		e.hasGpio = true;
+		e.gpio = entry.gpio;
+	}
+	if (entry.hasCmds)
+	{
+		e.hasCmds = true;
+		e.bootVersion = entry.bootVersion;
+		memcpy(e.cmds, entry.cmds, sizeof(e.cmds));
+		e.chipId = entry.chipId;
+	}
+	if (entry.baudrate)
+	{
+		e.baudrate = entry.baudrate;
+		e.latency = entry.latency;
+	}
+	saveCache(entries);
+	pthread_mutex_unlock(&cacheMutex);
+}
+void deviceCacheInvalidate(const string& serial)
+{
+	if (!device_cache_enabled || serial.empty())
+		return;
+
+	map<string, TDeviceCacheEntry> entries;
+	pthread_mutex_lock(&cacheMutex);
+	loadCache(entries);
+	if (entries.erase(serial))
+	{
+		LOG_DEBUG("device cache entry for %s invalidated", serial.c_str());
+		saveCache(entries);
+	}
+	pthread_mutex_unlock(&cacheMutex);
+}
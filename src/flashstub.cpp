@@ -0,0 +1,214 @@
+#include "flashstub.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "compress.h"
+#include "timeutil.h"
+#include "utils.h"
+
+#define STUB_TIMEOUT 1000
+// a 128 kB sector takes up to 4 s to erase
+#define STUB_ERASE_TIMEOUT 5000
+#define STUB_PING_INTERVAL 50
+
+FlashStub::FlashStub(StubLink& link)
+	: m_link(link), m_seq(0), m_inFlight(0), m_done(0)
+{
+}
+
+int FlashStub::connect(int timeout)
+{
+	// the stub drops the first received byte while picking the USART,
+	// so the first ping is lost and the following ones resync the parser
+	uint32_t start = TimeUtilGetSystemTimeMs();
+	while (TimeUtilGetSystemTimeMs() - start < (uint32_t)timeout)
+	{
+		if (send(STUB_CMD_PING, 0, 0))
+			return -1;
+
+		uint32_t version;
+		int res = waitReply(STUB_PING_INTERVAL, &version);
+		if (res == 0)
+		{
+			if (version != STUB_VERSION)
+			{
+				LOG_DEBUG("stub: unsupported version %u", version);
+				return -1;
+			}
+			return 0;
+		}
+		m_pending.clear();
+		m_inFlight = 0;
+		m_link.flush();
+	}
+	LOG_DEBUG("stub: no response");
+	return -1;
+}
+int FlashStub::setBaudrate(int baudrate)
+{
+	if (call(STUB_CMD_BAUD, 0, baudrate, STUB_TIMEOUT))
+		return -1;
+	if (m_link.setBaudrate(baudrate))
+		return -1;
+	TimeUtilDelayMs(10);
+	m_link.flush();
+	uint32_t version;
+	return call(STUB_CMD_PING, 0, 0, STUB_TIMEOUT, &version);
+}
+int FlashStub::erase(const vector<int>& sectors)
+{
+	for (size_t i = 0; i < sectors.size(); i++)
+	{
+		LOG_DEBUG("stub: erasing sector %d", sectors[i]);
+		if (call(STUB_CMD_ERASE, 0, sectors[i], STUB_ERASE_TIMEOUT))
+			return -1;
+	}
+	return 0;
+}
+int FlashStub::program(THexFile& image, void (*callback)(uint32_t current, uint32_t total))
+{
+	vector<uint8_t> block, packed;
+	uint32_t compressedSize = 0;
+
+	m_done = 0;
+	for (unsigned int i = 0; i < image.parts.size();)
+	{
+		// the stub programs whole words, parts sharing a word are sent
+		// together so no word is written twice
+		uint32_t start = image.parts[i]->getStartAddr() & ~3;
+		uint32_t end = (image.parts[i]->getEndAddr() + 4) & ~3;
+		for (i++; i < image.parts.size() && image.parts[i]->getStartAddr() < end; i++)
+			end = (image.parts[i]->getEndAddr() + 4) & ~3;
+
+		for (uint32_t addr = start; addr < end;)
+		{
+			uint32_t len = end - addr;
+			if (len > STUB_BLOCK_SIZE)
+				len = STUB_BLOCK_SIZE;
+
+			block.resize(len);
+			image.read(addr, len, block.data());
+			uint32_t raw = 0;
+			for (unsigned int j = 0; j < image.parts.size(); j++)
+			{
+				TPart* part = image.parts[j];
+				uint32_t first = part->getStartAddr() > addr ? part->getStartAddr() : addr;
+				uint32_t last = part->getEndAddr() + 1 < addr + len ? part->getEndAddr() + 1 : addr + len;
+				if (first < last)
+					raw += last - first;
+			}
+
+			lz4Compress(block.data(), len, packed);
+			bool compressed = packed.size() < len;
+			const uint8_t* payload = compressed ? packed.data() : block.data();
+			int payloadLen = compressed ? packed.size() : len;
+			int size = sizeof(stub_cmd_t) + ((payloadLen + 3) & ~3) + 4;
+
+			while (!m_pending.empty() && m_inFlight + size > STUB_WINDOW)
+			{
+				if (waitReply(STUB_TIMEOUT))
+					return -1;
+				if (callback)
+					callback(m_done, image.totalLength);
+			}
+			if (send(STUB_CMD_WRITE, addr, len, payload, payloadLen, compressed ? STUB_FLAG_COMPRESSED : 0, raw))
+				return -1;
+
+			compressedSize += payloadLen;
+			addr += len;
+		}
+	}
+	while (!m_pending.empty())
+	{
+		if (waitReply(STUB_TIMEOUT))
+			return -1;
+		if (callback)
+			callback(m_done, image.totalLength);
+	}
+
+	LOG_DEBUG("stub: sent %u bytes for %u bytes of image", compressedSize, m_done);
+	return 0;
+}
+int FlashStub::crc(uint32_t addr, uint32_t len, uint32_t& crc)
+{
+	return call(STUB_CMD_CRC, addr, len, STUB_TIMEOUT, &crc);
+}
+int FlashStub::reset()
+{
+	return send(STUB_CMD_RESET, 0, 0);
+}
+
+int FlashStub::send(uint8_t cmd, uint32_t addr, uint32_t arg, const uint8_t* payload, int len, uint8_t flags, int raw)
+{
+	int padded = (len + 3) & ~3;
+	vector<uint8_t> buf(sizeof(stub_cmd_t) + padded + 4, 0);
+
+	stub_cmd_t* hdr = (stub_cmd_t*)buf.data();
+	hdr->sof = STUB_SOF;
+	hdr->cmd = cmd;
+	hdr->seq = m_seq++;
+	hdr->flags = flags;
+	hdr->addr = addr;
+	hdr->arg = arg;
+	hdr->len = len;
+	if (len)
+		memcpy(buf.data() + sizeof(stub_cmd_t), payload, len);
+	uint32_t crc = crc32_stm32(buf.data(), sizeof(stub_cmd_t) + padded);
+	memcpy(buf.data() + sizeof(stub_cmd_t) + padded, &crc, 4);
+
+	if (m_link.write(buf.data(), buf.size()) == -1)
+		return -1;
+
+	if (cmd != STUB_CMD_RESET)
+	{
+		TPending p = { hdr->seq, cmd, (int)buf.size(), raw };
+		m_pending.push_back(p);
+		m_inFlight += buf.size();
+	}
+	return 0;
+}
+int FlashStub::waitReply(int timeout, uint32_t* value)
+{
+	if (m_pending.empty())
+		return -1;
+
+	stub_reply_t reply;
+	int r = m_link.read(&reply, sizeof(reply), timeout);
+	if (r != sizeof(reply))
+	{
+		LOG_DEBUG("stub: no reply (%d bytes)", r);
+		return -1;
+	}
+
+	TPending p = m_pending.front();
+	m_pending.pop_front();
+	m_inFlight -= p.size;
+
+	if (reply.sof != STUB_SOF || crc32_stm32((uint8_t*)&reply, 8) != reply.crc)
+	{
+		LOG_DEBUG("stub: corrupted reply");
+		return -1;
+	}
+	if (reply.seq != p.seq || reply.cmd != p.cmd)
+	{
+		LOG_DEBUG("stub: unexpected reply to 0x%02x/%d, expected 0x%02x/%d", reply.cmd, reply.seq, p.cmd, p.seq);
+		return -1;
+	}
+	if (reply.status != STUB_OK)
+	{
+		LOG_DEBUG("stub: command 0x%02x failed with status %d", reply.cmd, reply.status);
+		return -1;
+	}
+
+	m_done += p.raw;
+	if (value)
+		*value = reply.value;
+	return 0;
+}
+int FlashStub::call(uint8_t cmd, uint32_t addr, uint32_t arg, int timeout, uint32_t* value)
+{
+	if (send(cmd, addr, arg))
+		return -1;
+	return waitReply(timeout, value);
+}
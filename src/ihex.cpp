@@ -1,9 +1,11 @@
 #include "ihex.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sstream>
+#include <algorithm>
 #include <unistd.h>
 
 using namespace std;
@@ -27,6 +29,7 @@ int str2int(string str)
 }
 
 THexFile::THexFile()
+	: totalLength(0)
 {
 }
 THexFile::~THexFile()
@@ -84,6 +87,127 @@ int THexFile::loadData(const char* data)
 	return true;
 }
 
+int THexFile::loadBin(const std::string& path, uint32_t addr)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+
+	for (unsigned int i = 0; i < parts.size(); i++)
+		delete parts[i];
+	parts.clear();
+
+	TPart *p = new TPart();
+	p->startAddr = addr;
+	uint8_t buf[4096];
+	size_t r;
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		p->data.insert(p->data.end(), buf, buf + r);
+	fclose(f);
+
+	totalLength = p->data.size();
+	if (p->data.empty())
+		delete p;
+	else
+		parts.push_back(p);
+	return true;
+}
+int THexFile::loadImages(const std::vector<std::string>& specs)
+{
+	for (unsigned int i = 0; i < parts.size(); i++)
+		delete parts[i];
+	parts.clear();
+	totalLength = 0;
+
+	for (unsigned int i = 0; i < specs.size(); i++)
+	{
+		THexFile image;
+		size_t at = specs[i].rfind('@');
+		if (at != string::npos)
+		{
+			string path = specs[i].substr(0, at);
+			char* end;
+			uint32_t addr = strtoul(specs[i].c_str() + at + 1, &end, 0);
+			if (*end || at + 1 == specs[i].size())
+			{
+				fprintf(stderr, "invalid base address in %s\n", specs[i].c_str());
+				return false;
+			}
+			if (!image.loadBin(path, addr))
+			{
+				fprintf(stderr, "unable to load %s\n", path.c_str());
+				return false;
+			}
+		}
+		else if (specs[i].size() > 4 && specs[i].compare(specs[i].size() - 4, 4, ".bin") == 0)
+		{
+			fprintf(stderr, "%s needs a base address (file.bin@0x08000000)\n", specs[i].c_str());
+			return false;
+		}
+		else if (!image.load(specs[i]))
+		{
+			fprintf(stderr, "unable to load %s\n", specs[i].c_str());
+			return false;
+		}
+
+		if (!merge(image))
+			return false;
+	}
+	return true;
+}
+static bool partLess(TPart* a, TPart* b)
+{
+	return a->getStartAddr() < b->getStartAddr();
+}
+int THexFile::merge(THexFile& other)
+{
+	for (unsigned int i = 0; i < other.parts.size(); i++)
+	{
+		TPart *a = other.parts[i];
+		for (unsigned int j = 0; j < parts.size(); j++)
+		{
+			TPart *b = parts[j];
+			if (a->getStartAddr() <= b->getEndAddr() && b->getStartAddr() <= a->getEndAddr())
+			{
+				uint32_t addr = a->getStartAddr() > b->getStartAddr() ? a->getStartAddr() : b->getStartAddr();
+				fprintf(stderr, "images overlap at 0x%08x\n", addr);
+				return false;
+			}
+		}
+	}
+
+	parts.insert(parts.end(), other.parts.begin(), other.parts.end());
+	other.parts.clear();
+	std::sort(parts.begin(), parts.end(), partLess);
+	for (unsigned int i = 1; i < parts.size();)
+	{
+		TPart *prev = parts[i - 1], *next = parts[i];
+		if (next->getStartAddr() != prev->getEndAddr() + 1)
+		{
+			i++;
+			continue;
+		}
+		prev->data.insert(prev->data.end(), next->data.begin(), next->data.end());
+		delete next;
+		parts.erase(parts.begin() + i);
+	}
+	totalLength += other.totalLength;
+	other.totalLength = 0;
+	return true;
+}
+void THexFile::read(uint32_t addr, uint32_t len, uint8_t* data)
+{
+	memset(data, 0xff, len);
+	for (unsigned int i = 0; i < parts.size(); i++)
+	{
+		TPart *p = parts[i];
+		uint32_t first = p->getStartAddr() > addr ? p->getStartAddr() : addr;
+		uint32_t last = p->getEndAddr() + 1 < addr + len ? p->getEndAddr() + 1 : addr + len;
+		if (first < last)
+			memcpy(data + (first - addr), p->data.data() + (first - p->getStartAddr()), last - first);
+	}
+}
+
 int THexFile::parseLine(const string& line)
 {
 	uint32_t len = strhex2int(line.substr(1, 2));
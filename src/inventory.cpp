@@ -0,0 +1,121 @@
+#include "inventory.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#ifdef UNIX
+#include <thread>
+#elif WIN32
+#include "mingw.thread.h"
+#endif
+
+#include "HardFlasher.h"
+#include "TDeviceSnapshot.h"
+#include "myFTDI.h"
+#include "utils.h"
+
+// a board that does not answer within this many attempts is reported as failed
+#define INVENTORY_CONNECT_ATTEMPTS 5
+
+struct TInventoryItem
+{
+	uart_device_t device;
+	TDeviceSnapshot snapshot;
+	int result;
+};
+
+static void readBoard(TInventoryItem* item, int speed)
+{
+	HardFlasher flasher;
+	flasher.setDevice(item->device.serial);
+	flasher.setBaudrate(speed);
+	flasher.setMaxAttempts(INVENTORY_CONNECT_ATTEMPTS);
+
+	item->result = flasher.start();
+	if (item->result == 0)
+		item->result = flasher.readSnapshot(item->snapshot);
+	flasher.cleanup();
+}
+
+static void printTable(vector<TInventoryItem>& items)
+{
+	printf("%-12s %-12s %-8s %-5s %-6s %-9s %-12s %s\n",
+	       "SERIAL", "PORT", "CHIP", "BOOT", "RDP", "BOR", "BOARD", "VERSION");
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		TInventoryItem& item = items[i];
+		printf("%-12s %-12s ", item.device.serial.c_str(), item.device.port.c_str());
+		if (item.result != 0)
+		{
+			printf("(no response)\n");
+			continue;
+		}
+
+		TDeviceSnapshot& s = item.snapshot;
+		printf("0x%04x   %d.%-3d ", s.chipId, s.bootVersion >> 4, s.bootVersion & 0x0f);
+		if (s.optionsValid())
+			printf("0x%02x   0b%d%d      ", (s.getOption1() >> 8) & 0xff,
+			       !!(s.getOption1() & 0x08), !!(s.getOption1() & 0x04));
+		else
+			printf("%-6s %-9s ", "?", "?");
+
+		TRoboCOREHeader header = s.getHeader(0);
+		if (header.isClear())
+		{
+			printf("%-12s -\n", "unregistered");
+		}
+		else
+		{
+			int a, b, c, d;
+			parseVersion(header.version, a, b, c, d);
+			char serial[16];
+			sprintf(serial, "%04d%s", header.id, header.isValid() ? "" : "!");
+			printf("%-12s %d.%d.%d.%d\n", serial, a, b, c, d);
+		}
+	}
+}
+
+static void printJson(vector<TInventoryItem>& items)
+{
+	printf("{");
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		TInventoryItem& item = items[i];
+		printf("%s\n\"%s\":{\"port\":\"%s\",\"result\":\"%s\"", i ? "," : "",
+		       jsonEscape(item.device.serial).c_str(), jsonEscape(item.device.port).c_str(),
+		       item.result == 0 ? "ok" : "failed");
+		if (item.result == 0)
+			printf(",\"device\":%s", item.snapshot.toJson().c_str());
+		printf("}");
+	}
+	printf("\n}\n");
+}
+
+int runInventory(int speed, bool json)
+{
+	vector<uart_device_t> devices;
+	if (uart_list_devices(devices) < 0)
+	{
+		LOG("unable to list USB devices\r\n");
+		return 1;
+	}
+	LOG_DEBUG("found %d boards", (int)devices.size());
+
+	vector<TInventoryItem> items(devices.size());
+	vector<std::thread> threads;
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		items[i].device = devices[i];
+		items[i].result = -1;
+		threads.push_back(std::thread(readBoard, &items[i], speed));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	if (json)
+		printJson(items);
+	else
+		printTable(items);
+	return 0;
+}
@@ -0,0 +1,160 @@
+#include "job.h"
+
+#include <stdio.h>
+
+#include "utils.h"
+
+static const char* opNames[] =
+{
+	"dump", "setup", "unprotect", "erase", "flash", "verify", "protect", "register", "reset"
+};
+static const char* opMessages[] =
+{
+	"Dumping info...\r\n", "Checking configuration... ", "Unprotecting bootloader... ", "Erasing device... ",
+	"Programming device... ", "Verifying device... ", "Protecting bootloader... ", "Registering... ", "Reseting device... "
+};
+
+int parseJob(const string& list, vector<EJobOp>& ops)
+{
+	vector<string> names = splitString(list, ",");
+	ops.clear();
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		int j;
+		for (j = 0; j < (int)(sizeof(opNames) / sizeof(opNames[0])); j++)
+			if (names[i] == opNames[j])
+				break;
+		if (j == sizeof(opNames) / sizeof(opNames[0]))
+		{
+			LOG("unknown job operation '%s'\r\n", names[i].c_str());
+			return -1;
+		}
+		ops.push_back((EJobOp)j);
+	}
+	return 0;
+}
+bool jobHasOp(const vector<EJobOp>& ops, EJobOp op)
+{
+	for (size_t i = 0; i < ops.size(); i++)
+		if (ops[i] == op)
+			return true;
+	return false;
+}
+
+static int registerBoard(HardFlasher& flasher, const TJobConfig& config)
+{
+	TRoboCOREHeader old;
+	if (flasher.readHeader(old, config.headerId))
+		return -1;
+	if (!old.isClear())
+	{
+		LOG_NICE("already registered\r\n");
+		return 0;
+	}
+	TRoboCOREHeader h = config.header;
+	if (flasher.writeHeader(h, config.headerId))
+	{
+		LOG_NICE("ERROR\r\n");
+		return -1;
+	}
+	LOG_NICE("OK\r\n");
+	return 0;
+}
+
+int runJob(HardFlasher& flasher, const vector<EJobOp>& ops, const TJobConfig& config)
+{
+	uint32_t connections = 1;
+	bool setupChanged = false;
+	int upToDate = -1; // image stamp not checked yet
+	if (flasher.start() != 0)
+		return -1;
+
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		EJobOp op = ops[i];
+		bool last = i == ops.size() - 1;
+		bool chipReset = false;
+		int res = 0;
+
+		bool imageOp = op == JOB_ERASE || op == JOB_FLASH || op == JOB_VERIFY;
+		if (imageOp && config.stamp && upToDate == -1)
+		{
+			LOG_NICE("Checking image stamp... ");
+			LOG_DEBUG("job: checking image stamp");
+			upToDate = flasher.checkStamp() == 1;
+		}
+		if (imageOp && upToDate == 1)
+		{
+			LOG_DEBUG("job: %s skipped, image up to date", opNames[op]);
+			continue;
+		}
+
+		LOG_NICE("%s", opMessages[op]);
+		LOG_DEBUG("job: %s", opNames[op]);
+		switch (op)
+		{
+		case JOB_DUMP:
+			res = flasher.dump(config.json);
+			break;
+		case JOB_SETUP:
+			res = flasher.setup(config.noSettingsCheck);
+			// option bytes were written and the chip reset itself, the check
+			// is repeated once in the new session
+			if (res == 1 && !setupChanged)
+			{
+				setupChanged = true;
+				if (flasher.reconnect() != 0)
+					return -1;
+				connections++;
+				i--;
+				continue;
+			}
+			break;
+		case JOB_UNPROTECT:
+			res = flasher.unprotect();
+			chipReset = true;
+			break;
+		case JOB_ERASE:
+			res = flasher.erase();
+			break;
+		case JOB_FLASH:
+			res = flasher.flash();
+			if (res == 0 && config.stamp)
+			{
+				LOG_NICE("Writing image stamp... ");
+				LOG_DEBUG("job: writing image stamp");
+				res = flasher.writeStamp();
+			}
+			break;
+		case JOB_VERIFY:
+			res = flasher.verify(config.verifyMode);
+			break;
+		case JOB_PROTECT:
+			res = flasher.protect();
+			chipReset = true;
+			break;
+		case JOB_REGISTER:
+			res = registerBoard(flasher, config);
+			break;
+		case JOB_RESET:
+			res = flasher.reset();
+			chipReset = true;
+			break;
+		}
+
+		if (res != 0)
+		{
+			LOG("job failed at '%s'\r\n", opNames[op]);
+			return -1;
+		}
+		if (chipReset && !last)
+		{
+			LOG_DEBUG("job: chip reset, reconnecting");
+			if (flasher.reconnect() != 0)
+				return -1;
+			connections++;
+		}
+	}
+	LOG_DEBUG("job done with %u connections", connections);
+	return 0;
+}
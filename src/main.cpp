@@ -12,15 +12,24 @@
 #include "TRoboCOREHeader.h"
 #include "timeutil.h"
 #include "HardFlasher.h"
+#include "SoftFlasher.h"
+#include "softbatch.h"
 #include "utils.h"
 #include "console.h"
 #include "signal.h"
 #include "myFTDI.h"
+#include "station.h"
+#include "devicecache.h"
+#include "inventory.h"
+#include "job.h"
+#include "stubproto.h"
+#include "recorder.h"
 
 #ifdef EMBED_BOOTLOADERS
 #include "bootloaders.h"
 #endif
 
+#include <algorithm>
 #include <vector>
 using namespace std;
 
@@ -29,15 +38,37 @@ int doUnprotect = 0, doProtect = 0, doFlash = 0,
     doDump = 0, doDumpEEPROM = 0, doRegister = 0, doSetup = 0, doFlashBootloader = 0,
     doTest = 0, doSwitchEdison = 0, doSwitchSTM32 = 0, doSwitchESP = 0, doEraseEEPROM = 0, doFixPermissions;
 int regType = -1;
+int fastSpeed = 0;
+const char* stubPath = 0;
+const char* eepromSavePath = 0;
+const char* eepromRestorePath = 0;
+int verifyMode = -1;
+uint32_t stampAddr = 0;
 int doConsole = 0;
+int doRun = 0;
+int runMode = RUN_GO;
+uint32_t runAddr = FLASH_START;
+int consoleSpeed = 460800;
+bool appRunning = false;
+TConsoleOptions consoleOptions;
+int doRecordText = 0;
+int doSendPace = 0;
+int doXonXoff = 0;
+int doStation = 0;
+int doJson = 0;
+int doInventory = 0;
 int noSettingsCheck = 0;
 
+#define FAST_SPEED 1000000
+// default of the OpenBLT UART configuration
+#define SOFT_SPEED 57600
+
 #define BEGIN_CHECK_USAGE() int found = 0; do {
 #define END_CHECK_USAGE() if (found != 1) { if (found > 1) warn1(); else warn2(); usage(argv); return 1; } } while (0);
 #define CHECK_USAGE(x) if(x) { found++; }
 #define CHECK_USAGE_NO_INC(x) if (x && found == 0) { found++; }
 
-void decodeKey(const char* source, char* target);
+void decodeKey(const char* source, uint8_t* target);
 
 uint32_t getTicks()
 {
@@ -60,10 +91,57 @@ void usage(char** argv)
 	fprintf(stderr, "Usage:\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Flashing CORE2:\n");
-	fprintf(stderr, "  %s [--speed speed] file.hex\n", argv[0]);
+	fprintf(stderr, "  %s [--speed speed] [--fast[=speed]] [--stub stub.bin] file.hex [file.bin@addr...]\n", argv[0]);
+	fprintf(stderr, "      several images are flashed in one session, binaries need a base address\n");
+	fprintf(stderr, "      --fast runs a flashing stub from RAM that takes compressed data\n");
+	fprintf(stderr, "      at a higher speed (default %d, at most %d)\n", FAST_SPEED, STUB_MAX_BAUDRATE);
+	fprintf(stderr, "      --verify[=crc|read] checks the programmed image by CRCs computed\n");
+	fprintf(stderr, "      on the chip (default, uses the stub) or by reading it back\n");
+	fprintf(stderr, "      --run[=go|reset] starts the application on the same connection instead\n");
+	fprintf(stderr, "      of a reset and prints its output (--console-speed, default 460800);\n");
+	fprintf(stderr, "      go jumps to --run-addr (default 0x%08x) without resetting the chip\n", FLASH_START);
+	fprintf(stderr, "      --stamp addr keeps a fingerprint of the image at this reserved flash\n");
+	fprintf(stderr, "      address and skips flashing when the device is already up to date\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Updating the application through a resident OpenBLT bootloader:\n");
+	fprintf(stderr, "  %s --soft[=ftdi:[serial]|port] [--speed speed] file.hex [file.bin@addr...]\n", argv[0]);
+	fprintf(stderr, "      talks XCP through the FTDI chip of the board (default) and resets it\n");
+	fprintf(stderr, "      without BOOT0, or through a serial port; --speed defaults to %d\n", SOFT_SPEED);
+	fprintf(stderr, "      --verify[=crc|read] compares checksums built by the bootloader (default)\n");
+	fprintf(stderr, "      or reads the image back\n");
+	fprintf(stderr, "  %s --soft=dev1,dev2,... [--soft-workers n] file.hex\n", argv[0]);
+	fprintf(stderr, "      updates several boards at once, n at a time (default all of them);\n");
+	fprintf(stderr, "      each device is a different port or ftdi:serial\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Several operations in one bootloader session:\n");
+	fprintf(stderr, "  %s --job dump,setup,unprotect,erase,flash,verify,protect,register,reset [file.hex]\n", argv[0]);
+	fprintf(stderr, "      operations run in the given order, the bootloader is only entered again\n");
+	fprintf(stderr, "      after the ones that reset the chip (setup, unprotect, protect, reset)\n");
+	fprintf(stderr, "      with --stamp addr (needs erase before flash), flash also writes the image\n");
+	fprintf(stderr, "      stamp and erase, flash and verify are skipped on an up to date device\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Production station (flashes every newly attached board):\n");
+	fprintf(stderr, "  %s --station [--pipeline setup,erase,program,protect,reset] [--station-log file] file.hex\n", argv[0]);
+	fprintf(stderr, "  %s --station --manifest ids.csv --version 1.0.0 --variant core2 --header-id 0 [file.hex]\n", argv[0]);
+	fprintf(stderr, "      registers every new board with the next unused \"serial,key\" of the manifest\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Inventory of all attached boards:\n");
+	fprintf(stderr, "  %s --inventory [--json]\n", argv[0]);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Serial terminal:\n");
-	fprintf(stderr, "  %s --console [--speed speed]\n", argv[0]);
+	fprintf(stderr, "  %s --console [--speed speed] [--record file [--record-text]]\n", argv[0]);
+	fprintf(stderr, "      --record keeps the raw stream with timestamps in file, file.idx and\n");
+	fprintf(stderr, "      with --record-text a readable copy in file.txt\n");
+	fprintf(stderr, "  %s --console --serve unix:/path|tcp:port\n", argv[0]);
+	fprintf(stderr, "      shares the stream with local clients, their input goes to the board\n");
+	fprintf(stderr, "  %s --console --send file|- [--send-pace] [--xonxoff]\n", argv[0]);
+	fprintf(stderr, "      streams a file (or stdin) to the board and exits when done; --send-pace\n");
+	fprintf(stderr, "      limits it to the line speed, --xonxoff lets the board pause it\n");
+	fprintf(stderr, "  %s --console --rosserial[=frames.bin]\n", argv[0]);
+	fprintf(stderr, "      shows only the text around rosserial frames and board log messages,\n");
+	fprintf(stderr, "      per topic rates go to stderr, frames optionally to a file\n");
+	fprintf(stderr, "  %s --slice file [--from s] [--to s] > out\n", argv[0]);
+	fprintf(stderr, "      extracts the data received in a time range of a recording\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "RoboCORE management:\n");
 	fprintf(stderr, "  %s --switch-to-edison-only connects FTDI to Edison debug port and keeps STM32 in reset\n", argv[0]);
@@ -82,9 +160,14 @@ void usage(char** argv)
 	fprintf(stderr, "       --unprotect      unprotects bootloader against\n");
 	fprintf(stderr, "                        unintended modifications\n");
 	fprintf(stderr, "       --dump           dumps device info\n");
+	fprintf(stderr, "       --json           prints --dump output as JSON\n");
 	fprintf(stderr, "       --dump-eeprom    dumps emulated EEPROM content\n");
 	fprintf(stderr, "       --erase-eeprom   erases emulated EEPROM content\n");
+	fprintf(stderr, "       --eeprom-save file     saves emulated EEPROM variables to a file\n");
+	fprintf(stderr, "       --eeprom-restore file  replaces emulated EEPROM content with saved variables\n");
 	fprintf(stderr, "       --debug          show debug messages\n");
+	fprintf(stderr, "       --no-device-cache  always verify FTDI and bootloader settings\n");
+	fprintf(stderr, "                        instead of trusting ~/.core2-flasher-devices\n");
 }
 
 void callback(uint32_t cur, uint32_t total)
@@ -121,6 +204,22 @@ void callback(uint32_t cur, uint32_t total)
 	fflush(stdout);
 }
 
+// last step of flashing, --run keeps the handle open for the console
+static int resetOrRun(HardFlasher* flasher)
+{
+	if (!doRun)
+	{
+		LOG_NICE("Reseting device... ");
+		LOG_DEBUG("reseting device...");
+		return flasher->reset();
+	}
+	LOG_NICE("Starting application... ");
+	LOG_DEBUG("starting application...");
+	int res = flasher->run((ERunMode)runMode, consoleSpeed, runAddr);
+	appRunning = res == 0;
+	return res;
+}
+
 static void sigHandler(int)
 {
 	uart_close();
@@ -134,8 +233,17 @@ int main(int argc, char** argv)
 	int regSerial = -1;
 	uint32_t regVer = 0xffffffff;
 	int headerId = -1;
-	char boardKey[16];
+	uint8_t boardKey[16];
 	bool hasKey = false;
+	const char* pipeline = 0;
+	const char* stationLog = 0;
+	const char* manifestPath = 0;
+	const char* jobSpec = 0;
+	int doSoft = 0;
+	const char* softDevice = 0;
+	int softWorkers = 0;
+	const char* slicePath = 0;
+	double sliceFrom = 0, sliceTo = 1e12;
 
 	setvbuf(stdout, NULL, _IONBF, 0);
 	signal(SIGINT, sigHandler);
@@ -150,8 +258,12 @@ int main(int argc, char** argv)
 		{ "unprotect",  no_argument,       &doUnprotect, 1 },
 		{ "protect",    no_argument,       &doProtect,   1 },
 		{ "dump",       no_argument,       &doDump,      1 },
+		{ "json",       no_argument,       &doJson,      1 },
+		{ "inventory",  no_argument,       &doInventory, 1 },
 		{ "dump-eeprom",  no_argument,     &doDumpEEPROM, 1 },
 		{ "erase-eeprom", no_argument,     &doEraseEEPROM, 1 },
+		{ "eeprom-save",    required_argument, 0,    111 },
+		{ "eeprom-restore", required_argument, 0,    112 },
 		{ "setup",      no_argument,       &doSetup,     1 },
 		{ "register",   no_argument,       &doRegister,  1 },
 
@@ -162,6 +274,21 @@ int main(int argc, char** argv)
 		{ "board-key", required_argument, 0,      'k' },
 
 		{ "speed",      required_argument, 0,       's' },
+		{ "fast",       optional_argument, 0,       103 },
+		{ "stub",       required_argument, 0,       106 },
+		{ "verify",     optional_argument, 0,       108 },
+		{ "stamp",      required_argument, 0,       109 },
+		{ "job",        required_argument, 0,       113 },
+		{ "soft",       optional_argument, 0,       126 },
+		{ "soft-workers", required_argument, 0,     127 },
+		{ "run",        optional_argument, 0,       114 },
+		{ "run-addr",   required_argument, 0,       116 },
+		{ "console-speed", required_argument, 0,    117 },
+
+		{ "station",     no_argument,       &doStation, 1 },
+		{ "pipeline",    required_argument, 0,       101 },
+		{ "station-log", required_argument, 0,       102 },
+		{ "manifest",    required_argument, 0,       110 },
 
 		{ "switch-to-edison-only", no_argument, &doSwitchEdison, 2 },
 		{ "switch-to-edison", no_argument, &doSwitchEdison, 1 },
@@ -169,11 +296,22 @@ int main(int argc, char** argv)
 		{ "switch-to-esp-flash",  no_argument, &doSwitchESP,  1 },
 
 		{ "no-settings-check",  no_argument, &noSettingsCheck,  1 },
+		{ "no-device-cache",    no_argument, &device_cache_enabled, 0 },
 
 		{ "usage",      no_argument,       &doHelp,   1 },
 		{ "help",       no_argument,       &doHelp,   1 },
 
 		{ "console",    no_argument,       &doConsole, 1 },
+		{ "record",     required_argument, 0,       122 },
+		{ "record-text", no_argument,      &doRecordText, 1 },
+		{ "serve",      required_argument, 0,       123 },
+		{ "send",       required_argument, 0,       124 },
+		{ "send-pace",  no_argument,       &doSendPace, 1 },
+		{ "rosserial",  optional_argument, 0,       125 },
+		{ "xonxoff",    no_argument,       &doXonXoff,  1 },
+		{ "slice",      required_argument, 0,       119 },
+		{ "from",       required_argument, 0,       120 },
+		{ "to",         required_argument, 0,       121 },
 		{ "debug",      no_argument,       &log_debug, 1 },
 
 #ifdef __linux__
@@ -272,14 +410,120 @@ int main(int argc, char** argv)
 			decodeKey(optarg, boardKey);
 			hasKey = true;
 			break;
+		case 101:
+			pipeline = optarg;
+			break;
+		case 102:
+			stationLog = optarg;
+			break;
+		case 103:
+			fastSpeed = optarg ? atoi(optarg) : FAST_SPEED;
+			if (fastSpeed <= 0 || fastSpeed > STUB_MAX_BAUDRATE)
+			{
+				printf("invalid fast speed\r\n");
+				exit(1);
+			}
+			break;
+		case 106:
+			stubPath = optarg;
+			break;
+		case 110:
+			manifestPath = optarg;
+			break;
+		case 111:
+			eepromSavePath = optarg;
+			break;
+		case 112:
+			eepromRestorePath = optarg;
+			break;
+		case 108:
+			if (!optarg || strcmp(optarg, "crc") == 0)
+			{
+				verifyMode = VERIFY_CRC;
+			}
+			else if (strcmp(optarg, "read") == 0)
+			{
+				verifyMode = VERIFY_READ;
+			}
+			else
+			{
+				printf("invalid verify mode\r\n");
+				exit(1);
+			}
+			break;
+		case 109:
+			stampAddr = strtoul(optarg, 0, 0);
+			break;
+		case 113:
+			jobSpec = optarg;
+			break;
+		case 126:
+			doSoft = 1;
+			softDevice = optarg;
+			break;
+		case 127:
+			softWorkers = atoi(optarg);
+			break;
+		case 114:
+			doRun = 1;
+			if (!optarg || strcmp(optarg, "go") == 0)
+			{
+				runMode = RUN_GO;
+			}
+			else if (strcmp(optarg, "reset") == 0)
+			{
+				runMode = RUN_RESET;
+			}
+			else
+			{
+				printf("invalid run mode\r\n");
+				exit(1);
+			}
+			break;
+		case 122:
+			consoleOptions.recordPath = optarg;
+			break;
+		case 123:
+			consoleOptions.serveSpec = optarg;
+			break;
+		case 124:
+			consoleOptions.sendPath = optarg;
+			break;
+		case 125:
+			consoleOptions.rosserial = true;
+			consoleOptions.rosserialFrames = optarg;
+			break;
+		case 119:
+			slicePath = optarg;
+			break;
+		case 120:
+			sliceFrom = atof(optarg);
+			break;
+		case 121:
+			sliceTo = atof(optarg);
+			break;
+		case 116:
+			runAddr = strtoul(optarg, 0, 0);
+			break;
+		case 117:
+			consoleSpeed = atoi(optarg);
+			if (consoleSpeed <= 0)
+			{
+				printf("invalid console speed\r\n");
+				exit(1);
+			}
+			break;
 		}
 	}
 
 	const char* filePath = 0;
+	vector<string> imagePaths;
 	if (optind < argc)
 		filePath = argv[optind];
+	for (int i = optind; i < argc; i++)
+		imagePaths.push_back(argv[i]);
 
-	doFlash = !!filePath;
+	doFlash = !!filePath && !jobSpec && !doSoft;
 	if (doHelp)
 	{
 		usage(argv);
@@ -289,15 +533,28 @@ int main(int argc, char** argv)
 	if (doFlash && doConsole && !filePath)
 		doFlash = 0;
 
+	if (doRun && !doFlash)
+	{
+		printf("--run needs an image to flash\r\n");
+		return 1;
+	}
+
 	BEGIN_CHECK_USAGE();
 	CHECK_USAGE(doTest);
-	CHECK_USAGE(!doProtect && !doUnprotect && doFlash);
-	CHECK_USAGE((doProtect || doUnprotect) && doFlash);
+	CHECK_USAGE(doStation && (doFlash || manifestPath));
+	CHECK_USAGE(!doStation && !doProtect && !doUnprotect && doFlash);
+	CHECK_USAGE(!doStation && (doProtect || doUnprotect) && doFlash);
 	CHECK_USAGE(doProtect && !doFlash);
 	CHECK_USAGE(doUnprotect && !doFlash);
 	CHECK_USAGE(doDump);
+	CHECK_USAGE(doInventory);
+	CHECK_USAGE(jobSpec);
+	CHECK_USAGE(doSoft);
+	CHECK_USAGE(slicePath);
 	CHECK_USAGE(doDumpEEPROM);
 	CHECK_USAGE(doEraseEEPROM);
+	CHECK_USAGE(eepromSavePath);
+	CHECK_USAGE(eepromRestorePath);
 	CHECK_USAGE(doRegister && regSerial != -1 && regVer != 0xffffffff && regType != -1 && headerId != -1 && hasKey);
 	CHECK_USAGE(doSetup);
 	CHECK_USAGE(doFlashBootloader);
@@ -308,9 +565,220 @@ int main(int argc, char** argv)
 	CHECK_USAGE_NO_INC(doConsole);
 	END_CHECK_USAGE();
 
+	if (doStation)
+	{
+		THexFile image;
+		LOG_DEBUG("loading file...");
+		if (filePath && !image.loadImages(imagePaths))
+		{
+			LOG("unable to load hex file");
+			return 1;
+		}
+
+		Station station(image, speed == -1 ? 460800 : speed);
+		if (manifestPath)
+		{
+			if (regVer == 0xffffffff || regType == -1 || headerId == -1)
+			{
+				LOG("--manifest needs --version, --variant and --header-id\r\n");
+				return 1;
+			}
+			if (station.setManifest(manifestPath, regVer, regType, headerId) != 0)
+				return 1;
+			if (!pipeline)
+				station.setPipeline(filePath ? "setup,erase,program,register,reset" : "register,reset");
+		}
+		if (pipeline && station.setPipeline(pipeline) != 0)
+			return 1;
+		if (stationLog && station.setLog(stationLog) != 0)
+			return 1;
+		return station.run();
+	}
+
+	consoleOptions.recordText = doRecordText;
+	consoleOptions.sendPace = doSendPace;
+	consoleOptions.sendXonXoff = doXonXoff;
+	if (slicePath)
+		return sliceRecording(slicePath, sliceFrom, sliceTo, stdout) == 0 ? 0 : 1;
+
+	if (doInventory)
+		return runInventory(speed == -1 ? 460800 : speed, doJson);
+
+	if (jobSpec)
+	{
+		vector<EJobOp> ops;
+		if (parseJob(jobSpec, ops) != 0)
+			return 1;
+
+		TJobConfig config;
+		config.json = doJson;
+		config.noSettingsCheck = noSettingsCheck;
+		config.verifyMode = verifyMode == -1 ? VERIFY_CRC : (EVerifyMode)verifyMode;
+		config.headerId = headerId;
+		config.stamp = stampAddr != 0;
+		if (config.stamp)
+		{
+			// erase clears the stamp sector, flash writes the new stamp
+			size_t erase = find(ops.begin(), ops.end(), JOB_ERASE) - ops.begin();
+			size_t flash = find(ops.begin(), ops.end(), JOB_FLASH) - ops.begin();
+			if (flash == ops.size() || erase > flash)
+			{
+				LOG("--stamp needs erase before flash in the job\r\n");
+				return 1;
+			}
+		}
+		if (jobHasOp(ops, JOB_REGISTER))
+		{
+			if (regSerial == -1 || regVer == 0xffffffff || regType == -1 || headerId == -1 || !hasKey)
+			{
+				LOG("register needs --serial, --version, --variant, --header-id and --board-key\r\n");
+				return 1;
+			}
+			config.header.headerVersion = 0x02;
+			config.header.type = regType;
+			config.header.version = regVer;
+			config.header.id = regSerial;
+			config.header.setKey(boardKey);
+		}
+
+		bool needImage = jobHasOp(ops, JOB_ERASE) || jobHasOp(ops, JOB_FLASH) || jobHasOp(ops, JOB_VERIFY);
+		HardFlasher flasher;
+		flasher.setBaudrate(speed == -1 ? 460800 : speed);
+		flasher.setCallback(&callback);
+		if (needImage)
+		{
+			if (!filePath)
+			{
+				LOG("erase, flash and verify need an image\r\n");
+				return 1;
+			}
+			if (flasher.load(imagePaths) != 0)
+			{
+				LOG("unable to load hex file");
+				return 1;
+			}
+			if (stampAddr && flasher.setStampAddress(stampAddr) != 0)
+			{
+				LOG("invalid stamp address 0x%08x (must be aligned, in flash and outside the image)\r\n", stampAddr);
+				return 1;
+			}
+		}
+		if (stubPath && flasher.loadStub(stubPath) != 0)
+		{
+			LOG("unable to load flashing stub %s\r\n", stubPath);
+			return 1;
+		}
+		if (fastSpeed || (jobHasOp(ops, JOB_VERIFY) && config.verifyMode == VERIFY_CRC))
+		{
+			if (!flasher.hasStub())
+			{
+				LOG("flashing stub not available, build with EMBED_STUB or pass --stub\r\n");
+				return 1;
+			}
+			flasher.setFastBaudrate(fastSpeed);
+		}
+		if (flasher.init() != 0)
+		{
+			LOG("unable to initialize flasher");
+			return 1;
+		}
+
+		res = runJob(flasher, ops, config);
+		// without a final reset the board is left in the bootloader
+		flasher.cleanup(false);
+		return res == 0 ? 0 : 1;
+	}
+
+	if (doSoft)
+	{
+		if (!filePath)
+		{
+			LOG("--soft needs an image\r\n");
+			return 1;
+		}
+
+		vector<string> softDevices;
+		if (softDevice)
+			softDevices = splitString(softDevice, ",");
+		if (softDevices.size() > 1)
+		{
+			// every worker needs its own board, "ftdi:" alone takes the first one found
+			for (size_t i = 0; i < softDevices.size(); i++)
+			{
+				const string& dev = softDevices[i];
+				if (dev.empty() || dev == XCP_TRANSPORT_FTDI_PREFIX)
+				{
+					LOG("--soft with several devices needs a port or ftdi:serial for each of them\r\n");
+					return 1;
+				}
+				if (find(softDevices.begin(), softDevices.begin() + i, dev) != softDevices.begin() + i)
+				{
+					LOG("device %s given more than once\r\n", dev.c_str());
+					return 1;
+				}
+			}
+
+			THexFile image;
+			LOG_DEBUG("loading file...");
+			if (!image.loadImages(imagePaths))
+			{
+				LOG("unable to load hex file");
+				return 1;
+			}
+			return runSoftBatch(image, softDevices, speed == -1 ? SOFT_SPEED : speed, softWorkers, verifyMode);
+		}
+
+		SoftFlasher flasher;
+		if (softDevice)
+			flasher.setDevice(softDevice);
+		flasher.setBaudrate(speed == -1 ? SOFT_SPEED : speed);
+		flasher.setCallback(&callback);
+		LOG_DEBUG("loading file...");
+		if (flasher.load(imagePaths) != 0)
+		{
+			LOG("unable to load hex file");
+			return 1;
+		}
+		if (flasher.init() != 0 || flasher.start() != 0)
+			return 1;
+
+		uint32_t startTime = TimeUtilGetSystemTimeMs();
+		LOG_NICE("Erasing device... ");
+		LOG_DEBUG("erasing device...");
+		res = flasher.erase();
+		if (res == 0)
+		{
+			LOG_NICE("Programming device... ");
+			LOG_DEBUG("programming device...");
+			res = flasher.flash();
+		}
+		if (res == 0 && verifyMode != -1)
+		{
+			LOG_NICE("Verifying device... ");
+			LOG_DEBUG("verifying device...");
+			res = flasher.verify((EVerifyMode)verifyMode);
+		}
+		if (res == 0)
+		{
+			LOG_NICE("Reseting device... ");
+			LOG_DEBUG("reseting device...");
+			res = flasher.reset();
+		}
+		// a failed update leaves the board in the bootloader
+		flasher.cleanup(false);
+		if (res != 0)
+			return 1;
+
+		uint32_t endTime = TimeUtilGetSystemTimeMs();
+		float time = endTime - startTime;
+		float avg = flasher.getHexFile().totalLength / (time / 1000.0f) / 1024.0f;
+		LOG_NICE("==== Summary ====\nTime: %d ms\nSpeed: %.2f KBps (%d bps)\n", endTime - startTime, avg, (int)(avg * 8.0f * 1024.0f));
+		return 0;
+	}
+
 	int openBootloader = doTest || doFlash || doProtect || doUnprotect ||
 	                     doDump || doDumpEEPROM || doRegister || doSetup || doFlashBootloader ||
-	                     doEraseEEPROM;
+	                     doEraseEEPROM || eepromSavePath || eepromRestorePath;
 
 	if (openBootloader)
 	{
@@ -320,15 +788,35 @@ int main(int argc, char** argv)
 			s = 460800;
 		flasher->setBaudrate(s);
 		flasher->setCallback(&callback);
+		if (stubPath && flasher->loadStub(stubPath) != 0)
+		{
+			LOG("unable to load flashing stub %s\r\n", stubPath);
+			return 1;
+		}
+		if ((fastSpeed || verifyMode == VERIFY_CRC) && doFlash)
+		{
+			if (!flasher->hasStub())
+			{
+				LOG("flashing stub not available, build with EMBED_STUB or pass --stub\r\n");
+				return 1;
+			}
+			flasher->setFastBaudrate(fastSpeed);
+		}
+		bool verifyFailed = false;
 		if (doFlash)
 		{
 			LOG_DEBUG("loading file...");
-			res = flasher->load(filePath);
+			res = flasher->load(imagePaths);
 			if (res != 0)
 			{
 				LOG("unable to load hex file");
 				return 1;
 			}
+			if (stampAddr && flasher->setStampAddress(stampAddr) != 0)
+			{
+				LOG("invalid stamp address 0x%08x (must be aligned, in flash and outside the image)\r\n", stampAddr);
+				return 1;
+			}
 		}
 
 		res = flasher->init();
@@ -353,13 +841,14 @@ int main(int argc, char** argv)
 					LOG_DEBUG("unprotecting bootloader...");
 					res = flasher->unprotect();
 					unprotectDone = true;
-					continue;
+					if (res != 0 || flasher->reconnect() != 0)
+						continue;
 				}
 				if (doDump)
 				{
 					LOG_NICE("Dumping info...\r\n");
 					LOG_DEBUG("dumping info...");
-					res = flasher->dump();
+					res = flasher->dump(doJson);
 				}
 				if (doDumpEEPROM)
 				{
@@ -373,6 +862,18 @@ int main(int argc, char** argv)
 					LOG_DEBUG("Erasing info...");
 					res = flasher->eraseEmulatedEEPROM();
 				}
+				if (eepromSavePath)
+				{
+					LOG_NICE("Saving EEPROM... ");
+					LOG_DEBUG("saving EEPROM...");
+					res = flasher->saveEmulatedEEPROM(eepromSavePath);
+				}
+				if (eepromRestorePath)
+				{
+					LOG_NICE("Restoring EEPROM... ");
+					LOG_DEBUG("restoring EEPROM...");
+					res = flasher->restoreEmulatedEEPROM(eepromRestorePath);
+				}
 				if (doSetup)
 				{
 					LOG_NICE("Checking configuration... ");
@@ -400,17 +901,42 @@ int main(int argc, char** argv)
 					h.type = regType;
 					h.version = regVer;
 					h.id = regSerial;
-					h.key[0] = 0x01;
-					memcpy(h.key + 1, boardKey, 16);
-					uint16_t crc = crc16_calc((uint8_t*)boardKey, 16);
-					memcpy(h.key + 17, &crc, 2);
-					res = hf->writeHeader(h);
+					h.setKey(boardKey);
+					printf("header version 0x%02x\r\ntype = %d\r\nversion = 0x%08x\r\nid = %d\r\n",
+					       h.headerVersion, h.type, h.version, h.id);
+					res = hf->writeHeader(h, headerId);
+					if (res == -2)
+						printf("unable to register\r\n");
+				}
+				bool upToDate = false;
+				if (doFlash && stampAddr)
+				{
+					LOG_NICE("Checking image stamp... ");
+					LOG_DEBUG("checking image stamp...");
+					upToDate = flasher->checkStamp() == 1;
+				}
+				if (doFlash && upToDate)
+				{
+					if (!doProtect)
+					{
+						res = resetOrRun(flasher);
+						if (res != 0)
+						{
+							printf("\n");
+							continue;
+						}
+					}
 				}
-				if (doFlash)
+				else if (doFlash)
 				{
 					LOG_NICE("Checking configuration... ");
 					LOG_DEBUG("checking configuration...");
 					res = flasher->setup(noSettingsCheck);
+					if (res == 1 && flasher->reconnect() == 0)
+					{
+						LOG_NICE("Checking configuration... ");
+						res = flasher->setup(noSettingsCheck);
+					}
 					if (res != 0)
 					{
 						continue;
@@ -434,11 +960,33 @@ int main(int argc, char** argv)
 						continue;
 					}
 
+					if (verifyMode != -1)
+					{
+						LOG_NICE("Verifying device... ");
+						LOG_DEBUG("verifying device...");
+						res = flasher->verify((EVerifyMode)verifyMode);
+						if (res != 0)
+						{
+							verifyFailed = true;
+							break;
+						}
+					}
+
+					if (stampAddr)
+					{
+						LOG_NICE("Writing image stamp... ");
+						LOG_DEBUG("writing image stamp...");
+						res = flasher->writeStamp();
+						if (res != 0)
+						{
+							printf("\n");
+							continue;
+						}
+					}
+
 					if (!doProtect)
 					{
-						LOG_NICE("Reseting device... ");
-						LOG_DEBUG("reseting device...");
-						res = flasher->reset();
+						res = resetOrRun(flasher);
 						if (res != 0)
 						{
 							printf("\n");
@@ -460,9 +1008,7 @@ int main(int argc, char** argv)
 
 					if (doFlash)
 					{
-						LOG_NICE("Reseting device... ");
-						LOG_DEBUG("reseting device...");
-						res = flasher->reset();
+						res = resetOrRun(flasher);
 						if (res != 0)
 						{
 							printf("\n");
@@ -608,8 +1154,14 @@ int main(int argc, char** argv)
 			}
 		}
 
+		// the application was started on the same handle, its output follows
+		if (appRunning)
+			return attachConsole(consoleOptions);
+
 		bool reset = !(doSwitchSTM32 || doSwitchEdison);
 		flasher->cleanup(reset);
+		if (verifyFailed)
+			return 1;
 	}
 	else if (doSwitchEdison)
 	{
@@ -650,7 +1202,7 @@ int main(int argc, char** argv)
 		int s = speed;
 		if (s == -1)
 			s = 460800;
-		return runConsole(s);
+		return runConsole(s, consoleOptions);
 	}
 
 #ifdef __linux__
@@ -681,26 +1233,16 @@ int main(int argc, char** argv)
 	return 0;
 }
 
-void decodeKey(const char* source, char* target)
+void decodeKey(const char* source, uint8_t* target)
 {
 	if (strlen(source) != 32)
 	{
 		printf("invalid key length (%s)\n", source);
 		exit(1);
 	}
-	for (int i = 0; i < 16; i ++)
+	if (!hexDecode(source, target, 16))
 	{
-		char byte[3];
-		byte[0] = source[i * 2];
-		byte[1] = source[i * 2 + 1];
-		byte[2] = 0;
-		int val;
-		int read = sscanf(byte, "%x", &val);
-		if (read != 1 || !isxdigit(byte[0]) || !isxdigit(byte[1]))
-		{
-			printf("invalid key");
-			exit(1);
-		}
-		target[i] = (char)val;
+		printf("invalid key");
+		exit(1);
 	}
 }
@@ -2,9 +2,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include <libusb.h>
 #include <ftdi.h>
@@ -12,30 +15,110 @@
 
 #include "utils.h"
 #include "timeutil.h"
+#include "devicecache.h"
 
 #define BOOT0  0
 #define RST    1
 #define EDISON 3
 
+#define VENDOR_ID  0x0403
+#define PRODUCT_ID 0x6015
+
 uint32_t getTicks();
 
-static uint8_t vals;
-static int speed;
-static ftdi_context* ftdi = 0;
+// state is kept per thread so several boards can be driven at once
+static thread_local uint8_t vals;
+static thread_local int speed;
+static thread_local ftdi_context* ftdi = 0;
+static thread_local std::string selectedDevice;
+static thread_local std::string openedSerial;
+static thread_local int latency = 16;
+// 0 waits for the manual replug as long as it takes
+static thread_local uint32_t replugTimeout = 0;
+
+// UART settings last applied to the chip, reapplied only when they change
+static thread_local int lineParity = -1;
+static thread_local int lineBaud = -1;
+
+static uint8_t applyPin(uint8_t pattern, int pin, int value)
+{
+	if (value < 0)
+		return pattern;
+	pattern &= ~(1 << pin);
+	pattern |= (1 << (pin + 4)) | (value << pin);
+	return pattern;
+}
+
+int uart_run_waveform(const gpio_step_t* steps, int count)
+{
+	// compute all bit patterns up front, pins changed by consecutive steps
+	// without a delay in between go out in a single transfer. The first one is
+	// always sent, the pins fall back to their EEPROM functions whenever
+	// bitbang mode is left, so vals may not match them anymore.
+	vector<uint8_t> patterns(count);
+	vector<uint32_t> delays(count);
+	uint32_t leadDelay = 0;
+	uint8_t pattern = vals;
+	int last = -1;
+	int n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		pattern = applyPin(pattern, BOOT0, steps[i].boot0);
+		pattern = applyPin(pattern, RST, steps[i].rst);
+		pattern = applyPin(pattern, EDISON, steps[i].edison);
+		if (pattern != last)
+		{
+			if (n == 0 || delays[n - 1] != 0)
+			{
+				delays[n] = 0;
+				n++;
+			}
+			patterns[n - 1] = pattern;
+			last = pattern;
+		}
+		if (n)
+			delays[n - 1] += steps[i].delay_us;
+		else
+			leadDelay += steps[i].delay_us;
+	}
+
+	if (leadDelay)
+		usleep(leadDelay);
+	for (int i = 0; i < n; i++)
+	{
+		LOG_DEBUG("setting pins BOOT0=%d RST=%d EDISON=%d (values 0x%02x)",
+		          (patterns[i] >> BOOT0) & 1, (patterns[i] >> RST) & 1, (patterns[i] >> EDISON) & 1, patterns[i]);
+		if (ftdi_set_bitmode(ftdi, patterns[i], BITMODE_CBUS) < 0)
+			return -1;
+		vals = patterns[i];
+		if (delays[i])
+			usleep(delays[i]);
+	}
+	return n;
+}
 
-int setPin(int pin, int value)
+// leaves CBUS bitbang mode and restores UART settings that differ from the requested ones
+static int uart_restore_line(enum ftdi_parity_type parity)
 {
-	vals &= ~(1 << pin);
-	vals |= (1 << (pin + 4)) | (value << pin);
-	const char *name;
-	switch (pin)
+	if (ftdi_disable_bitbang(ftdi) < 0)
+		return -1;
+	if (lineParity != parity)
+	{
+		if (ftdi_set_line_property(ftdi, BITS_8, STOP_BIT_1, parity) < 0)
+			return -1;
+		lineParity = parity;
+	}
+	if (lineBaud != speed)
 	{
-	case BOOT0: name = "BOOT0"; break;
-	case RST: name = "RST"; break;
-	case EDISON: name = "EDISON"; break;
+#ifdef WIN32
+		if (ftdi_set_baudrate(ftdi, speed * 4) < 0)
+#else
+		if (ftdi_set_baudrate(ftdi, speed) < 0)
+#endif
+			return -1;
+		lineBaud = speed;
 	}
-	LOG_DEBUG("setting pin %s to %d (values 0x%02x)", name, value, vals);
-	return ftdi_set_bitmode(ftdi, vals, BITMODE_CBUS);
+	return 0;
 }
 
 bool reset_device(int vendorId, int productId) {
@@ -49,12 +132,17 @@ bool reset_device(int vendorId, int productId) {
 	if (libusb_init(&ctx) < 0) goto cleanup;
 	if (libusb_get_device_list(ctx, &devs) < 0) goto cleanup;
 
-	for (; *devs != nullptr; devs ++) {
-		struct libusb_device* device = *devs;
+	for (int i = 0; devs[i] != nullptr; i++) {
+		struct libusb_device* device = devs[i];
 		libusb_device_descriptor desc = {0};
 		libusb_get_device_descriptor(device, &desc);
 
 		if (desc.idVendor == vendorId && desc.idProduct == productId) {
+			// other boards may be in use by other threads, leave them alone
+			uart_device_t info;
+			if (!selectedDevice.empty() && (!uart_describe_device(device, info) || info.serial != selectedDevice))
+				continue;
+
 			libusb_device_handle* handle;
 			if (libusb_open(device, &handle) < 0) {
 				fprintf(stderr, "device open failed\n");
@@ -62,6 +150,7 @@ bool reset_device(int vendorId, int productId) {
 			}
 			if (libusb_reset_device(handle) < 0) {
 				fprintf(stderr, "device reset failed\n");
+				libusb_close(handle);
 				goto cleanup;
 			}
 			libusb_close(handle);
@@ -86,10 +175,10 @@ bool reset_device(int vendorId, int productId) {
 	} else {
 		fprintf(stderr, "failed\n");
 	}
-	//if (devs != nullptr)
-	//	libusb_free_device_list(devs, 1);
-	//if (ctx != nullptr)
-	//	libusb_exit(ctx);
+	if (devs != nullptr)
+		libusb_free_device_list(devs, 1);
+	if (ctx != nullptr)
+		libusb_exit(ctx);
 	return result;
 }
 
@@ -102,13 +191,19 @@ bool uart_open(int speed, bool showErrors)
 		uart_close();
 	}
 	ftdi = ftdi_new();
+	// a new handle starts outside of bitbang mode, no pin is driven
+	vals = 0;
 
 	LOG_DEBUG("opening ftdi");
 
 	for (int i=0; i < 2; i ++) {
-		const int vendorId = 0x0403;
-		const int productId = 0x6015;
-		if ((ret = ftdi_usb_open(ftdi, vendorId, productId)) < 0) {
+		const int vendorId = VENDOR_ID;
+		const int productId = PRODUCT_ID;
+		if (selectedDevice.empty())
+			ret = ftdi_usb_open(ftdi, vendorId, productId);
+		else
+			ret = ftdi_usb_open_desc(ftdi, vendorId, productId, NULL, selectedDevice.c_str());
+		if (ret < 0) {
 #ifdef __linux__
 			if (ret == -4 && getuid() != 0) {
 				// probably permission error
@@ -139,6 +234,8 @@ bool uart_open(int speed, bool showErrors)
 		}
 	}
 
+	openedSerial = selectedDevice;
+	latency = 16;
 	ftdi->usb_read_timeout = 1000;
 	ftdi->usb_write_timeout = 1000;
 	libusb_set_auto_detach_kernel_driver(ftdi->usb_dev, 1);
@@ -154,10 +251,156 @@ bool uart_open(int speed, bool showErrors)
 #else
 	ftdi_set_baudrate(ftdi, speed);
 #endif
+	lineParity = NONE;
+	lineBaud = speed;
 
 	return true;
 }
 
+ftdi_context* uart_get_context()
+{
+	return ftdi;
+}
+void uart_attach_context(ftdi_context* context)
+{
+	ftdi = context;
+}
+void uart_select_device(const char* serial)
+{
+	selectedDevice = serial ? serial : "";
+}
+
+bool uart_describe_device(libusb_device* device, uart_device_t& info)
+{
+	libusb_device_descriptor desc;
+	if (libusb_get_device_descriptor(device, &desc) < 0)
+		return false;
+	if (desc.idVendor != VENDOR_ID || desc.idProduct != PRODUCT_ID)
+		return false;
+
+	char port[64];
+	uint8_t ports[8];
+	int cnt = libusb_get_port_numbers(device, ports, sizeof(ports));
+	int len = snprintf(port, sizeof(port), "%d", libusb_get_bus_number(device));
+	for (int i = 0; i < cnt && len < (int)sizeof(port); i++)
+		len += snprintf(port + len, sizeof(port) - len, "%c%d", i == 0 ? '-' : '.', ports[i]);
+	info.port = port;
+
+	libusb_device_handle* handle;
+	if (libusb_open(device, &handle) < 0)
+		return false;
+	unsigned char serial[64];
+	int r = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+	libusb_close(handle);
+	if (r < 0)
+		return false;
+	info.serial = std::string((char*)serial, r);
+	return true;
+}
+
+int uart_list_devices(std::vector<uart_device_t>& devices)
+{
+	libusb_context* ctx = nullptr;
+	libusb_device** devs = nullptr;
+
+	devices.clear();
+	if (libusb_init(&ctx) < 0)
+		return -1;
+	ssize_t cnt = libusb_get_device_list(ctx, &devs);
+	if (cnt < 0)
+	{
+		libusb_exit(ctx);
+		return -1;
+	}
+
+	for (ssize_t i = 0; i < cnt; i++)
+	{
+		uart_device_t info;
+		if (uart_describe_device(devs[i], info))
+			devices.push_back(info);
+	}
+
+	libusb_free_device_list(devs, 1);
+	libusb_exit(ctx);
+	return devices.size();
+}
+
+static int LIBUSB_CALL arrivalCallback(libusb_context*, libusb_device*, libusb_hotplug_event, void* userData)
+{
+	*(int*)userData = 1;
+	return 0;
+}
+
+// Makes the FTDI chip reload its EEPROM by resetting its USB port and
+// reopens the same board once it is back. Returns false if the caller
+// has to fall back to asking the user to replug the board.
+static bool uart_reenumerate(int speed)
+{
+	std::string serial = uart_get_serial();
+	libusb_context* ctx = nullptr;
+	libusb_hotplug_callback_handle handle;
+	bool hotplug = false;
+	int arrived = 0;
+
+	if (libusb_init(&ctx) < 0)
+		return false;
+	// register before the reset, so the arrival cannot be missed
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		hotplug = libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, (libusb_hotplug_flag)0,
+		          VENDOR_ID, PRODUCT_ID, LIBUSB_HOTPLUG_MATCH_ANY, arrivalCallback, &arrived, &handle) == LIBUSB_SUCCESS;
+	}
+
+	LOG_DEBUG("resetting USB port of %s", serial.c_str());
+	int r = libusb_reset_device(ftdi->usb_dev);
+	// the interface may already be gone, so do not try to release it
+	ftdi_free(ftdi);
+	ftdi = 0;
+	openedSerial.clear();
+
+	bool res = false;
+	if (r == 0 || r == LIBUSB_ERROR_NOT_FOUND)
+	{
+		// NOT_FOUND means the device has re-enumerated and the handle is gone
+		bool waitForArrival = hotplug && r == LIBUSB_ERROR_NOT_FOUND;
+		std::string prevDevice = selectedDevice;
+		selectedDevice = serial;
+
+		uint32_t start = getTicks();
+		while (getTicks() - start < 10000)
+		{
+			if (waitForArrival && !arrived)
+			{
+				struct timeval tv = { 0, 100 * 1000 };
+				libusb_handle_events_timeout_completed(ctx, &tv, 0);
+				continue;
+			}
+			if (uart_open(speed, false))
+			{
+				res = true;
+				break;
+			}
+			// the node may exist before udev has applied its permissions
+			TimeUtilDelayMs(50);
+		}
+		selectedDevice = prevDevice;
+	}
+	else
+	{
+		LOG_DEBUG("USB port reset failed: %s", libusb_error_name(r));
+	}
+
+	if (hotplug)
+		libusb_hotplug_deregister_callback(ctx, handle);
+	libusb_exit(ctx);
+	return res;
+}
+
+void uart_set_replug_timeout(uint32_t timeout_ms)
+{
+	replugTimeout = timeout_ms;
+}
+
 bool uart_open_with_config(int speed, const gpio_config_t& config, bool showErrors)
 {
 	bool res = uart_open(speed, showErrors);
@@ -168,12 +411,28 @@ bool uart_open_with_config(int speed, const gpio_config_t& config, bool showErro
 		int r = uart_set_gpio_config(config);
 		if (r)
 		{
+			LOG_NICE(" FTDI settings changed, re-enumerating the device...");
+			if (uart_reenumerate(speed))
+			{
+				LOG_NICE(" OK\r\n");
+				return 0;
+			}
 			uart_close();
-			LOG_NICE(" FTDI settings changed, the device must be replugged to take changes into account.\r\n");
+
+			LOG_NICE(" failed\r\n");
+			LOG_NICE("The device must be replugged to take changes into account.\r\n");
 			LOG_NICE("Unplug the Husarion device.");
 			bool restarted = false;
+			int cnt = 0;
+			uint32_t start = getTicks();
 			for (;;)
 			{
+				if (replugTimeout && getTicks() - start >= replugTimeout)
+				{
+					LOG_NICE(" timeout\r\n");
+					LOG_DEBUG("device was not replugged within %u ms", replugTimeout);
+					return -1;
+				}
 				if (!restarted)
 				{
 					res = uart_open(speed, showErrors);
@@ -194,7 +453,6 @@ bool uart_open_with_config(int speed, const gpio_config_t& config, bool showErro
 						break;
 				}
 				TimeUtilDelayMs(10);
-				static int cnt = 0;
 				if (cnt++ == 15)
 				{
 					LOG_NICE(".");
@@ -215,9 +473,24 @@ bool uart_open_with_config(int speed, const gpio_config_t& config, bool showErro
 	}
 }
 
+static bool sameConfig(const gpio_config_t& a, const gpio_config_t& b)
+{
+	return a.cbus0 == b.cbus0 && a.cbus1 == b.cbus1 && a.cbus2 == b.cbus2 && a.cbus3 == b.cbus3;
+}
+
 int uart_set_gpio_config(const gpio_config_t& config)
 {
 	LOG_DEBUG("checking gpio config");
+
+	// reading the whole EEPROM takes dozens of control transfers, trust a fresh cache entry
+	TDeviceCacheEntry entry;
+	bool cached = deviceCacheGet(uart_get_serial(), entry);
+	if (cached && entry.hasGpio && sameConfig(entry.gpio, config))
+	{
+		LOG_DEBUG("gpio config verified by device cache");
+		return 0;
+	}
+
 	ftdi_read_eeprom(ftdi);
 	ftdi_eeprom_decode(ftdi, 0);
 	int p1 = ftdi->eeprom->cbus_function[0];
@@ -232,31 +505,43 @@ int uart_set_gpio_config(const gpio_config_t& config)
 		ftdi->eeprom->cbus_function[3] = config.cbus3;
 		ftdi_eeprom_build(ftdi);
 		ftdi_write_eeprom(ftdi);
+		deviceCacheInvalidate(uart_get_serial());
 		return 1;
 	}
+
+	entry.hasGpio = true;
+	entry.gpio = config;
+	deviceCachePut(entry);
 	return 0;
 }
 int uart_reset_boot()
 {
 	LOG_DEBUG("resetting to bootloader mode...");
-	setPin(BOOT0, 1);
-	setPin(EDISON, 0);
-	usleep(10000);
-	setPin(RST, 1);
-	usleep(100000);
-	setPin(RST, 0);
-	usleep(100000);
-
-	ftdi_set_line_property(ftdi, BITS_8, STOP_BIT_1, EVEN);
-	ftdi_setflowctrl(ftdi, SIO_DISABLE_FLOW_CTRL);
-
-	ftdi_disable_bitbang(ftdi);
-#ifdef WIN32
-	ftdi_set_baudrate(ftdi, speed * 4);
-#else
-	ftdi_set_baudrate(ftdi, speed);
-#endif
-	return 0;
+	static const gpio_step_t wave[] =
+	{
+		{  1, -1,  0,  10000 },
+		{ -1,  1, -1, 100000 },
+		{ -1,  0, -1, 100000 },
+	};
+	if (uart_run_waveform(wave, sizeof(wave) / sizeof(wave[0])) < 0)
+		return -1;
+	return uart_restore_line(EVEN);
+}
+int uart_hold_boot()
+{
+	// no RST pulse, the chip is expected to reset itself and BOOT0 brings it
+	// back into the system bootloader
+	static const gpio_step_t wave[] = { { 1, 0, -1, 0 } };
+	if (uart_run_waveform(wave, 1) < 0)
+		return -1;
+	if (uart_restore_line(EVEN))
+		return -1;
+	return uart_flush_rx();
+}
+int uart_release_boot()
+{
+	static const gpio_step_t wave[] = { { 0, 0, -1, 0 } };
+	return uart_run_waveform(wave, 1) < 0 ? -1 : 0;
 }
 int uart_switch_to_edison(bool resetSTM)
 {
@@ -270,8 +555,8 @@ int uart_switch_to_edison(bool resetSTM)
 	if (res)
 		return -1;
 
-	setPin(BOOT0, 0);
-	setPin(RST, resetSTM ? 1 : 0);
+	gpio_step_t wave[] = { { 0, (int8_t)(resetSTM ? 1 : 0), -1, 0 } };
+	uart_run_waveform(wave, 1);
 
 	uart_close();
 
@@ -289,8 +574,8 @@ int uart_switch_to_stm32()
 	if (res)
 		return -1;
 
-	setPin(BOOT0, 0);
-	setPin(RST, 0);
+	static const gpio_step_t wave[] = { { 0, 0, -1, 0 } };
+	uart_run_waveform(wave, 1);
 
 	uart_close();
 
@@ -308,8 +593,8 @@ int uart_switch_to_esp()
 	if (res)
 		return -1;
 
-	setPin(BOOT0, 0);
-	setPin(RST, 0);
+	static const gpio_step_t wave[] = { { 0, 0, -1, 0 } };
+	uart_run_waveform(wave, 1);
 
 	uart_close();
 
@@ -319,6 +604,72 @@ bool uart_is_opened()
 {
 	return ftdi != 0;
 }
+const std::string& uart_get_serial()
+{
+	if (openedSerial.empty() && ftdi)
+	{
+		libusb_device_descriptor desc;
+		unsigned char serial[64];
+		if (libusb_get_device_descriptor(libusb_get_device(ftdi->usb_dev), &desc) >= 0)
+		{
+			int r = libusb_get_string_descriptor_ascii(ftdi->usb_dev, desc.iSerialNumber, serial, sizeof(serial));
+			if (r > 0)
+				openedSerial = std::string((char*)serial, r);
+		}
+	}
+	return openedSerial;
+}
+int uart_set_latency(int ms)
+{
+	if (ms == latency)
+		return 0;
+	LOG_DEBUG("setting latency timer to %d ms", ms);
+	if (ftdi_set_latency_timer(ftdi, ms) < 0)
+		return -1;
+	latency = ms;
+	return 0;
+}
+int uart_get_latency()
+{
+	return latency;
+}
+int uart_get_speed()
+{
+	return lineBaud;
+}
+int uart_set_xonxoff(bool enable)
+{
+	// the XON and XOFF characters go in the value, libftdi only sets the mode
+	int res = libusb_control_transfer(ftdi->usb_dev, FTDI_DEVICE_OUT_REQTYPE, SIO_SET_FLOW_CTRL_REQUEST,
+	                                  enable ? (0x13 << 8) | 0x11 : 0,
+	                                  (enable ? SIO_XON_XOFF_HS : SIO_DISABLE_FLOW_CTRL) | ftdi->index,
+	                                  NULL, 0, ftdi->usb_write_timeout);
+	return res < 0 ? -1 : 0;
+}
+int uart_setspeed(int baudrate)
+{
+	if (lineBaud == baudrate)
+		return 0;
+	LOG_DEBUG("setting baudrate to %d", baudrate);
+#ifdef WIN32
+	if (ftdi_set_baudrate(ftdi, baudrate * 4) < 0)
+#else
+	if (ftdi_set_baudrate(ftdi, baudrate) < 0)
+#endif
+		return -1;
+	lineBaud = baudrate;
+	return 0;
+}
+int uart_flush_rx()
+{
+	return ftdi_usb_purge_rx_buffer(ftdi) < 0 ? -1 : 0;
+}
+int uart_set_console(int baudrate)
+{
+	LOG_DEBUG("switching to console mode at %d", baudrate);
+	::speed = baudrate;
+	return uart_restore_line(NONE);
+}
 int uart_tx(const void* data, int len)
 {
 	uint8_t* _data = (uint8_t*)data;
@@ -363,23 +714,226 @@ int uart_rx(void* data, int len, uint32_t timeout_ms)
 void uart_reset_normal()
 {
 	LOG_DEBUG("resetting to normal mode...");
-	setPin(BOOT0, 0);
-	setPin(EDISON, 0);
-	usleep(10000);
-	setPin(RST, 1);
-	usleep(100000);
-	setPin(RST, 0);
+	static const gpio_step_t wave[] =
+	{
+		{  0, -1,  0,  10000 },
+		{ -1,  1, -1, 100000 },
+		{ -1,  0, -1,      0 },
+	};
+	if (uart_run_waveform(wave, sizeof(wave) / sizeof(wave[0])) >= 0)
+		uart_restore_line(NONE);
+}
+// streaming
+#define STREAM_TRANSFERS 8
+#define STREAM_PACKETS 32
+#define STREAM_STATUS_OE 0x02
 
-	ftdi_set_line_property(ftdi, BITS_8, STOP_BIT_1, NONE);
-	ftdi_setflowctrl(ftdi, SIO_DISABLE_FLOW_CTRL);
+struct TStreamState
+{
+	uart_stream_callback_t callback;
+	void* userdata;
+	int packetSize;
+	int pending;
+	int error;
+	bool stopping;
+	uart_stream_stats_t* stats;
+};
+
+static void LIBUSB_CALL uart_stream_cb(libusb_transfer* transfer)
+{
+	TStreamState* state = (TStreamState*)transfer->user_data;
 
-	ftdi_disable_bitbang(ftdi);
-#ifdef WIN32
-	ftdi_set_baudrate(ftdi, speed * 4);
-#else
-	ftdi_set_baudrate(ftdi, speed);
-#endif
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		// every packet starts with two modem/line status bytes, they are
+		// squeezed out so the whole transfer is passed on at once
+		uint8_t* ptr = transfer->buffer;
+		uint8_t* out = transfer->buffer;
+		int length = transfer->actual_length;
+		while (length > 0)
+		{
+			int packetLen = length < state->packetSize ? length : state->packetSize;
+			if (packetLen > 2)
+			{
+				memmove(out, ptr + 2, packetLen - 2);
+				out += packetLen - 2;
+			}
+			if (packetLen >= 2 && (ptr[1] & STREAM_STATUS_OE))
+				state->stats->overruns++;
+			ptr += packetLen;
+			length -= packetLen;
+		}
+		if (out > transfer->buffer)
+		{
+			state->callback(transfer->buffer, out - transfer->buffer, state->userdata);
+			state->stats->bytes += out - transfer->buffer;
+		}
+	}
+	else if (transfer->status != LIBUSB_TRANSFER_TIMED_OUT && transfer->status != LIBUSB_TRANSFER_CANCELLED)
+	{
+		LOG_DEBUG("stream transfer failed with status %d", transfer->status);
+		state->error = -1;
+	}
+
+	if (!state->stopping && !state->error)
+	{
+		if (libusb_submit_transfer(transfer) == 0)
+			return;
+		state->error = -1;
+	}
+	state->pending--;
+}
+
+int uart_rx_stream(uart_stream_callback_t callback, void* userdata, const volatile bool& stop, uart_stream_stats_t& stats)
+{
+	TStreamState state = { callback, userdata, (int)ftdi->max_packet_size, 0, 0, false, &stats };
+	int bufferSize = STREAM_PACKETS * ftdi->max_packet_size;
+	libusb_transfer* transfers[STREAM_TRANSFERS];
+
+	// bytes already fetched by ftdi_read_data go first
+	if (ftdi->readbuffer_remaining)
+	{
+		callback(ftdi->readbuffer + ftdi->readbuffer_offset, ftdi->readbuffer_remaining, userdata);
+		stats.bytes += ftdi->readbuffer_remaining;
+		ftdi->readbuffer_offset += ftdi->readbuffer_remaining;
+		ftdi->readbuffer_remaining = 0;
+	}
+
+	int n;
+	for (n = 0; n < STREAM_TRANSFERS; n++)
+	{
+		transfers[n] = libusb_alloc_transfer(0);
+		if (!transfers[n])
+			break;
+		libusb_fill_bulk_transfer(transfers[n], ftdi->usb_dev, ftdi->out_ep, (uint8_t*)malloc(bufferSize), bufferSize,
+		                          uart_stream_cb, &state, 0);
+		if (libusb_submit_transfer(transfers[n]))
+		{
+			free(transfers[n]->buffer);
+			libusb_free_transfer(transfers[n]);
+			break;
+		}
+		state.pending++;
+	}
+	if (n < STREAM_TRANSFERS)
+		state.error = -1;
+
+	while (!stop && !state.error)
+	{
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(ftdi->usb_ctx, &tv, 0);
+	}
+
+	state.stopping = true;
+	for (int i = 0; i < n; i++)
+		libusb_cancel_transfer(transfers[i]);
+	while (state.pending > 0)
+	{
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(ftdi->usb_ctx, &tv, 0);
+	}
+	for (int i = 0; i < n; i++)
+	{
+		free(transfers[i]->buffer);
+		libusb_free_transfer(transfers[i]);
+	}
+	return state.error;
+}
+
+#define TX_STREAM_CHUNK 4096
+#define TX_STREAM_MAX_TRANSFERS 16
+
+struct TTxSlot
+{
+	libusb_transfer* transfer;
+	std::atomic<bool> busy;
+	std::atomic<bool> failed;
+};
+
+static void LIBUSB_CALL uart_tx_stream_cb(libusb_transfer* transfer)
+{
+	TTxSlot* slot = (TTxSlot*)transfer->user_data;
+	// may run in the thread of uart_rx_stream, which handles the same events
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != transfer->length)
+		slot->failed = true;
+	slot->busy = false;
 }
+
+int uart_tx_stream(uart_tx_source_t source, void* userdata, int inFlight, const volatile bool& stop)
+{
+	if (inFlight > TX_STREAM_MAX_TRANSFERS)
+		inFlight = TX_STREAM_MAX_TRANSFERS;
+
+	TTxSlot slots[TX_STREAM_MAX_TRANSFERS];
+	int n;
+	for (n = 0; n < inFlight; n++)
+	{
+		slots[n].busy = false;
+		slots[n].failed = false;
+		slots[n].transfer = libusb_alloc_transfer(0);
+		if (!slots[n].transfer)
+			break;
+		libusb_fill_bulk_transfer(slots[n].transfer, ftdi->usb_dev, ftdi->in_ep, (uint8_t*)malloc(TX_STREAM_CHUNK), 0,
+		                          uart_tx_stream_cb, &slots[n], 0);
+	}
+
+	int res = n == inFlight ? 0 : -1;
+	bool end = false;
+	for (;;)
+	{
+		int busy = 0;
+		for (int i = 0; i < n; i++)
+		{
+			if (slots[i].failed)
+				res = -1;
+			if (slots[i].busy)
+			{
+				busy++;
+				continue;
+			}
+			if (end || res != 0 || stop)
+				continue;
+
+			int len = source(slots[i].transfer->buffer, TX_STREAM_CHUNK, userdata);
+			if (len <= 0)
+			{
+				if (len < 0)
+					res = -1;
+				end = true;
+				continue;
+			}
+			slots[i].transfer->length = len;
+			slots[i].busy = true;
+			if (libusb_submit_transfer(slots[i].transfer))
+			{
+				slots[i].busy = false;
+				res = -1;
+				continue;
+			}
+			busy++;
+		}
+		if (busy == 0 && (end || res != 0 || stop))
+			break;
+		// data held back by XOFF would keep the transfers pending forever
+		if (stop)
+		{
+			for (int i = 0; i < n; i++)
+				if (slots[i].busy)
+					libusb_cancel_transfer(slots[i].transfer);
+		}
+
+		struct timeval tv = { 0, 10000 };
+		libusb_handle_events_timeout_completed(ftdi->usb_ctx, &tv, 0);
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		free(slots[i].transfer->buffer);
+		libusb_free_transfer(slots[i].transfer);
+	}
+	return res;
+}
+
 void uart_close()
 {
 	int ret;
@@ -395,4 +949,5 @@ void uart_close()
 	ftdi_free(ftdi);
 
 	ftdi = 0;
+	openedSerial.clear();
 }
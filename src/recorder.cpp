@@ -0,0 +1,306 @@
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <chrono>
+#include <vector>
+
+#include "utils.h"
+
+#define RECORD_RING_SIZE (16 * 1024 * 1024)
+// the data file grows in steps, it is truncated to its real size on close
+#define RECORD_PREALLOC_STEP (64 * 1024 * 1024)
+#define RECORD_IDLE_US 1000
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static uint64_t monotonicUs()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Recorder::Recorder()
+	: m_ring(RECORD_RING_SIZE), m_thread(0), m_stop(false), m_fd(-1), m_index(0), m_text(0),
+	  m_startTime(0), m_pendingDrops(0), m_dropped(0)
+{
+}
+Recorder::~Recorder()
+{
+	close();
+}
+
+int Recorder::open(const string& path, bool textView)
+{
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (m_fd == -1)
+	{
+		LOG("unable to create %s\r\n", path.c_str());
+		return -1;
+	}
+	m_index = fopen((path + ".idx").c_str(), "wb");
+	if (!m_index)
+	{
+		LOG("unable to create %s.idx\r\n", path.c_str());
+		return -1;
+	}
+	if (textView)
+	{
+		m_text = fopen((path + ".txt").c_str(), "w");
+		if (!m_text)
+		{
+			LOG("unable to create %s.txt\r\n", path.c_str());
+			return -1;
+		}
+	}
+
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	TRecordHeader header;
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	header.startTime = tv.tv_sec * 1000000ull + tv.tv_usec;
+
+	m_offset = m_allocated = 0;
+	m_chunkFill = m_chunkLeft = 0;
+	m_lastIndexTime = 0;
+	m_indexed = false;
+	m_lineStart = true;
+	if (writeFile((const uint8_t*)&header, sizeof(header)))
+		return -1;
+
+	m_startTime = monotonicUs();
+	m_stop = false;
+	m_thread = new thread(&Recorder::run, this);
+	return 0;
+}
+
+void Recorder::push(const uint8_t* data, int len)
+{
+	TRecordChunk chunk;
+	if (m_ring.space() < sizeof(chunk) + len)
+	{
+		m_pendingDrops += len;
+		m_dropped += len;
+		return;
+	}
+	chunk.time = monotonicUs() - m_startTime;
+	chunk.len = len;
+	chunk.dropped = m_pendingDrops;
+	m_pendingDrops = 0;
+	m_ring.write((const uint8_t*)&chunk, sizeof(chunk));
+	m_ring.write(data, len);
+}
+
+void Recorder::close()
+{
+	if (m_thread)
+	{
+		m_stop = true;
+		m_thread->join();
+		delete m_thread;
+		m_thread = 0;
+	}
+	if (m_fd != -1)
+	{
+		if (ftruncate(m_fd, m_offset))
+			LOG_DEBUG("recorder: unable to truncate the preallocated space");
+		::close(m_fd);
+		m_fd = -1;
+	}
+	if (m_index)
+	{
+		fclose(m_index);
+		m_index = 0;
+	}
+	if (m_text)
+	{
+		fclose(m_text);
+		m_text = 0;
+	}
+}
+
+void Recorder::run()
+{
+	for (;;)
+	{
+		const uint8_t* data;
+		uint32_t len = m_ring.peek(data);
+		if (len)
+		{
+			// the ring holds the file content as is, it is only parsed for the index and text view
+			parse(data, len);
+			writeFile(data, len);
+			m_ring.consume(len);
+			continue;
+		}
+		if (m_stop)
+			break;
+		usleep(RECORD_IDLE_US);
+	}
+}
+
+int Recorder::writeFile(const uint8_t* data, uint32_t len)
+{
+#ifdef __linux__
+	if (m_offset + len > m_allocated)
+	{
+		if (posix_fallocate(m_fd, m_allocated, RECORD_PREALLOC_STEP) == 0)
+			m_allocated += RECORD_PREALLOC_STEP;
+	}
+#endif
+	while (len)
+	{
+		int r = write(m_fd, data, len);
+		if (r <= 0)
+		{
+			LOG_DEBUG("recorder: write failed");
+			return -1;
+		}
+		data += r;
+		len -= r;
+		m_offset += r;
+	}
+	return 0;
+}
+
+void Recorder::parse(const uint8_t* data, uint32_t len)
+{
+	uint64_t offset = m_offset;
+	while (len)
+	{
+		if (m_chunkFill < sizeof(m_chunk))
+		{
+			uint32_t n = sizeof(m_chunk) - m_chunkFill;
+			if (n > len)
+				n = len;
+			memcpy((uint8_t*)&m_chunk + m_chunkFill, data, n);
+			m_chunkFill += n;
+			data += n;
+			len -= n;
+			offset += n;
+			if (m_chunkFill < sizeof(m_chunk))
+				break;
+
+			m_chunkLeft = m_chunk.len;
+			if (!m_indexed || m_chunk.time >= m_lastIndexTime + RECORD_INDEX_INTERVAL_US)
+			{
+				TRecordIndexEntry entry = { m_chunk.time, offset - sizeof(m_chunk) };
+				fwrite(&entry, sizeof(entry), 1, m_index);
+				m_lastIndexTime = m_chunk.time;
+				m_indexed = true;
+			}
+		}
+
+		uint32_t n = m_chunkLeft < len ? m_chunkLeft : len;
+		if (m_text)
+			writeText(data, n);
+		data += n;
+		len -= n;
+		offset += n;
+		m_chunkLeft -= n;
+		if (m_chunkLeft == 0)
+			m_chunkFill = 0;
+	}
+}
+
+void Recorder::writeText(const uint8_t* data, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uint8_t c = data[i];
+		if (c == '\r')
+			continue;
+		if (m_lineStart)
+		{
+			fprintf(m_text, "[%12.6f] ", m_chunk.time / 1e6);
+			m_lineStart = false;
+		}
+		if (c == '\n')
+		{
+			fputc('\n', m_text);
+			m_lineStart = true;
+		}
+		else if (c == '\t' || (c >= 0x20 && c < 0x7f))
+		{
+			fputc(c, m_text);
+		}
+		else
+		{
+			fprintf(m_text, "\\x%02x", c);
+		}
+	}
+}
+
+int sliceRecording(const string& path, double from, double to, FILE* out)
+{
+	uint64_t fromUs = from * 1e6, toUs = to * 1e6;
+
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		LOG("unable to open %s\r\n", path.c_str());
+		return -1;
+	}
+	TRecordHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0)
+	{
+		LOG("%s is not a console recording\r\n", path.c_str());
+		fclose(f);
+		return -1;
+	}
+
+	// last index entry not after the start of the range
+	uint64_t offset = sizeof(header);
+	FILE* idx = fopen((path + ".idx").c_str(), "rb");
+	if (idx)
+	{
+		fseek(idx, 0, SEEK_END);
+		long lo = 0, hi = ftell(idx) / sizeof(TRecordIndexEntry) - 1;
+		while (lo <= hi)
+		{
+			long mid = (lo + hi) / 2;
+			TRecordIndexEntry entry;
+			fseek(idx, mid * sizeof(entry), SEEK_SET);
+			if (fread(&entry, sizeof(entry), 1, idx) != 1)
+				break;
+			if (entry.time <= fromUs)
+			{
+				offset = entry.offset;
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid - 1;
+			}
+		}
+		fclose(idx);
+	}
+	else
+	{
+		LOG_DEBUG("no index for %s, reading from the start", path.c_str());
+	}
+
+	fseek(f, offset, SEEK_SET);
+	vector<uint8_t> buf;
+	TRecordChunk chunk;
+	while (fread(&chunk, sizeof(chunk), 1, f) == 1 && chunk.time <= toUs)
+	{
+		if (chunk.time < fromUs)
+		{
+			fseek(f, chunk.len, SEEK_CUR);
+			continue;
+		}
+		buf.resize(chunk.len);
+		if (fread(buf.data(), 1, chunk.len, f) != chunk.len)
+			break;
+		if (chunk.dropped)
+			LOG_DEBUG("%u bytes lost before %.6f s", chunk.dropped, chunk.time / 1e6);
+		fwrite(buf.data(), 1, chunk.len, out);
+	}
+	fclose(f);
+	return 0;
+}
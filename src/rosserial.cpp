@@ -0,0 +1,225 @@
+#include "rosserial.h"
+
+#include <string.h>
+
+static const char* logLevels[] = { "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+
+RosserialDemux::RosserialDemux(TextCallback text, void* userdata)
+	: m_text(text), m_userdata(userdata), m_frames(0), m_state(ST_TEXT), m_fill(0), m_len(0), m_topic(0), m_sum(0),
+	  m_badFrames(0)
+{
+	m_frame = new uint8_t[ROSSERIAL_HEADER_SIZE + ROSSERIAL_MAX_DATA + 1];
+}
+RosserialDemux::~RosserialDemux()
+{
+	delete[] m_frame;
+}
+
+void RosserialDemux::process(const uint8_t* data, int len)
+{
+	const uint8_t* textStart = data;
+	const uint8_t* end = data + len;
+	const uint8_t* p = data;
+
+	while (p < end)
+	{
+		if (m_state == ST_TEXT)
+		{
+			const uint8_t* sync = (const uint8_t*)memchr(p, ROSSERIAL_SYNC, end - p);
+			if (!sync)
+				break;
+			if (sync > textStart)
+				m_text(textStart, sync - textStart, m_userdata);
+			m_frame[0] = ROSSERIAL_SYNC;
+			m_fill = 1;
+			m_state = ST_VERSION;
+			p = sync + 1;
+			continue;
+		}
+
+		if (m_state == ST_DATA)
+		{
+			// bulk of the frame, copied in one go
+			uint32_t n = m_len - (m_fill - ROSSERIAL_HEADER_SIZE);
+			if (n > (uint32_t)(end - p))
+				n = end - p;
+			memcpy(m_frame + m_fill, p, n);
+			for (uint32_t i = 0; i < n; i++)
+				m_sum += p[i];
+			m_fill += n;
+			p += n;
+			if (m_fill == ROSSERIAL_HEADER_SIZE + m_len)
+				m_state = ST_CHK;
+			continue;
+		}
+
+		uint8_t c = *p++;
+		m_frame[m_fill++] = c;
+		switch (m_state)
+		{
+		case ST_VERSION:
+			if (c == ROSSERIAL_VERSION)
+			{
+				m_state = ST_LEN_LO;
+			}
+			else if (c == ROSSERIAL_SYNC)
+			{
+				// only the bytes before it were text, the byte may start the next frame
+				m_fill--;
+				dropFrame();
+				m_frame[0] = ROSSERIAL_SYNC;
+				m_fill = 1;
+				m_state = ST_VERSION;
+			}
+			else
+			{
+				dropFrame();
+			}
+			break;
+		case ST_LEN_LO:
+			m_len = c;
+			m_state = ST_LEN_HI;
+			break;
+		case ST_LEN_HI:
+			m_len |= c << 8;
+			m_state = ST_LEN_CHK;
+			break;
+		case ST_LEN_CHK:
+			if ((uint8_t)(m_frame[2] + m_frame[3] + c) != 0xff)
+			{
+				m_badFrames++;
+				dropFrame();
+				break;
+			}
+			m_state = ST_TOPIC_LO;
+			break;
+		case ST_TOPIC_LO:
+			m_topic = c;
+			m_sum = c;
+			m_state = ST_TOPIC_HI;
+			break;
+		case ST_TOPIC_HI:
+			m_topic |= c << 8;
+			m_sum += c;
+			m_state = m_len ? ST_DATA : ST_CHK;
+			break;
+		case ST_CHK:
+			if ((uint8_t)(m_sum + c) != 0xff)
+			{
+				m_badFrames++;
+				dropFrame();
+				break;
+			}
+			frameDone();
+			break;
+		default:
+			break;
+		}
+		textStart = p;
+	}
+
+	if (m_state == ST_TEXT && end > textStart)
+		m_text(textStart, end - textStart, m_userdata);
+}
+
+void RosserialDemux::frameDone()
+{
+	const uint8_t* data = m_frame + ROSSERIAL_HEADER_SIZE;
+	TTopicStats& stats = m_topics[m_topic];
+	stats.frames++;
+	stats.bytes += m_fill;
+
+	if (m_topic == ROSSERIAL_ID_PUBLISHER || m_topic == ROSSERIAL_ID_SUBSCRIBER)
+		parseTopicInfo(data, m_len);
+	else if (m_topic == ROSSERIAL_ID_LOG)
+		parseLog(data, m_len);
+	if (m_frames)
+		fwrite(m_frame, 1, m_fill, m_frames);
+
+	m_fill = 0;
+	m_state = ST_TEXT;
+}
+
+void RosserialDemux::dropFrame()
+{
+	// not a frame after all, the bytes were text
+	m_text(m_frame, m_fill, m_userdata);
+	m_fill = 0;
+	m_state = ST_TEXT;
+}
+
+static bool readString(const uint8_t*& p, const uint8_t* end, string* s)
+{
+	if (end - p < 4)
+		return false;
+	uint32_t len = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	p += 4;
+	if ((uint32_t)(end - p) < len)
+		return false;
+	if (s)
+		s->assign((const char*)p, len);
+	p += len;
+	return true;
+}
+
+// rosserial_msgs/TopicInfo: uint16 topic_id, string topic_name, string message_type, ...
+void RosserialDemux::parseTopicInfo(const uint8_t* data, uint32_t len)
+{
+	const uint8_t* end = data + len;
+	if (len < 2)
+		return;
+	uint16_t id = data[0] | (data[1] << 8);
+	const uint8_t* p = data + 2;
+	string name;
+	if (readString(p, end, &name))
+		m_topics[id].name = name;
+}
+
+// rosserial_msgs/Log: uint8 level, string msg
+void RosserialDemux::parseLog(const uint8_t* data, uint32_t len)
+{
+	if (len < 1)
+		return;
+	uint8_t level = data[0];
+	const uint8_t* p = data + 1;
+	string msg;
+	if (!readString(p, data + len, &msg))
+		return;
+
+	char prefix[32];
+	int n = snprintf(prefix, sizeof(prefix), "[rosserial %s] ", level < 5 ? logLevels[level] : "?");
+	m_text((const uint8_t*)prefix, n, m_userdata);
+	m_text((const uint8_t*)msg.data(), msg.size(), m_userdata);
+	m_text((const uint8_t*)"\n", 1, m_userdata);
+}
+
+void RosserialDemux::printRates(FILE* f, double interval)
+{
+	fprintf(f, "\r\n[rosserial:");
+	for (map<uint16_t, TTopicStats>::iterator it = m_topics.begin(); it != m_topics.end(); it++)
+	{
+		TTopicStats& stats = it->second;
+		if (stats.frames == stats.lastFrames)
+			continue;
+		if (stats.name.empty())
+			fprintf(f, " #%d", it->first);
+		else
+			fprintf(f, " %s", stats.name.c_str());
+		fprintf(f, " %.1f Hz %.1f kB/s", (stats.frames - stats.lastFrames) / interval,
+		        (stats.bytes - stats.lastBytes) / interval / 1024.0);
+		stats.lastFrames = stats.frames;
+		stats.lastBytes = stats.bytes;
+	}
+	fprintf(f, "]\r\n");
+}
+
+void RosserialDemux::printSummary(FILE* f)
+{
+	fprintf(f, "rosserial topics:\r\n");
+	for (map<uint16_t, TTopicStats>::iterator it = m_topics.begin(); it != m_topics.end(); it++)
+	{
+		fprintf(f, "  %5d %-30s %10llu frames %12llu bytes\r\n", it->first, it->second.name.c_str(),
+		        (unsigned long long)it->second.frames, (unsigned long long)it->second.bytes);
+	}
+	fprintf(f, "  %llu corrupted frames\r\n", (unsigned long long)m_badFrames);
+}
@@ -0,0 +1,116 @@
+#include "softbatch.h"
+
+#include <stdio.h>
+
+#include <atomic>
+
+#ifdef UNIX
+#include <thread>
+#elif WIN32
+#include "mingw.thread.h"
+#endif
+
+#include <pthread.h>
+
+#include "SoftFlasher.h"
+#include "timeutil.h"
+#include "utils.h"
+
+struct TSoftBatch
+{
+	THexFile* image;
+	const vector<string>* devices;
+	int baudrate;
+	int verifyMode;
+	std::atomic<int> next;
+	std::atomic<int> failed;
+};
+
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int updateBoard(SoftFlasher& flasher, int verifyMode, const char*& failedStage)
+{
+	failedStage = "connect";
+	if (flasher.init() != 0 || flasher.start() != 0)
+		return -1;
+	failedStage = "erase";
+	if (flasher.erase() != 0)
+		return -1;
+	failedStage = "program";
+	if (flasher.flash() != 0)
+		return -1;
+	failedStage = "verify";
+	if (verifyMode != -1 && flasher.verify((EVerifyMode)verifyMode) != 0)
+		return -1;
+	failedStage = "reset";
+	return flasher.reset();
+}
+
+// the sessions over FTDI stay in the thread that opened them, the FTDI
+// state of myFTDI is per thread
+static void softWorker(TSoftBatch* batch)
+{
+	for (;;)
+	{
+		int idx = batch->next++;
+		if (idx >= (int)batch->devices->size())
+			break;
+		const string& device = (*batch->devices)[idx];
+
+		SoftFlasher flasher;
+		flasher.setDevice(device);
+		flasher.setBaudrate(batch->baudrate);
+		flasher.setHexFile(batch->image);
+		// the progress of several boards would interleave, only the result is printed
+		flasher.setQuiet(true);
+
+		uint32_t startTime = TimeUtilGetSystemTimeMs();
+		const char* failedStage;
+		int res = updateBoard(flasher, batch->verifyMode, failedStage);
+		// a failed update leaves the board in the bootloader
+		flasher.cleanup(false);
+		uint32_t endTime = TimeUtilGetSystemTimeMs();
+
+		pthread_mutex_lock(&logMutex);
+		if (res == 0)
+		{
+			LOG("Board %s: OK (%u ms)\r\n", device.c_str(), endTime - startTime);
+		}
+		else
+		{
+			LOG("Board %s: failed at %s\r\n", device.c_str(), failedStage);
+			batch->failed++;
+		}
+		pthread_mutex_unlock(&logMutex);
+	}
+}
+
+int runSoftBatch(THexFile& image, const vector<string>& devices, int baudrate, int workers, int verifyMode)
+{
+	TSoftBatch batch;
+	batch.image = &image;
+	batch.devices = &devices;
+	batch.baudrate = baudrate;
+	batch.verifyMode = verifyMode;
+	batch.next = 0;
+	batch.failed = 0;
+
+	if (workers <= 0 || workers > (int)devices.size())
+		workers = devices.size();
+
+	uint32_t startTime = TimeUtilGetSystemTimeMs();
+	vector<std::thread*> threads;
+	for (int i = 0; i < workers; i++)
+		threads.push_back(new std::thread(softWorker, &batch));
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	uint32_t endTime = TimeUtilGetSystemTimeMs();
+
+	int failed = batch.failed;
+	LOG("==== Summary ====\n%d of %d boards updated in %u ms\n", (int)devices.size() - failed,
+	    (int)devices.size(), endTime - startTime);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,488 @@
+#include "station.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <list>
+#include <set>
+
+#ifdef UNIX
+#include <thread>
+#elif WIN32
+#include "mingw.thread.h"
+#endif
+
+#include <pthread.h>
+#include <libusb.h>
+
+#include "HardFlasher.h"
+#include "myFTDI.h"
+#include "timeutil.h"
+#include "utils.h"
+
+// connection attempts per try, one attempt takes ~200 ms
+#define STATION_CONNECT_ATTEMPTS 10
+// full pipeline retries per board (e.g. after option bytes were changed)
+#define STATION_RETRIES 3
+// how often the device list is polled when hotplug is not available
+#define STATION_POLL_MS 500
+// nobody replugs a board at the station, a worker waiting for it gives up
+#define STATION_REPLUG_TIMEOUT_MS 30000
+
+static const char* stageNames[] = { "setup", "erase", "program", "protect", "reset", "register" };
+
+struct TStationJob
+{
+	uart_device_t device;
+	std::thread thread;
+	std::atomic<bool> done;
+	int identity; // serial registered on this board, -1 if none
+	bool alreadyRegistered;
+};
+
+static volatile bool stop = false;
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<libusb_device*> arrived;
+
+static void stationSigHandler(int)
+{
+	if (stop)
+		exit(1);
+	stop = true;
+}
+
+static int LIBUSB_CALL hotplugCallback(libusb_context*, libusb_device* device,
+                                       libusb_hotplug_event, void*)
+{
+	// no I/O allowed here, the device is described later by the main loop
+	arrived.push_back(libusb_ref_device(device));
+	return 0;
+}
+
+Station::Station(THexFile& image, int baudrate)
+	: m_image(image), m_baudrate(baudrate), m_log(stdout), m_claims(0),
+	  m_regVersion(0), m_regType(0), m_regHeaderId(0)
+{
+	pthread_mutex_init(&m_claimMutex, 0);
+	setPipeline("setup,erase,program,reset");
+}
+
+int Station::setPipeline(const string& pipeline)
+{
+	vector<string> names = splitString(pipeline, ",");
+	vector<EStationStage> stages;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		int j;
+		for (j = 0; j < (int)(sizeof(stageNames) / sizeof(stageNames[0])); j++)
+			if (names[i] == stageNames[j])
+				break;
+		if (j == sizeof(stageNames) / sizeof(stageNames[0]))
+		{
+			LOG("unknown pipeline stage '%s'\r\n", names[i].c_str());
+			return -1;
+		}
+		stages.push_back((EStationStage)j);
+	}
+	m_stages = stages;
+	return 0;
+}
+
+int Station::setLog(const string& path)
+{
+	FILE* f = fopen(path.c_str(), "a");
+	if (!f)
+	{
+		LOG("unable to open log file %s\r\n", path.c_str());
+		return -1;
+	}
+	m_log = f;
+	return 0;
+}
+
+// manifest: CSV lines "serial,key" or a JSON array of {"serial": N, "key": "hex"}
+static bool parseManifest(const string& text, vector<TIdentity>& identities)
+{
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first != string::npos && text[first] == '[')
+	{
+		size_t pos = first;
+		while ((pos = text.find('{', pos)) != string::npos)
+		{
+			size_t end = text.find('}', pos);
+			if (end == string::npos)
+				return false;
+			string obj = text.substr(pos, end - pos);
+			size_t serialPos = obj.find("\"serial\"");
+			size_t keyPos = obj.find("\"key\"");
+			if (serialPos == string::npos || keyPos == string::npos)
+				return false;
+
+			TIdentity id;
+			id.used = false;
+			serialPos = obj.find(':', serialPos);
+			keyPos = obj.find('"', obj.find(':', keyPos));
+			if (serialPos == string::npos || keyPos == string::npos)
+				return false;
+			id.serial = atoi(obj.c_str() + serialPos + 1);
+			size_t keyEnd = obj.find('"', keyPos + 1);
+			if (keyEnd == string::npos || !hexDecode(obj.substr(keyPos + 1, keyEnd - keyPos - 1), id.key, 16))
+				return false;
+			identities.push_back(id);
+			pos = end;
+		}
+		return true;
+	}
+
+	vector<string> lines = splitString(text, "\n");
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		string line = lines[i];
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		vector<string> fields = splitString(line, ",");
+		if (fields.size() < 2)
+			return false;
+		if (!isdigit(fields[0][0]))
+			continue; // column names
+		TIdentity id;
+		id.used = false;
+		id.serial = atoi(fields[0].c_str());
+		if (!hexDecode(fields[1], id.key, 16))
+			return false;
+		identities.push_back(id);
+	}
+	return true;
+}
+
+int Station::setManifest(const string& path, uint32_t version, int type, int headerId)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		LOG("unable to open manifest %s\r\n", path.c_str());
+		return -1;
+	}
+	string text;
+	char buf[4096];
+	size_t r;
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, r);
+	fclose(f);
+
+	m_identities.clear();
+	if (!parseManifest(text, m_identities) || m_identities.empty())
+	{
+		LOG("invalid manifest %s\r\n", path.c_str());
+		return -1;
+	}
+
+	// "<serial> <board>" per claimed identity, never handed out again even if
+	// the registration failed as OTP may already be partially written
+	string claimsPath = path + ".claims";
+	f = fopen(claimsPath.c_str(), "r");
+	if (f)
+	{
+		int serial;
+		char board[64];
+		while (fscanf(f, "%d %63s", &serial, board) == 2)
+			for (size_t i = 0; i < m_identities.size(); i++)
+				if (m_identities[i].serial == serial)
+					m_identities[i].used = true;
+		fclose(f);
+	}
+	m_claims = fopen(claimsPath.c_str(), "a");
+	if (!m_claims)
+	{
+		LOG("unable to open %s\r\n", claimsPath.c_str());
+		return -1;
+	}
+
+	int left = 0;
+	for (size_t i = 0; i < m_identities.size(); i++)
+		if (!m_identities[i].used)
+			left++;
+	LOG("Manifest: %d identities, %d unused\r\n", (int)m_identities.size(), left);
+
+	m_regVersion = version;
+	m_regType = type;
+	m_regHeaderId = headerId;
+	return 0;
+}
+
+TIdentity* Station::claimIdentity(const string& board)
+{
+	TIdentity* id = 0;
+	pthread_mutex_lock(&m_claimMutex);
+	for (size_t i = 0; i < m_identities.size(); i++)
+	{
+		if (!m_identities[i].used)
+		{
+			id = &m_identities[i];
+			break;
+		}
+	}
+	if (id)
+	{
+		// persisted before anything is written to the board
+		if (fprintf(m_claims, "%d %s\n", id->serial, board.c_str()) < 0 || fflush(m_claims) != 0)
+			id = 0;
+#ifndef WIN32
+		else
+			fsync(fileno(m_claims));
+#endif
+	}
+	if (id)
+		id->used = true;
+	pthread_mutex_unlock(&m_claimMutex);
+	return id;
+}
+
+int Station::registerBoard(HardFlasher& flasher, TStationJob* job)
+{
+	TRoboCOREHeader old;
+	if (flasher.readHeader(old, m_regHeaderId))
+		return -1;
+	if (!old.isClear())
+	{
+		job->alreadyRegistered = true;
+		return 0;
+	}
+
+	TIdentity* id = claimIdentity(job->device.serial);
+	if (!id)
+	{
+		LOG("No identity left for board %s\r\n", job->device.serial.c_str());
+		return -1;
+	}
+	job->identity = id->serial;
+
+	TRoboCOREHeader h;
+	h.headerVersion = 0x02;
+	h.type = m_regType;
+	h.version = m_regVersion;
+	h.id = id->serial;
+	h.setKey(id->key);
+	return flasher.writeHeader(h, m_regHeaderId);
+}
+
+int Station::runStage(HardFlasher& flasher, EStationStage stage, TStationJob* job)
+{
+	switch (stage)
+	{
+	case STAGE_SETUP:
+	{
+		int res = flasher.setup();
+		if (res == 1 && flasher.reconnect() == 0)
+			res = flasher.setup();
+		return res;
+	}
+	case STAGE_ERASE: return flasher.erase();
+	case STAGE_PROGRAM: return flasher.flash();
+	case STAGE_PROTECT: return flasher.protect();
+	case STAGE_RESET: return flasher.reset();
+	case STAGE_REGISTER: return registerBoard(flasher, job);
+	}
+	return -1;
+}
+
+void Station::runBoard(TStationJob* job)
+{
+	uart_set_replug_timeout(STATION_REPLUG_TIMEOUT_MS);
+
+	HardFlasher flasher;
+	flasher.setDevice(job->device.serial);
+	flasher.setBaudrate(m_baudrate);
+	flasher.setHexFile(&m_image);
+	flasher.setMaxAttempts(STATION_CONNECT_ATTEMPTS);
+
+	uint32_t startTime = TimeUtilGetSystemTimeMs();
+	const char* failedStage = "connect";
+	int res = -1, tries;
+	for (tries = 1; tries <= STATION_RETRIES && !stop; tries++)
+	{
+		failedStage = "connect";
+		res = flasher.start();
+		if (res != 0)
+			continue;
+
+		for (size_t i = 0; i < m_stages.size() && res == 0; i++)
+		{
+			failedStage = stageNames[m_stages[i]];
+			res = runStage(flasher, m_stages[i], job);
+		}
+		// an identity must not be retried, the OTP may be partially written
+		if (res == 0 || job->identity != -1)
+			break;
+	}
+	flasher.cleanup();
+	uint32_t endTime = TimeUtilGetSystemTimeMs();
+
+	char timeStr[32];
+	time_t now = time(0);
+
+	pthread_mutex_lock(&logMutex);
+	strftime(timeStr, sizeof(timeStr), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	fprintf(m_log, "{\"time\":\"%s\",\"serial\":\"%s\",\"port\":\"%s\",\"result\":\"%s\"",
+	        timeStr, jsonEscape(job->device.serial).c_str(), jsonEscape(job->device.port).c_str(),
+	        res == 0 ? "ok" : "failed");
+	if (res != 0)
+		fprintf(m_log, ",\"stage\":\"%s\"", failedStage);
+	if (job->identity != -1)
+		fprintf(m_log, ",\"registered\":%d", job->identity);
+	else if (job->alreadyRegistered)
+		fprintf(m_log, ",\"registered\":\"already\"");
+	fprintf(m_log, ",\"attempts\":%d,\"duration_ms\":%u}\n", res == 0 ? tries : tries - 1, endTime - startTime);
+	fflush(m_log);
+	pthread_mutex_unlock(&logMutex);
+
+	job->done = true;
+}
+
+int Station::run()
+{
+	libusb_context* ctx = nullptr;
+	libusb_hotplug_callback_handle hotplugHandle;
+	bool hotplug = false;
+	set<string> present;
+	list<TStationJob*> jobs;
+
+	for (size_t i = 0; i < m_stages.size(); i++)
+	{
+		if ((m_stages[i] == STAGE_ERASE || m_stages[i] == STAGE_PROGRAM) && m_image.parts.empty())
+		{
+			LOG("pipeline stage '%s' needs an image\r\n", stageNames[m_stages[i]]);
+			return 1;
+		}
+		if (m_stages[i] == STAGE_REGISTER && !m_claims)
+		{
+			LOG("pipeline stage 'register' needs a manifest\r\n");
+			return 1;
+		}
+	}
+
+	if (libusb_init(&ctx) < 0)
+	{
+		LOG("unable to initialize libusb\r\n");
+		return 1;
+	}
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		int r = libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, (libusb_hotplug_flag)0,
+		        0x0403, 0x6015, LIBUSB_HOTPLUG_MATCH_ANY, hotplugCallback, 0, &hotplugHandle);
+		hotplug = r == LIBUSB_SUCCESS;
+	}
+	if (!hotplug)
+	{
+		// boards attached before the station was started are not new
+		vector<uart_device_t> devices;
+		uart_list_devices(devices);
+		for (size_t i = 0; i < devices.size(); i++)
+			present.insert(devices[i].serial);
+	}
+
+	signal(SIGINT, stationSigHandler);
+	LOG("Station ready (%s), waiting for boards...\r\n", hotplug ? "hotplug" : "polling");
+
+	while (!stop)
+	{
+		vector<uart_device_t> attached;
+		if (hotplug)
+		{
+			struct timeval tv = { 0, 200 * 1000 };
+			libusb_handle_events_timeout_completed(ctx, &tv, 0);
+
+			for (size_t i = 0; i < arrived.size(); i++)
+			{
+				uart_device_t info;
+				// udev may need a moment to apply permissions to the new node
+				for (int tries = 0; tries < 10; tries++)
+				{
+					if (uart_describe_device(arrived[i], info))
+					{
+						attached.push_back(info);
+						break;
+					}
+					TimeUtilDelayMs(100);
+				}
+				libusb_unref_device(arrived[i]);
+			}
+			arrived.clear();
+		}
+		else
+		{
+			TimeUtilDelayMs(STATION_POLL_MS);
+
+			vector<uart_device_t> devices;
+			set<string> current;
+			uart_list_devices(devices);
+			for (size_t i = 0; i < devices.size(); i++)
+			{
+				current.insert(devices[i].serial);
+				if (present.find(devices[i].serial) == present.end())
+					attached.push_back(devices[i]);
+			}
+			present = current;
+		}
+
+		for (size_t i = 0; i < attached.size(); i++)
+		{
+			// ignore re-enumeration of a board that is being processed
+			bool busy = false;
+			for (list<TStationJob*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+				if ((*it)->device.serial == attached[i].serial)
+					busy = true;
+			if (busy)
+				continue;
+
+			LOG("Board %s attached at %s\r\n", attached[i].serial.c_str(), attached[i].port.c_str());
+			TStationJob* job = new TStationJob();
+			job->device = attached[i];
+			job->done = false;
+			job->identity = -1;
+			job->alreadyRegistered = false;
+			job->thread = std::thread(&Station::runBoard, this, job);
+			jobs.push_back(job);
+		}
+
+		for (list<TStationJob*>::iterator it = jobs.begin(); it != jobs.end();)
+		{
+			if ((*it)->done)
+			{
+				(*it)->thread.join();
+				LOG("Board %s done\r\n", (*it)->device.serial.c_str());
+				delete *it;
+				it = jobs.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+
+	if (!jobs.empty())
+		LOG("Waiting for %d boards to finish...\r\n", (int)jobs.size());
+	for (list<TStationJob*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+	{
+		(*it)->thread.join();
+		delete *it;
+	}
+
+	if (hotplug)
+		libusb_hotplug_deregister_callback(ctx, hotplugHandle);
+	libusb_exit(ctx);
+	if (m_log != stdout)
+		fclose(m_log);
+	if (m_claims)
+		fclose(m_claims);
+	return 0;
+}
@@ -1,5 +1,9 @@
 #include "utils.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
 int log_debug = 0;
 
 uint16_t crc16_calc(const uint8_t* data, int len)
@@ -22,6 +26,118 @@ uint16_t crc16_calc(const uint8_t* data, int len)
 
 	return crc;
 }
+uint32_t crc32_stm32(const uint8_t* data, int len, uint32_t crc)
+{
+	for (int i = 0; i + 4 <= len; i += 4)
+	{
+		crc ^= data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+		for (int j = 0; j < 32; j++)
+		{
+			if (crc & 0x80000000)
+				crc = (crc << 1) ^ 0x04c11db7;
+			else
+				crc = (crc << 1);
+		}
+	}
+	return crc;
+}
+static const uint32_t sha256K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+TSha256::TSha256()
+	: m_length(0), m_bufLen(0)
+{
+	static const uint32_t init[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(m_state, init, sizeof(m_state));
+}
+void TSha256::update(const void* data, size_t len)
+{
+	const uint8_t* _data = (const uint8_t*)data;
+	m_length += len;
+	while (len)
+	{
+		size_t n = 64 - m_bufLen;
+		if (n > len)
+			n = len;
+		memcpy(m_buf + m_bufLen, _data, n);
+		m_bufLen += n;
+		_data += n;
+		len -= n;
+		if (m_bufLen == 64)
+		{
+			transform(m_buf);
+			m_bufLen = 0;
+		}
+	}
+}
+void TSha256::final(uint8_t digest[32])
+{
+	uint64_t bits = m_length * 8;
+	uint8_t pad = 0x80;
+	update(&pad, 1);
+	pad = 0;
+	while (m_bufLen != 56)
+		update(&pad, 1);
+	uint8_t len[8];
+	for (int i = 0; i < 8; i++)
+		len[i] = bits >> (56 - i * 8);
+	update(len, 8);
+
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 4; j++)
+			digest[i * 4 + j] = m_state[i] >> (24 - j * 8);
+}
+void TSha256::transform(const uint8_t* block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+		w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+	uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	m_state[0] += a;
+	m_state[1] += b;
+	m_state[2] += c;
+	m_state[3] += d;
+	m_state[4] += e;
+	m_state[5] += f;
+	m_state[6] += g;
+	m_state[7] += h;
+}
+
 vector<string> splitString(const string& str, const string& delim, size_t maxCount, size_t start)
 {
 	vector<std::string> parts;
@@ -58,3 +174,41 @@ vector<string> splitString(const string& str, const string& delim, size_t maxCou
 	return parts;
 }
 
+string jsonEscape(const string& str)
+{
+	string res;
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\')
+		{
+			res += '\\';
+			res += c;
+		}
+		else if (c < 0x20)
+		{
+			char buf[8];
+			sprintf(buf, "\\u%04x", c);
+			res += buf;
+		}
+		else
+		{
+			res += c;
+		}
+	}
+	return res;
+}
+
+bool hexDecode(const string& str, uint8_t* data, int len)
+{
+	if ((int)str.size() != len * 2)
+		return false;
+	for (int i = 0; i < len; i++)
+	{
+		char byte[3] = { str[i * 2], str[i * 2 + 1], 0 };
+		if (!isxdigit(byte[0]) || !isxdigit(byte[1]))
+			return false;
+		data[i] = strtoul(byte, 0, 16);
+	}
+	return true;
+}
@@ -0,0 +1,60 @@
+#include "xcpmaster.h"
+
+#include <string.h>
+
+#include "myFTDI.h"
+#include "timeutil.h"
+#include "utils.h"
+
+// the default 16 ms latency timer would be added to every response
+#define XCP_FTDI_LATENCY_MS 1
+// the bytes of a packet follow each other without gaps
+#define XCP_FTDI_PACKET_TIMEOUT_MS 50
+
+// the uart_* state is per thread, so is the opened FTDI channel
+uint8_t XcpFtdiInit(const char* serial, uint32_t baudrate, uint8_t* ownsHandle)
+{
+	// SoftFlasher opens the handle itself to be able to reset the board
+	*ownsHandle = false;
+	if (!uart_is_opened())
+	{
+		uart_select_device(serial);
+		if (!uart_open(baudrate, true))
+			return false;
+		*ownsHandle = true;
+	}
+	// OpenBLT uses 8N1
+	if (uart_set_console(baudrate) != 0 || uart_set_latency(XCP_FTDI_LATENCY_MS) != 0 || uart_flush_rx() != 0)
+	{
+		XcpFtdiClose(*ownsHandle);
+		return false;
+	}
+	LOG_DEBUG("xcp: using FTDI at %u", baudrate);
+	return true;
+}
+
+uint8_t XcpFtdiWritePacket(uint8_t* data, uint8_t len)
+{
+	// the length byte and the packet go out in one USB transfer
+	uint8_t buf[XCP_MASTER_TX_MAX_DATA + 1];
+	buf[0] = len;
+	memcpy(buf + 1, data, len);
+	return uart_tx(buf, len + 1) == 0;
+}
+
+uint8_t XcpFtdiReceivePacket(tXcpTransportResponsePacket* packet, uint16_t timeOutMs)
+{
+	uint32_t startTime = TimeUtilGetSystemTimeMs();
+	if (uart_rx(&packet->len, 1, timeOutMs) != 1)
+		return false;
+
+	uint32_t elapsed = TimeUtilGetSystemTimeMs() - startTime;
+	uint32_t timeout = (elapsed < timeOutMs ? timeOutMs - elapsed : 0) + XCP_FTDI_PACKET_TIMEOUT_MS;
+	return uart_rx(packet->data, packet->len, timeout) == packet->len;
+}
+
+void XcpFtdiClose(uint8_t ownsHandle)
+{
+	if (ownsHandle)
+		uart_close();
+}
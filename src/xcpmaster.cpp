@@ -36,7 +36,9 @@
 ****************************************************************************************/
 #include <assert.h>                                   /* assertion module              */
 #include <stdint.h>                                   /* assertion module              */
+#include <string.h>                                   /* string library                */
 #include "xcpmaster.h"                                /* XCP master protocol module    */
+#include "timeutil.h"                                 /* time utility module           */
 
 
 /****************************************************************************************
@@ -47,14 +49,41 @@
 #define XCP_MASTER_CMD_DISCONNECT      (0xFE)
 #define XCP_MASTER_CMD_SET_MTA         (0xF6)
 #define XCP_MASTER_CMD_UPLOAD          (0xF5)
+#define XCP_MASTER_CMD_BUILD_CHECKSUM  (0xF3)
 #define XCP_MASTER_CMD_PROGRAM_START   (0xD2)
 #define XCP_MASTER_CMD_PROGRAM_CLEAR   (0xD1)
 #define XCP_MASTER_CMD_PROGRAM         (0xD0)
 #define XCP_MASTER_CMD_PROGRAM_RESET   (0xCF)
 #define XCP_MASTER_CMD_PROGRAM_MAX     (0xC9)
+#define XCP_MASTER_CMD_PROGRAM_NEXT    (0xCA)
+
+/* communication mode bits in the CONNECT and PROGRAM START responses */
+#define XCP_MASTER_COMM_MODE_MASTER_BLOCK (0x01) /* COMM_MODE_PGM: master block mode */
+#define XCP_MASTER_COMM_MODE_SLAVE_BLOCK  (0x40) /* COMM_MODE_BASIC: slave block mode */
+
+/** \brief Largest block of a block transfer, the length field is a single byte. */
+#define XCP_MASTER_MAX_BLOCK_LEN       (255)
 
 /* XCP response packet IDs as defined by the protocol */
 #define XCP_MASTER_CMD_PID_RES         (0xFF) /* positive response */
+#define XCP_MASTER_CMD_PID_ERR         (0xFE) /* error packet */
+
+/* XCP error codes as defined by the protocol */
+#define XCP_MASTER_ERR_OUT_OF_RANGE    (0x22)
+
+/* checksum types of the BUILD CHECKSUM response */
+#define XCP_MASTER_CS_ADD_11           (0x01) /* add byte into byte */
+#define XCP_MASTER_CS_ADD_12           (0x02) /* add byte into word */
+#define XCP_MASTER_CS_ADD_14           (0x03) /* add byte into dword */
+#define XCP_MASTER_CS_ADD_22           (0x04) /* add word into word */
+#define XCP_MASTER_CS_ADD_24           (0x05) /* add word into dword */
+#define XCP_MASTER_CS_ADD_44           (0x06) /* add dword into dword */
+#define XCP_MASTER_CS_CRC_16           (0x07) /* CRC-16, polynomial 0x8005 reflected */
+#define XCP_MASTER_CS_CRC_16_CITT      (0x08) /* CRC-16, polynomial 0x1021 */
+#define XCP_MASTER_CS_CRC_32           (0x09) /* CRC-32, polynomial 0x04C11DB7 reflected */
+
+/** \brief Number of bytes compared at once when verifying by upload. */
+#define XCP_MASTER_COMPARE_CHUNK_LEN   (1024)
 
 /* timeout values */
 #define XCP_MASTER_CONNECT_TIMEOUT_MS  (20)
@@ -73,69 +102,74 @@
 /****************************************************************************************
 * Function prototypes
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdConnect(void);
-static uint8_t XcpMasterSendCmdSetMta(uint32_t address);
-static uint8_t XcpMasterSendCmdUpload(uint8_t data[], uint8_t length);
-static uint8_t XcpMasterSendCmdProgramStart(void);
-static uint8_t XcpMasterSendCmdProgramReset(void);
-static uint8_t XcpMasterSendCmdProgram(uint8_t length, uint8_t data[]);
-static uint8_t XcpMasterSendCmdProgramMax(uint8_t data[]);
-static uint8_t XcpMasterSendCmdProgramClear(uint32_t length);
-static void     XcpMasterSetOrderedLong(uint32_t value, uint8_t data[]);
-
-
-/****************************************************************************************
-* Local data declarations
-****************************************************************************************/
-/** \brief Store the byte ordering of the XCP slave. */
-static uint8_t xcpSlaveIsIntel = false;
-
-/** \brief The max number of bytes in the command transmit object (master->slave). */
-static uint8_t xcpMaxCto;
-
-/** \brief The max number of bytes in the command transmit object (master->slave) during
- *         a programming session.
- */
-static uint8_t xcpMaxProgCto = 0;
-
-/** \brief The max number of bytes in the data transmit object (slave->master). */
-static uint8_t xcpMaxDto;
-
-/** \brief Internal data buffer for storing the data of the XCP response packet. */
-// static tXcpTransportResponsePacket responsePacket;
+static uint8_t XcpMasterSendCmdConnect(tXcpSession *session);
+static uint8_t XcpMasterSendCmdSetMta(tXcpSession *session, uint32_t address);
+static uint8_t XcpMasterSendCmdUpload(tXcpSession *session, uint8_t data[], uint8_t length);
+static uint8_t XcpMasterSendCmdProgramStart(tXcpSession *session);
+static uint8_t XcpMasterSendCmdProgramReset(tXcpSession *session);
+static uint8_t XcpMasterSendCmdProgram(tXcpSession *session, uint8_t length, uint8_t data[]);
+static uint8_t XcpMasterSendCmdProgramMax(tXcpSession *session, uint8_t data[]);
+static uint8_t XcpMasterSendCmdProgramBlock(tXcpSession *session, uint8_t length,
+                                            uint8_t data[]);
+static uint8_t XcpMasterSendCmdProgramClear(tXcpSession *session, uint32_t length);
+static uint8_t XcpMasterSendCmdBuildChecksum(tXcpSession *session, uint32_t length,
+                                             uint8_t *type, uint32_t *checksum,
+                                             uint32_t *maxLength);
+static uint8_t XcpMasterCalcChecksum(tXcpSession *session, uint8_t type, uint8_t data[],
+                                     uint32_t len, uint32_t *checksum);
+static void     XcpMasterSetOrderedLong(tXcpSession *session, uint32_t value, uint8_t data[]);
+static uint32_t XcpMasterGetOrderedLong(tXcpSession *session, uint8_t data[]);
 
 
 /************************************************************************************//**
-** \brief     Initializes the XCP master protocol layer.
+** \brief     Initializes the XCP master protocol layer. All state of the connection to
+**            one slave is kept in the session, so several slaves can be handled at the
+**            same time from different threads.
+** \param     session XCP session of the slave.
 ** \param     device Serial communication device name. For example "COM4".
 ** \param     baudrate Communication speed in bits/sec.
 ** \return    true is successful, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterInit(const char *device, uint32_t baudrate)
+uint8_t XcpMasterInit(tXcpSession *session, const char *device, uint32_t baudrate)
 {
+  /* reset the slave properties until the next connect */
+  session->slaveIsIntel = false;
+  session->maxCto = 0;
+  session->maxProgCto = 0;
+  session->maxDto = 0;
+  session->slaveBlockMode = false;
+  session->maxProgBlock = 0;
+  session->minStPgm = 0;
   /* initialize the underlying transport layer that is used for the communication */
-  return XcpTransportInit(device, baudrate);
+  session->transport = XcpTransportInit(device, baudrate);
+  return (session->transport != 0);
 } /*** end of XcpMasterInit ***/
 
 
 /************************************************************************************//**
 ** \brief     Uninitializes the XCP master protocol layer.
+** \param     session XCP session of the slave.
 ** \return    none.
 **
 ****************************************************************************************/
-void XcpMasterDeinit(void)
+void XcpMasterDeinit(tXcpSession *session)
 {
-  XcpTransportClose();
+  if (session->transport != 0)
+  {
+    XcpTransportClose(session->transport);
+    session->transport = 0;
+  }
 } /*** end of XcpMasterDeinit ***/
 
 
 /************************************************************************************//**
 ** \brief     Connect to the XCP slave.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterConnect(void)
+uint8_t XcpMasterConnect(tXcpSession *session)
 {
   uint8_t cnt;
   
@@ -143,7 +177,7 @@ uint8_t XcpMasterConnect(void)
   for (cnt=0; cnt<XCP_MASTER_CONNECT_RETRIES; cnt++)
   {
     /* send the connect command */
-    if (XcpMasterSendCmdConnect() == true)
+    if (XcpMasterSendCmdConnect(session) == true)
     {
       /* connected so no need to retry */
       return true;
@@ -156,95 +190,123 @@ uint8_t XcpMasterConnect(void)
 
 /************************************************************************************//**
 ** \brief     Disconnect the slave.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterDisconnect(void)
+uint8_t XcpMasterDisconnect(tXcpSession *session)
 {
   /* send reset command instead of the disconnect. this causes the user program on the
    * slave to automatically start again if present.
    */
-  return XcpMasterSendCmdProgramReset();
+  return XcpMasterSendCmdProgramReset(session);
 } /*** end of XcpMasterDisconnect ***/
 
 /************************************************************************************//**
 ** \brief     Puts a connected slave in programming session.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterStartProgrammingSession(void)
+uint8_t XcpMasterStartProgrammingSession(tXcpSession *session)
 {
   /* place the slave in programming mode */
-  return XcpMasterSendCmdProgramStart();
+  return XcpMasterSendCmdProgramStart(session);
 } /*** end of XcpMasterStartProgrammingSession ***/
 
 
 /************************************************************************************//**
 ** \brief     Stops the programming session by sending a program command with size 0 and
 **            then resetting the slave.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterStopProgrammingSession(void)
+uint8_t XcpMasterStopProgrammingSession(tXcpSession *session)
 {
   /* stop programming by sending the program command with size 0 */
-  if (XcpMasterSendCmdProgram(0, 0) == false)
+  if (XcpMasterFinishProgramming(session) == false)
   {
     return false;
   }
   /* request a reset of the slave */
-  return XcpMasterSendCmdProgramReset();
+  return XcpMasterSendCmdProgramReset(session);
 } /*** end of XcpMasterStopProgrammingSession ***/
 
 
+/************************************************************************************//**
+** \brief     Ends the programming by sending a program command with size 0, without
+**            resetting the slave. OpenBLT writes its buffered data and the checksum of
+**            the user program at this point, so the result can be verified afterwards.
+**            The session is ended with XcpMasterDisconnect().
+** \param     session XCP session of the slave.
+** \return    true is successfull, false otherwise.
+**
+****************************************************************************************/
+uint8_t XcpMasterFinishProgramming(tXcpSession *session)
+{
+  return XcpMasterSendCmdProgram(session, 0, 0);
+} /*** end of XcpMasterFinishProgramming ***/
+
+
 /************************************************************************************//**
 ** \brief     Erases non volatile memory on the slave.
+** \param     session XCP session of the slave.
 ** \param     addr Base memory address for the erase operation.
 ** \param     len Number of bytes to erase.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterClearMemory(uint32_t addr, uint32_t len)
+uint8_t XcpMasterClearMemory(tXcpSession *session, uint32_t addr, uint32_t len)
 {
   /* first set the MTA pointer */
-  if (XcpMasterSendCmdSetMta(addr) == false)
+  if (XcpMasterSendCmdSetMta(session, addr) == false)
   {
     return false;
   }
   /* now perform the erase operation */
-  return XcpMasterSendCmdProgramClear(len);
+  return XcpMasterSendCmdProgramClear(session, len);
 } /*** end of XcpMasterClearMemory ***/
 
 
 /************************************************************************************//**
 ** \brief     Reads data from the slave's memory.
+** \param     session XCP session of the slave.
 ** \param     addr Base memory address for the read operation
 ** \param     len Number of bytes to read.
 ** \param     data Destination buffer for storing the read data bytes.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterReadData(uint32_t addr, uint32_t len, uint8_t data[])
+uint8_t XcpMasterReadData(tXcpSession *session, uint32_t addr, uint32_t len, uint8_t data[])
 {
   uint8_t currentReadCnt;
   uint32_t bufferOffset = 0;
 
   /* first set the MTA pointer */
-  if (XcpMasterSendCmdSetMta(addr) == false)
+  if (XcpMasterSendCmdSetMta(session, addr) == false)
   {
     return false;
   }
   /* perform segmented upload of the data */
   while (len > 0)
   {
-    /* set the current read length to make optimal use of the available packet data. */
-    currentReadCnt = len % (xcpMaxDto - 1);
-    if (currentReadCnt == 0)
+    if (session->slaveBlockMode == true)
     {
-      currentReadCnt = (xcpMaxDto - 1);
+      /* the slave splits the data over as many response packets as needed */
+      currentReadCnt = (len > XCP_MASTER_MAX_BLOCK_LEN) ? XCP_MASTER_MAX_BLOCK_LEN : len;
+    }
+    else
+    {
+      /* set the current read length to make optimal use of the available packet data. */
+      currentReadCnt = len % (session->maxDto - 1);
+      if (currentReadCnt == 0)
+      {
+        currentReadCnt = (session->maxDto - 1);
+      }
     }
     /* upload some data */
-    if (XcpMasterSendCmdUpload(&data[bufferOffset], currentReadCnt) == false)
+    if (XcpMasterSendCmdUpload(session, &data[bufferOffset], currentReadCnt) == false)
     {
       return false;
     }
@@ -260,36 +322,54 @@ uint8_t XcpMasterReadData(uint32_t addr, uint32_t len, uint8_t data[])
 /************************************************************************************//**
 ** \brief     Programs data to the slave's non volatile memory. Note that it must be
 **            erased first.
+** \param     session XCP session of the slave.
 ** \param     addr Base memory address for the program operation
 ** \param     len Number of bytes to program.
 ** \param     data Source buffer with the to be programmed bytes.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-uint8_t XcpMasterProgramData(uint32_t addr, uint32_t len, uint8_t data[])
+uint8_t XcpMasterProgramData(tXcpSession *session, uint32_t addr, uint32_t len, uint8_t data[])
 {
   uint8_t currentWriteCnt;
   uint32_t bufferOffset = 0;
 
   /* first set the MTA pointer */
-  if (XcpMasterSendCmdSetMta(addr) == false)
+  if (XcpMasterSendCmdSetMta(session, addr) == false)
   {
     return false;
   }
+  /* in master block mode only the last packet of each block is responded to */
+  if (session->maxProgBlock > 0)
+  {
+    while (len > 0)
+    {
+      currentWriteCnt = (len > session->maxProgBlock) ? session->maxProgBlock : len;
+      if (XcpMasterSendCmdProgramBlock(session, currentWriteCnt, &data[bufferOffset]) == false)
+      {
+        return false;
+      }
+      /* update loop variables */
+      len -= currentWriteCnt;
+      bufferOffset += currentWriteCnt;
+    }
+    /* still here so all data successfully programmed */
+    return true;
+  }
   /* perform segmented programming of the data */
   while (len > 0)
   {
     /* set the current read length to make optimal use of the available packet data. */
-    currentWriteCnt = len % (xcpMaxProgCto - 1);
+    currentWriteCnt = len % (session->maxProgCto - 1);
     if (currentWriteCnt == 0)
     {
-      currentWriteCnt = (xcpMaxProgCto - 1);
+      currentWriteCnt = (session->maxProgCto - 1);
     }
     /* prepare the packed data for the program command */
-    if (currentWriteCnt < (xcpMaxProgCto - 1))
+    if (currentWriteCnt < (session->maxProgCto - 1))
     {
       /* program data */
-      if (XcpMasterSendCmdProgram(currentWriteCnt, &data[bufferOffset]) == false)
+      if (XcpMasterSendCmdProgram(session, currentWriteCnt, &data[bufferOffset]) == false)
       {
         return false;
       }
@@ -297,7 +377,7 @@ uint8_t XcpMasterProgramData(uint32_t addr, uint32_t len, uint8_t data[])
     else
     {
       /* program max data */
-      if (XcpMasterSendCmdProgramMax(&data[bufferOffset]) == false)
+      if (XcpMasterSendCmdProgramMax(session, &data[bufferOffset]) == false)
       {
         return false;
       }
@@ -311,12 +391,107 @@ uint8_t XcpMasterProgramData(uint32_t addr, uint32_t len, uint8_t data[])
 } /*** end of XcpMasterProgramData ***/
 
 
+/************************************************************************************//**
+** \brief     Verifies the slave's memory against the given data by having the slave
+**            build checksums over the range, using the checksum type it reports. If the
+**            slave cannot build a checksum the host can reproduce, the data is uploaded
+**            and compared instead.
+** \param     session XCP session of the slave.
+** \param     addr Base memory address of the range.
+** \param     len Number of bytes to verify.
+** \param     data Expected contents of the range.
+** \return    true if the memory matches, false if not or on a communication error.
+**
+****************************************************************************************/
+uint8_t XcpMasterVerifyData(tXcpSession *session, uint32_t addr, uint32_t len, uint8_t data[])
+{
+  uint32_t bufferOffset = 0;
+  uint32_t blockLen = len;
+  uint32_t currentLen;
+  uint32_t maxLength;
+  uint32_t checksum;
+  uint32_t expected;
+  uint8_t type;
+
+  /* first set the MTA pointer, it is advanced by every checksum */
+  if (XcpMasterSendCmdSetMta(session, addr) == false)
+  {
+    return false;
+  }
+  while (len > 0)
+  {
+    currentLen = (len > blockLen) ? blockLen : len;
+    if (XcpMasterSendCmdBuildChecksum(session, currentLen, &type, &checksum, &maxLength) == false)
+    {
+      if ((maxLength > 0) && (maxLength < currentLen))
+      {
+        /* the range is too large for the slave, the MTA did not change */
+        blockLen = maxLength;
+        continue;
+      }
+      /* no checksum support, compare the remaining data instead */
+      return XcpMasterCompareData(session, addr + bufferOffset, len, &data[bufferOffset]);
+    }
+    if (XcpMasterCalcChecksum(session, type, &data[bufferOffset], currentLen, &expected) == false)
+    {
+      /* unknown or user defined checksum, compare this and the remaining data instead */
+      return XcpMasterCompareData(session, addr + bufferOffset, len, &data[bufferOffset]);
+    }
+    if (checksum != expected)
+    {
+      return false;
+    }
+    /* update loop variables */
+    len -= currentLen;
+    bufferOffset += currentLen;
+  }
+  /* still here so all data matches */
+  return true;
+} /*** end of XcpMasterVerifyData ***/
+
+
+/************************************************************************************//**
+** \brief     Verifies the slave's memory against the given data by uploading it.
+** \param     session XCP session of the slave.
+** \param     addr Base memory address of the range.
+** \param     len Number of bytes to verify.
+** \param     data Expected contents of the range.
+** \return    true if the memory matches, false if not or on a communication error.
+**
+****************************************************************************************/
+uint8_t XcpMasterCompareData(tXcpSession *session, uint32_t addr, uint32_t len, uint8_t data[])
+{
+  uint8_t buffer[XCP_MASTER_COMPARE_CHUNK_LEN];
+  uint32_t bufferOffset = 0;
+  uint32_t currentLen;
+
+  while (len > 0)
+  {
+    currentLen = (len > XCP_MASTER_COMPARE_CHUNK_LEN) ? XCP_MASTER_COMPARE_CHUNK_LEN : len;
+    if (XcpMasterReadData(session, addr + bufferOffset, currentLen, buffer) == false)
+    {
+      return false;
+    }
+    if (memcmp(buffer, &data[bufferOffset], currentLen) != 0)
+    {
+      return false;
+    }
+    /* update loop variables */
+    len -= currentLen;
+    bufferOffset += currentLen;
+  }
+  /* still here so all data matches */
+  return true;
+} /*** end of XcpMasterCompareData ***/
+
+
 /************************************************************************************//**
 ** \brief     Sends the XCP Connect command.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdConnect(void)
+static uint8_t XcpMasterSendCmdConnect(tXcpSession *session)
 {
   uint8_t packetData[2];
   tXcpTransportResponsePacket *responsePacketPtr;
@@ -326,13 +501,14 @@ static uint8_t XcpMasterSendCmdConnect(void)
   packetData[1] = 0; /* normal mode */
   
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, 2, XCP_MASTER_CONNECT_TIMEOUT_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 2,
+                             XCP_MASTER_CONNECT_TIMEOUT_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -345,24 +521,27 @@ static uint8_t XcpMasterSendCmdConnect(void)
   if ((responsePacketPtr->data[2] & 0x01) == 0)
   {
     /* store slave's byte ordering information */
-    xcpSlaveIsIntel = true;
+    session->slaveIsIntel = true;
   }
+  /* store whether the slave may answer an upload with several packets */
+  session->slaveBlockMode = ((responsePacketPtr->data[2] & XCP_MASTER_COMM_MODE_SLAVE_BLOCK) != 0);
   /* store max number of bytes the slave allows for master->slave packets. */
-  xcpMaxCto = responsePacketPtr->data[3];
-  xcpMaxProgCto = xcpMaxCto;
+  session->maxCto = responsePacketPtr->data[3];
+  session->maxProgCto = session->maxCto;
+  session->maxProgBlock = 0;
   /* store max number of bytes the slave allows for slave->master packets. */
-  if (xcpSlaveIsIntel == true)
+  if (session->slaveIsIntel == true)
   {
-    xcpMaxDto = responsePacketPtr->data[4] + (responsePacketPtr->data[5] << 8);
+    session->maxDto = responsePacketPtr->data[4] + (responsePacketPtr->data[5] << 8);
   }
   else
   {
-    xcpMaxDto = responsePacketPtr->data[5] + (responsePacketPtr->data[4] << 8);
+    session->maxDto = responsePacketPtr->data[5] + (responsePacketPtr->data[4] << 8);
   }
   
   /* double check size configuration of the master */
-  assert(XCP_MASTER_TX_MAX_DATA >= xcpMaxCto);
-  assert(XCP_MASTER_RX_MAX_DATA >= xcpMaxDto);
+  assert(XCP_MASTER_TX_MAX_DATA >= session->maxCto);
+  assert(XCP_MASTER_RX_MAX_DATA >= session->maxDto);
   
   /* still here so all went well */  
   return true;
@@ -371,11 +550,12 @@ static uint8_t XcpMasterSendCmdConnect(void)
 
 /************************************************************************************//**
 ** \brief     Sends the XCP Set MTA command.
+** \param     session XCP session of the slave.
 ** \param     address New MTA address for the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdSetMta(uint32_t address)
+static uint8_t XcpMasterSendCmdSetMta(tXcpSession *session, uint32_t address)
 {
   uint8_t packetData[8];
   tXcpTransportResponsePacket *responsePacketPtr;
@@ -387,16 +567,17 @@ static uint8_t XcpMasterSendCmdSetMta(uint32_t address)
   packetData[3] = 0; /* address extension not supported */
   
   /* set the address taking into account byte ordering */
-  XcpMasterSetOrderedLong(address, &packetData[4]);
+  XcpMasterSetOrderedLong(session, address, &packetData[4]);
   
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, 8, XCP_MASTER_TIMEOUT_T1_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 8,
+                             XCP_MASTER_TIMEOUT_T1_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -411,45 +592,70 @@ static uint8_t XcpMasterSendCmdSetMta(uint32_t address)
 
 
 /************************************************************************************//**
-** \brief     Sends the XCP UPLOAD command.
+** \brief     Sends the XCP UPLOAD command. In slave block mode the data may arrive in
+**            several response packets, which are all collected here.
+** \param     session XCP session of the slave.
 ** \param     data Destination data buffer.
 ** \param     length Number of bytes to upload.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdUpload(uint8_t data[], uint8_t length)
+static uint8_t XcpMasterSendCmdUpload(tXcpSession *session, uint8_t data[], uint8_t length)
 {
   uint8_t packetData[2];
   tXcpTransportResponsePacket *responsePacketPtr;
   uint8_t data_index;
+  uint8_t received = 0;
+  uint8_t packetCnt;
   
-  /* cannot request more data then the max rx data - 1 */
-  assert(length < XCP_MASTER_RX_MAX_DATA);
+  /* cannot request more data then the max rx data - 1, unless the slave sends blocks */
+  assert((length < XCP_MASTER_RX_MAX_DATA) || (session->slaveBlockMode == true));
   
   /* prepare the command packet */
   packetData[0] = XCP_MASTER_CMD_UPLOAD;
   packetData[1] = length;
 
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, 2, XCP_MASTER_TIMEOUT_T1_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 2,
+                             XCP_MASTER_TIMEOUT_T1_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
-  /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
-  
-  /* check if the reponse was valid */
-  if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
-  {
-    /* not a valid or positive response */
-    return false;
-  }
   
-  /* now store the uploaded data */
-  for (data_index=0; data_index<length; data_index++)
+  for (;;)
   {
-    data[data_index] = responsePacketPtr->data[data_index+1];
+    /* still here so a response was received */
+    responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
+    
+    /* check if the reponse was valid */
+    if ( (responsePacketPtr->len <= 1) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
+    {
+      /* not a valid or positive response */
+      return false;
+    }
+    
+    /* now store the uploaded data */
+    packetCnt = responsePacketPtr->len - 1;
+    if (packetCnt > (length - received))
+    {
+      packetCnt = length - received;
+    }
+    for (data_index=0; data_index<packetCnt; data_index++)
+    {
+      data[received+data_index] = responsePacketPtr->data[data_index+1];
+    }
+    received += packetCnt;
+    if (received == length)
+    {
+      break;
+    }
+    
+    /* more response packets of the block follow */
+    if (XcpTransportReceivePacket(session->transport, XCP_MASTER_TIMEOUT_T1_MS) == false)
+    {
+      return false;
+    }
   }
   
   /* still here so all went well */  
@@ -459,10 +665,11 @@ static uint8_t XcpMasterSendCmdUpload(uint8_t data[], uint8_t length)
 
 /************************************************************************************//**
 ** \brief     Sends the XCP PROGRAM START command.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdProgramStart(void)
+static uint8_t XcpMasterSendCmdProgramStart(tXcpSession *session)
 {
   uint8_t packetData[1];
   tXcpTransportResponsePacket *responsePacketPtr;
@@ -471,13 +678,14 @@ static uint8_t XcpMasterSendCmdProgramStart(void)
   packetData[0] = XCP_MASTER_CMD_PROGRAM_START;
 
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, 1, XCP_MASTER_TIMEOUT_T3_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 1,
+                             XCP_MASTER_TIMEOUT_T3_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -489,7 +697,26 @@ static uint8_t XcpMasterSendCmdProgramStart(void)
   /* store max number of bytes the slave allows for master->slave packets during the
    * programming session
    */
-  xcpMaxProgCto = responsePacketPtr->data[3];
+  session->maxProgCto = responsePacketPtr->data[3];
+  
+  /* use master block mode if the slave supports it, a block holds up to MAX_BS_PGM
+   * packets and is responded to only once
+   */
+  session->maxProgBlock = 0;
+  if ( (responsePacketPtr->len >= 6) && (session->maxProgCto > 2) &&
+       ((responsePacketPtr->data[2] & XCP_MASTER_COMM_MODE_MASTER_BLOCK) != 0) &&
+       (responsePacketPtr->data[4] > 1) )
+  {
+    if ((uint32_t)(session->maxProgCto - 2) * responsePacketPtr->data[4] >= XCP_MASTER_MAX_BLOCK_LEN)
+    {
+      session->maxProgBlock = XCP_MASTER_MAX_BLOCK_LEN;
+    }
+    else
+    {
+      session->maxProgBlock = (session->maxProgCto - 2) * responsePacketPtr->data[4];
+    }
+    session->minStPgm = responsePacketPtr->data[5];
+  }
   
   /* still here so all went well */  
   return true;
@@ -499,10 +726,11 @@ static uint8_t XcpMasterSendCmdProgramStart(void)
 /************************************************************************************//**
 ** \brief     Sends the XCP PROGRAM RESET command. Note that this command is a bit 
 **            different as in it does not require a response.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdProgramReset(void)
+static uint8_t XcpMasterSendCmdProgramReset(tXcpSession *session)
 {
   uint8_t packetData[1];
   tXcpTransportResponsePacket *responsePacketPtr;
@@ -513,7 +741,8 @@ static uint8_t XcpMasterSendCmdProgramReset(void)
   /* send the packet, assume the sending itself is ok and check if a response was
    * received.
    */
-  if (XcpTransportSendPacket(packetData, 1, XCP_MASTER_TIMEOUT_T5_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 1,
+                             XCP_MASTER_TIMEOUT_T5_MS) == false)
   {
     /* probably no response received within the specified timeout, but that is allowed
      * for the reset command.
@@ -521,7 +750,7 @@ static uint8_t XcpMasterSendCmdProgramReset(void)
     return true;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -537,19 +766,20 @@ static uint8_t XcpMasterSendCmdProgramReset(void)
 
 /************************************************************************************//**
 ** \brief     Sends the XCP PROGRAM command.
+** \param     session XCP session of the slave.
 ** \param     length Number of bytes in the data array to program.
 ** \param     data Array with data bytes to program.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdProgram(uint8_t length, uint8_t data[])
+static uint8_t XcpMasterSendCmdProgram(tXcpSession *session, uint8_t length, uint8_t data[])
 {
   uint8_t packetData[XCP_MASTER_TX_MAX_DATA];
   tXcpTransportResponsePacket *responsePacketPtr;
   uint8_t cnt;
   
   /* verify that this number of bytes actually first in this command */
-  assert(length <= (xcpMaxProgCto-2) && (xcpMaxProgCto <= XCP_MASTER_TX_MAX_DATA));
+  assert(length <= (session->maxProgCto-2) && (session->maxProgCto <= XCP_MASTER_TX_MAX_DATA));
   
   /* prepare the command packet */
   packetData[0] = XCP_MASTER_CMD_PROGRAM;
@@ -560,13 +790,14 @@ static uint8_t XcpMasterSendCmdProgram(uint8_t length, uint8_t data[])
   }
 
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, length+2, XCP_MASTER_TIMEOUT_T5_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, length+2,
+                             XCP_MASTER_TIMEOUT_T5_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -582,34 +813,36 @@ static uint8_t XcpMasterSendCmdProgram(uint8_t length, uint8_t data[])
 
 /************************************************************************************//**
 ** \brief     Sends the XCP PROGRAM MAX command.
+** \param     session XCP session of the slave.
 ** \param     data Array with data bytes to program.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdProgramMax(uint8_t data[])
+static uint8_t XcpMasterSendCmdProgramMax(tXcpSession *session, uint8_t data[])
 {
   uint8_t packetData[XCP_MASTER_TX_MAX_DATA];
   tXcpTransportResponsePacket *responsePacketPtr;
   uint8_t cnt;
   
   /* verify that this number of bytes actually first in this command */
-  assert(xcpMaxProgCto <= XCP_MASTER_TX_MAX_DATA);
+  assert(session->maxProgCto <= XCP_MASTER_TX_MAX_DATA);
   
   /* prepare the command packet */
   packetData[0] = XCP_MASTER_CMD_PROGRAM_MAX;
-  for (cnt=0; cnt<(xcpMaxProgCto-1); cnt++)
+  for (cnt=0; cnt<(session->maxProgCto-1); cnt++)
   {
     packetData[cnt+1] = data[cnt];
   }
 
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, xcpMaxProgCto, XCP_MASTER_TIMEOUT_T5_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, session->maxProgCto,
+                             XCP_MASTER_TIMEOUT_T5_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -623,12 +856,90 @@ static uint8_t XcpMasterSendCmdProgramMax(uint8_t data[])
 } /*** end of XcpMasterSendCmdProgramMax ***/
 
 
+/************************************************************************************//**
+** \brief     Programs a block of data with a PROGRAM command followed by PROGRAM NEXT
+**            commands. The packets are sent back to back, respecting the separation
+**            time of the slave, and only the response to the last one is checked.
+** \param     session XCP session of the slave.
+** \param     length Number of bytes in the data array to program.
+** \param     data Array with data bytes to program.
+** \return    true is successfull, false otherwise.
+**
+****************************************************************************************/
+static uint8_t XcpMasterSendCmdProgramBlock(tXcpSession *session, uint8_t length,
+                                            uint8_t data[])
+{
+  uint8_t packetData[XCP_MASTER_TX_MAX_DATA];
+  tXcpTransportResponsePacket *responsePacketPtr;
+  uint8_t remaining = length;
+  uint8_t packetCnt;
+  uint8_t cnt;
+  uint32_t bufferOffset = 0;
+  
+  /* verify that the packets fit in the transmit buffer */
+  assert((session->maxProgCto > 2) && (session->maxProgCto <= XCP_MASTER_TX_MAX_DATA));
+  
+  /* the first packet is a regular program command, the following ones continue it. each
+   * carries the number of bytes remaining in the block.
+   */
+  packetData[0] = XCP_MASTER_CMD_PROGRAM;
+  for (;;)
+  {
+    packetData[1] = remaining;
+    packetCnt = (remaining > (session->maxProgCto - 2)) ? (session->maxProgCto - 2) : remaining;
+    for (cnt=0; cnt<packetCnt; cnt++)
+    {
+      packetData[cnt+2] = data[bufferOffset+cnt];
+    }
+    remaining -= packetCnt;
+    bufferOffset += packetCnt;
+    if (remaining == 0)
+    {
+      break;
+    }
+    
+    /* the slave does not respond to this packet */
+    if (XcpTransportWritePacket(session->transport, packetData, packetCnt+2) == false)
+    {
+      return false;
+    }
+    /* wait the separation time, rounded up to whole milliseconds */
+    if (session->minStPgm > 0)
+    {
+      TimeUtilDelayMs((session->minStPgm + 9) / 10);
+    }
+    packetData[0] = XCP_MASTER_CMD_PROGRAM_NEXT;
+  }
+  
+  /* send the last packet, its response covers the whole block */
+  if (XcpTransportSendPacket(session->transport, packetData, packetCnt+2,
+                             XCP_MASTER_TIMEOUT_T5_MS) == false)
+  {
+    /* cound not set packet or receive response within the specified timeout */
+    return false;
+  }
+  /* still here so a response was received */
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
+  
+  /* check if the reponse was valid, an error within the block is reported here */
+  if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
+  {
+    /* not a valid or positive response */
+    return false;
+  }
+  
+  /* still here so all went well */  
+  return true;
+} /*** end of XcpMasterSendCmdProgramBlock ***/
+
+
 /************************************************************************************//**
 ** \brief     Sends the XCP PROGRAM CLEAR command.
+** \param     session XCP session of the slave.
 ** \return    true is successfull, false otherwise.
 **
 ****************************************************************************************/
-static uint8_t XcpMasterSendCmdProgramClear(uint32_t length)
+static uint8_t XcpMasterSendCmdProgramClear(tXcpSession *session, uint32_t length)
 {
   uint8_t packetData[8];
   tXcpTransportResponsePacket *responsePacketPtr;
@@ -640,17 +951,18 @@ static uint8_t XcpMasterSendCmdProgramClear(uint32_t length)
   packetData[3] = 0; /* reserved */
 
   /* set the erase length taking into account byte ordering */
-  XcpMasterSetOrderedLong(length, &packetData[4]);
+  XcpMasterSetOrderedLong(session, length, &packetData[4]);
 
 
   /* send the packet */
-  if (XcpTransportSendPacket(packetData, 8, XCP_MASTER_TIMEOUT_T4_MS) == false)
+  if (XcpTransportSendPacket(session->transport, packetData, 8,
+                             XCP_MASTER_TIMEOUT_T4_MS) == false)
   {
     /* cound not set packet or receive response within the specified timeout */
     return false;
   }
   /* still here so a response was received */
-  responsePacketPtr = XcpTransportReadResponsePacket();
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
   
   /* check if the reponse was valid */
   if ( (responsePacketPtr->len == 0) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
@@ -664,17 +976,182 @@ static uint8_t XcpMasterSendCmdProgramClear(uint32_t length)
 } /*** end of XcpMasterSendCmdProgramClear ***/
 
 
+/************************************************************************************//**
+** \brief     Sends the XCP BUILD CHECKSUM command for the range starting at the MTA.
+** \param     session XCP session of the slave.
+** \param     length Number of bytes in the range.
+** \param     type Checksum type reported by the slave.
+** \param     checksum Checksum reported by the slave.
+** \param     maxLength Set to the largest range the slave accepts if it rejected this
+**            one as too large, 0 otherwise.
+** \return    true is successfull, false otherwise.
+**
+****************************************************************************************/
+static uint8_t XcpMasterSendCmdBuildChecksum(tXcpSession *session, uint32_t length,
+                                             uint8_t *type, uint32_t *checksum,
+                                             uint32_t *maxLength)
+{
+  uint8_t packetData[8];
+  tXcpTransportResponsePacket *responsePacketPtr;
+
+  *maxLength = 0;
+
+  /* prepare the command packet */
+  packetData[0] = XCP_MASTER_CMD_BUILD_CHECKSUM;
+  packetData[1] = 0; /* reserved */
+  packetData[2] = 0; /* reserved */
+  packetData[3] = 0; /* reserved */
+
+  /* set the block size taking into account byte ordering */
+  XcpMasterSetOrderedLong(session, length, &packetData[4]);
+
+  /* send the packet */
+  if (XcpTransportSendPacket(session->transport, packetData, 8,
+                             XCP_MASTER_TIMEOUT_T2_MS) == false)
+  {
+    /* cound not set packet or receive response within the specified timeout */
+    return false;
+  }
+  /* still here so a response was received */
+  responsePacketPtr = XcpTransportReadResponsePacket(session->transport);
+  
+  /* a range that is too large is answered with the largest allowed one */
+  if ( (responsePacketPtr->len >= 8) && (responsePacketPtr->data[0] == XCP_MASTER_CMD_PID_ERR) &&
+       (responsePacketPtr->data[1] == XCP_MASTER_ERR_OUT_OF_RANGE) )
+  {
+    *maxLength = XcpMasterGetOrderedLong(session, &responsePacketPtr->data[4]);
+    return false;
+  }
+  
+  /* check if the reponse was valid */
+  if ( (responsePacketPtr->len < 8) || (responsePacketPtr->data[0] != XCP_MASTER_CMD_PID_RES) )
+  {
+    /* not a valid or positive response */
+    return false;
+  }
+  
+  *type = responsePacketPtr->data[1];
+  *checksum = XcpMasterGetOrderedLong(session, &responsePacketPtr->data[4]);
+  
+  /* still here so all went well */  
+  return true;
+} /*** end of XcpMasterSendCmdBuildChecksum ***/
+
+
+/************************************************************************************//**
+** \brief     Calculates a checksum the same way as the slave does for BUILD CHECKSUM.
+**            Words and dwords are read in the byte ordering of the slave.
+** \param     session XCP session of the slave.
+** \param     type Checksum type as reported by the slave.
+** \param     data Array with the data bytes.
+** \param     len Number of data bytes.
+** \param     checksum The calculated checksum.
+** \return    true is successfull, false if the type is not supported or the length does
+**            not fit the element size of the type.
+**
+****************************************************************************************/
+static uint8_t XcpMasterCalcChecksum(tXcpSession *session, uint8_t type, uint8_t data[],
+                                     uint32_t len, uint32_t *checksum)
+{
+  uint32_t result = 0;
+  uint32_t idx;
+  uint8_t bit;
+
+  switch (type)
+  {
+    case XCP_MASTER_CS_ADD_11:
+    case XCP_MASTER_CS_ADD_12:
+    case XCP_MASTER_CS_ADD_14:
+      for (idx=0; idx<len; idx++)
+      {
+        result += data[idx];
+      }
+      result &= (type == XCP_MASTER_CS_ADD_11) ? 0xFF : (type == XCP_MASTER_CS_ADD_12) ? 0xFFFF : 0xFFFFFFFF;
+      break;
+    case XCP_MASTER_CS_ADD_22:
+    case XCP_MASTER_CS_ADD_24:
+      if ((len % 2) != 0)
+      {
+        return false;
+      }
+      for (idx=0; idx<len; idx+=2)
+      {
+        if (session->slaveIsIntel == true)
+        {
+          result += data[idx] | (data[idx+1] << 8);
+        }
+        else
+        {
+          result += data[idx+1] | (data[idx] << 8);
+        }
+      }
+      result &= (type == XCP_MASTER_CS_ADD_22) ? 0xFFFF : 0xFFFFFFFF;
+      break;
+    case XCP_MASTER_CS_ADD_44:
+      if ((len % 4) != 0)
+      {
+        return false;
+      }
+      for (idx=0; idx<len; idx+=4)
+      {
+        result += XcpMasterGetOrderedLong(session, &data[idx]);
+      }
+      break;
+    case XCP_MASTER_CS_CRC_16:
+      for (idx=0; idx<len; idx++)
+      {
+        result ^= data[idx];
+        for (bit=0; bit<8; bit++)
+        {
+          result = (result & 1) ? ((result >> 1) ^ 0xA001) : (result >> 1);
+        }
+      }
+      break;
+    case XCP_MASTER_CS_CRC_16_CITT:
+      result = 0xFFFF;
+      for (idx=0; idx<len; idx++)
+      {
+        result ^= (uint32_t)data[idx] << 8;
+        for (bit=0; bit<8; bit++)
+        {
+          result = (result & 0x8000) ? ((result << 1) ^ 0x1021) : (result << 1);
+        }
+        result &= 0xFFFF;
+      }
+      break;
+    case XCP_MASTER_CS_CRC_32:
+      result = 0xFFFFFFFF;
+      for (idx=0; idx<len; idx++)
+      {
+        result ^= data[idx];
+        for (bit=0; bit<8; bit++)
+        {
+          result = (result & 1) ? ((result >> 1) ^ 0xEDB88320) : (result >> 1);
+        }
+      }
+      result ^= 0xFFFFFFFF;
+      break;
+    default:
+      /* user defined or unknown */
+      return false;
+  }
+  *checksum = result;
+  return true;
+} /*** end of XcpMasterCalcChecksum ***/
+
+
 /************************************************************************************//**
 ** \brief     Stores a 32-bit value into a byte buffer taking into account Intel
 **            or Motorola byte ordering.
+** \param     session XCP session of the slave.
 ** \param     value The 32-bit value to store in the buffer.
 ** \param     data Array to the buffer for storage.
 ** \return    none.
 **
 ****************************************************************************************/
-static void XcpMasterSetOrderedLong(uint32_t value, uint8_t data[])
+static void XcpMasterSetOrderedLong(tXcpSession *session, uint32_t value, uint8_t data[])
 {
-  if (xcpSlaveIsIntel == true)
+  if (session->slaveIsIntel == true)
   {
     data[3] = (uint8_t)(value >> 24);
     data[2] = (uint8_t)(value >> 16);
@@ -691,4 +1168,22 @@ static void XcpMasterSetOrderedLong(uint32_t value, uint8_t data[])
 } /*** end of XcpMasterSetOrderedLong ***/
 
 
+/************************************************************************************//**
+** \brief     Reads a 32-bit value from a byte buffer taking into account Intel
+**            or Motorola byte ordering.
+** \param     session XCP session of the slave.
+** \param     data Array to the buffer with the value.
+** \return    The 32-bit value.
+**
+****************************************************************************************/
+static uint32_t XcpMasterGetOrderedLong(tXcpSession *session, uint8_t data[])
+{
+  if (session->slaveIsIntel == true)
+  {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  }
+  return data[3] | (data[2] << 8) | (data[1] << 16) | ((uint32_t)data[0] << 24);
+} /*** end of XcpMasterGetOrderedLong ***/
+
+
 /*********************************** end of xcpmaster.c ********************************/
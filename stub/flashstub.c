@@ -0,0 +1,419 @@
+/*
+ * RAM-resident flashing stub for the STM32F4 on CORE2.
+ *
+ * Uploaded by the flasher to STUB_LOAD_ADDR through the system bootloader and
+ * started with GO. It talks to the host over the USART the bootloader was
+ * using (detected from the first received byte), receives into a circular
+ * DMA buffer so the host can stream commands while flash is being programmed,
+ * decompresses LZ4 blocks, programs and verifies them with the CRC unit.
+ * The protocol is described in include/stubproto.h.
+ *
+ * GO may put the peripherals the bootloader used back to their reset values,
+ * so nothing it set up is relied on: the stub runs from HSI and configures
+ * the pins and both USARTs itself, at the baudrate the host patched into the
+ * image header. Runs with interrupts disabled, all peripherals are accessed
+ * by address to avoid any dependency on CMSIS.
+ */
+
+#include <stdint.h>
+#include "stubproto.h"
+#include "lz4block.h"
+
+#define REG(addr) (*(volatile uint32_t*)(addr))
+
+#define RCC_CR               REG(0x40023800)
+#define RCC_CFGR             REG(0x40023808)
+#define RCC_AHB1ENR          REG(0x40023830)
+#define RCC_APB1ENR          REG(0x40023840)
+#define RCC_APB2ENR          REG(0x40023844)
+#define RCC_CR_HSION         (1u << 0)
+#define RCC_CR_HSIRDY        (1u << 1)
+#define RCC_CFGR_SW          (3u << 0)
+#define RCC_CFGR_SWS         (3u << 2)
+#define RCC_CFGR_PRESCALERS  0xfcf0u /* HPRE, PPRE1, PPRE2 */
+#define RCC_AHB1ENR_GPIOAEN  (1u << 0)
+#define RCC_AHB1ENR_GPIOBEN  (1u << 1)
+#define RCC_AHB1ENR_CRCEN    (1u << 12)
+#define RCC_AHB1ENR_DMA1EN   (1u << 21)
+#define RCC_AHB1ENR_DMA2EN   (1u << 22)
+#define RCC_APB1ENR_USART3EN (1u << 18)
+#define RCC_APB2ENR_USART1EN (1u << 4)
+
+/* SYSCLK from HSI with all bus prescalers at 1 */
+#define PCLK                 16000000u
+
+/* bootloader pins: USART1 on PA9/PA10, USART3 on PB10/PB11, both AF7 */
+#define GPIOA_BASE           0x40020000u
+#define GPIOB_BASE           0x40020400u
+#define GPIO_MODER(b)        REG((b) + 0x00)
+#define GPIO_OSPEEDR(b)      REG((b) + 0x08)
+#define GPIO_PUPDR(b)        REG((b) + 0x0c)
+#define GPIO_AFRH(b)         REG((b) + 0x24)
+
+#define USART1_BASE          0x40011000u
+#define USART3_BASE          0x40004800u
+#define USART_SR(b)          REG((b) + 0x00)
+#define USART_DR(b)          REG((b) + 0x04)
+#define USART_BRR(b)         REG((b) + 0x08)
+#define USART_CR1(b)         REG((b) + 0x0c)
+#define USART_CR2(b)         REG((b) + 0x10)
+#define USART_CR3(b)         REG((b) + 0x14)
+#define USART_SR_RXNE        (1u << 5)
+#define USART_SR_TC          (1u << 6)
+#define USART_SR_TXE         (1u << 7)
+#define USART_CR1_RE         (1u << 2)
+#define USART_CR1_TE         (1u << 3)
+#define USART_CR1_PCE        (1u << 10)
+#define USART_CR1_M          (1u << 12)
+#define USART_CR1_UE         (1u << 13)
+#define USART_CR1_OVER8      (1u << 15)
+#define USART_CR3_DMAR       (1u << 6)
+
+/* USART1_RX: DMA2 stream 2 channel 4, USART3_RX: DMA1 stream 1 channel 4 */
+#define DMA1_BASE            0x40026000u
+#define DMA2_BASE            0x40026400u
+#define DMA_LIFCR(b)         REG((b) + 0x08)
+#define DMA_SCR(b, s)        REG((b) + 0x10 + 0x18 * (s))
+#define DMA_SNDTR(b, s)      REG((b) + 0x14 + 0x18 * (s))
+#define DMA_SPAR(b, s)       REG((b) + 0x18 + 0x18 * (s))
+#define DMA_SM0AR(b, s)      REG((b) + 0x1c + 0x18 * (s))
+#define DMA_SFCR(b, s)       REG((b) + 0x24 + 0x18 * (s))
+#define DMA_SCR_EN           (1u << 0)
+#define DMA_SCR_CIRC         (1u << 8)
+#define DMA_SCR_MINC         (1u << 10)
+#define DMA_SCR_CHSEL_4      (4u << 25)
+
+#define FLASH_KEYR           REG(0x40023c04)
+#define FLASH_SR             REG(0x40023c0c)
+#define FLASH_CR             REG(0x40023c10)
+#define FLASH_SR_BSY         (1u << 16)
+#define FLASH_SR_ERRORS      0xf2u /* PGSERR, PGPERR, PGAERR, WRPERR, OPERR */
+#define FLASH_CR_PG          (1u << 0)
+#define FLASH_CR_SER         (1u << 1)
+#define FLASH_CR_PSIZE_X32   (2u << 8)
+#define FLASH_CR_STRT        (1u << 16)
+#define FLASH_CR_LOCK        (1u << 31)
+
+#define CRC_DR               REG(0x40023000)
+#define CRC_CR               REG(0x40023008)
+
+#define IWDG_KR              REG(0x40003000)
+#define SCB_AIRCR            REG(0xe000ed0c)
+
+#define FLASH_START          0x08000000u
+#define FLASH_END            0x08200000u
+
+void stub_main(void);
+
+/* GO loads the stack pointer and the entry point from the first two words,
+ * the host fills in the baudrate at STUB_BAUDRATE_OFFSET before the upload
+ */
+extern uint32_t _estack;
+__attribute__((section(".vectors"), used))
+static volatile const struct
+{
+	const void* stack;
+	void (*entry)(void);
+	uint32_t baudrate;
+} header = { &_estack, stub_main, 0 };
+
+static uint32_t usart, dma, stream;
+static volatile uint8_t ring[STUB_RING_SIZE];
+static uint32_t ringPos;
+
+static uint32_t frame[(sizeof(stub_cmd_t) + STUB_BLOCK_SIZE + 8) / 4 + 1];
+static uint32_t block[STUB_BLOCK_SIZE / 4];
+
+static void kick(void)
+{
+	/* harmless when the watchdog is not running */
+	IWDG_KR = 0xaaaa;
+}
+
+/* transport */
+static int available(void)
+{
+	uint32_t head = STUB_RING_SIZE - DMA_SNDTR(dma, stream);
+	return (head - ringPos) & (STUB_RING_SIZE - 1);
+}
+static uint8_t readByte(void)
+{
+	while (!available())
+		kick();
+	uint8_t b = ring[ringPos];
+	ringPos = (ringPos + 1) & (STUB_RING_SIZE - 1);
+	return b;
+}
+static void writeBytes(const void* data, int len)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	while (len--)
+	{
+		while (!(USART_SR(usart) & USART_SR_TXE))
+			kick();
+		USART_DR(usart) = *p++;
+	}
+}
+
+/* setup */
+static void initClock(void)
+{
+	RCC_CR |= RCC_CR_HSION;
+	while (!(RCC_CR & RCC_CR_HSIRDY));
+	/* switch first, so the buses never run faster than allowed */
+	RCC_CFGR &= ~RCC_CFGR_SW;
+	while (RCC_CFGR & RCC_CFGR_SWS);
+	RCC_CFGR &= ~RCC_CFGR_PRESCALERS;
+
+	RCC_AHB1ENR |= RCC_AHB1ENR_GPIOAEN | RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_CRCEN |
+	               RCC_AHB1ENR_DMA1EN | RCC_AHB1ENR_DMA2EN;
+	RCC_APB1ENR |= RCC_APB1ENR_USART3EN;
+	RCC_APB2ENR |= RCC_APB2ENR_USART1EN;
+}
+static void initPins(uint32_t gpio, uint32_t tx, uint32_t rx)
+{
+	GPIO_AFRH(gpio) = (GPIO_AFRH(gpio) & ~((15u << (tx - 8) * 4) | (15u << (rx - 8) * 4))) |
+	                  (7u << (tx - 8) * 4) | (7u << (rx - 8) * 4);
+	GPIO_OSPEEDR(gpio) |= 3u << tx * 2;
+	GPIO_PUPDR(gpio) = (GPIO_PUPDR(gpio) & ~(3u << rx * 2)) | (1u << rx * 2);
+	GPIO_MODER(gpio) = (GPIO_MODER(gpio) & ~((3u << tx * 2) | (3u << rx * 2))) | (2u << tx * 2) | (2u << rx * 2);
+}
+/* BRR for PCLK, oversampling by 8 above PCLK / 16 */
+static uint32_t usartDivider(uint32_t baud, uint32_t* cr1)
+{
+	uint32_t div = (PCLK + baud / 2) / baud;
+	if (div >= 16)
+	{
+		*cr1 &= ~USART_CR1_OVER8;
+		return div;
+	}
+	div = (2 * PCLK + baud / 2) / baud;
+	*cr1 |= USART_CR1_OVER8;
+	return ((div >> 3) << 4) | (div & 7);
+}
+static void initUsart(uint32_t base, uint32_t baud)
+{
+	/* 8E1 like the bootloader */
+	uint32_t cr1 = USART_CR1_M | USART_CR1_PCE | USART_CR1_TE | USART_CR1_RE;
+	USART_CR1(base) = 0;
+	USART_CR2(base) = 0;
+	USART_CR3(base) = 0;
+	USART_BRR(base) = usartDivider(baud, &cr1);
+	USART_CR1(base) = cr1 | USART_CR1_UE;
+}
+
+static void waitForHost(void)
+{
+	/* the host may be on either bootloader USART, use the one it talks to */
+	for (;;)
+	{
+		kick();
+		if (USART_SR(USART1_BASE) & USART_SR_RXNE)
+		{
+			usart = USART1_BASE;
+			dma = DMA2_BASE;
+			stream = 2;
+			break;
+		}
+		if (USART_SR(USART3_BASE) & USART_SR_RXNE)
+		{
+			usart = USART3_BASE;
+			dma = DMA1_BASE;
+			stream = 1;
+			break;
+		}
+	}
+	(void)USART_DR(usart); /* the rest of that command is dropped by the frame parser */
+
+	DMA_SCR(dma, stream) = 0;
+	while (DMA_SCR(dma, stream) & DMA_SCR_EN);
+	DMA_LIFCR(dma) = 0x0f7d0f7d;
+	DMA_SPAR(dma, stream) = usart + 0x04;
+	DMA_SM0AR(dma, stream) = (uint32_t)ring;
+	DMA_SNDTR(dma, stream) = STUB_RING_SIZE;
+	DMA_SFCR(dma, stream) = 0;
+	DMA_SCR(dma, stream) = DMA_SCR_CHSEL_4 | DMA_SCR_MINC | DMA_SCR_CIRC | DMA_SCR_EN;
+	USART_CR3(usart) |= USART_CR3_DMAR;
+	ringPos = 0;
+}
+
+static void setBaudrate(uint32_t baud)
+{
+	uint32_t cr1 = USART_CR1(usart);
+
+	while (!(USART_SR(usart) & USART_SR_TC))
+		kick();
+
+	USART_CR1(usart) = cr1 & ~USART_CR1_UE;
+	USART_BRR(usart) = usartDivider(baud, &cr1);
+	USART_CR1(usart) = cr1;
+}
+
+/* CRC unit, same algorithm as crc32_stm32() on the host */
+static uint32_t crc(const uint32_t* data, uint32_t words)
+{
+	CRC_CR = 1;
+	while (words--)
+		CRC_DR = *data++;
+	return CRC_DR;
+}
+
+static void reply(const stub_cmd_t* cmd, uint8_t status, uint32_t value)
+{
+	uint32_t buf[3];
+	stub_reply_t* r = (stub_reply_t*)buf;
+	r->sof = STUB_SOF;
+	r->cmd = cmd->cmd;
+	r->seq = cmd->seq;
+	r->status = status;
+	r->value = value;
+	r->crc = crc(buf, 2);
+	writeBytes(buf, sizeof(*r));
+}
+
+/* flash */
+static int flashWait(void)
+{
+	while (FLASH_SR & FLASH_SR_BSY)
+		kick();
+	uint32_t sr = FLASH_SR;
+	FLASH_SR = sr;
+	return (sr & FLASH_SR_ERRORS) ? -1 : 0;
+}
+static void flashUnlock(void)
+{
+	if (FLASH_CR & FLASH_CR_LOCK)
+	{
+		FLASH_KEYR = 0x45670123;
+		FLASH_KEYR = 0xcdef89ab;
+	}
+	FLASH_SR = FLASH_SR_ERRORS;
+}
+static int flashErase(uint32_t sector)
+{
+	if (sector > 23)
+		return -1;
+	/* sectors of the second bank are numbered from 16 in SNB */
+	uint32_t snb = sector < 12 ? sector : sector + 4;
+	flashUnlock();
+	FLASH_CR = FLASH_CR_PSIZE_X32 | FLASH_CR_SER | (snb << 3);
+	FLASH_CR |= FLASH_CR_STRT;
+	int res = flashWait();
+	FLASH_CR = 0;
+	return res;
+}
+static int flashProgram(uint32_t addr, const uint32_t* data, uint32_t words)
+{
+	flashUnlock();
+	FLASH_CR = FLASH_CR_PSIZE_X32 | FLASH_CR_PG;
+	int res = 0;
+	volatile uint32_t* dst = (volatile uint32_t*)addr;
+	while (words-- && res == 0)
+	{
+		*dst++ = *data++;
+		res = flashWait();
+	}
+	FLASH_CR = 0;
+	return res;
+}
+
+/* commands */
+static uint8_t handleWrite(const stub_cmd_t* cmd, const uint8_t* payload)
+{
+	uint32_t len = cmd->arg;
+	if ((cmd->addr & 3) || (len & 3) || len == 0 || len > STUB_BLOCK_SIZE ||
+	    cmd->addr < FLASH_START || cmd->addr + len > FLASH_END)
+		return STUB_ERR_ARG;
+
+	const uint32_t* data;
+	if (cmd->flags & STUB_FLAG_COMPRESSED)
+	{
+		if (lz4_decompress_block(payload, cmd->len, (uint8_t*)block, len) != (int)len)
+			return STUB_ERR_DECOMPRESS;
+		data = block;
+	}
+	else
+	{
+		if (cmd->len != len)
+			return STUB_ERR_ARG;
+		data = (const uint32_t*)payload;
+	}
+
+	if (flashProgram(cmd->addr, data, len / 4))
+		return STUB_ERR_FLASH;
+	if (crc((const uint32_t*)cmd->addr, len / 4) != crc(data, len / 4))
+		return STUB_ERR_VERIFY;
+	return STUB_OK;
+}
+
+static int readFrame(void)
+{
+	uint8_t* p = (uint8_t*)frame;
+	stub_cmd_t* cmd = (stub_cmd_t*)frame;
+
+	for (;;)
+	{
+		while ((p[0] = readByte()) != STUB_SOF);
+		for (uint32_t i = 1; i < sizeof(stub_cmd_t); i++)
+			p[i] = readByte();
+		if (cmd->len > STUB_BLOCK_SIZE)
+			continue;
+
+		uint32_t words = (sizeof(stub_cmd_t) + cmd->len + 3) / 4;
+		for (uint32_t i = sizeof(stub_cmd_t); i < words * 4 + 4; i++)
+			p[i] = readByte();
+		if (crc(frame, words) == frame[words])
+			return 0;
+		/* a corrupted frame keeps its place in the host window, report it */
+		reply(cmd, STUB_ERR_CRC, 0);
+	}
+}
+
+void stub_main(void)
+{
+	__asm volatile ("cpsid i");
+
+	initClock();
+	initPins(GPIOA_BASE, 9, 10);
+	initPins(GPIOB_BASE, 10, 11);
+	initUsart(USART1_BASE, header.baudrate);
+	initUsart(USART3_BASE, header.baudrate);
+	waitForHost();
+
+	for (;;)
+	{
+		readFrame();
+		const stub_cmd_t* cmd = (const stub_cmd_t*)frame;
+		const uint8_t* payload = (const uint8_t*)frame + sizeof(stub_cmd_t);
+
+		switch (cmd->cmd)
+		{
+		case STUB_CMD_PING:
+			reply(cmd, STUB_OK, STUB_VERSION);
+			break;
+		case STUB_CMD_BAUD:
+			reply(cmd, STUB_OK, 0);
+			setBaudrate(cmd->arg);
+			break;
+		case STUB_CMD_ERASE:
+			reply(cmd, flashErase(cmd->arg) ? STUB_ERR_FLASH : STUB_OK, 0);
+			break;
+		case STUB_CMD_WRITE:
+			reply(cmd, handleWrite(cmd, payload), 0);
+			break;
+		case STUB_CMD_CRC:
+			if ((cmd->addr & 3) || (cmd->arg & 3))
+				reply(cmd, STUB_ERR_ARG, 0);
+			else
+				reply(cmd, STUB_OK, crc((const uint32_t*)cmd->addr, cmd->arg / 4));
+			break;
+		case STUB_CMD_RESET:
+			while (!(USART_SR(usart) & USART_SR_TC));
+			SCB_AIRCR = 0x05fa0004;
+			for (;;);
+		default:
+			reply(cmd, STUB_ERR_CMD, 0);
+			break;
+		}
+	}
+}
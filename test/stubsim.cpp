@@ -0,0 +1,292 @@
+// Debug tool, not part of the flasher: runs the host side of the flashing
+// stub (window handling, LZ4, CRCs) against a model of the stub, without a
+// board. Built with -DSTUB_SIM=1:
+//   stub-sim [-v] file.hex [file.bin@addr...]
+
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "devices.h"
+#include "flashstub.h"
+#include "ihex.h"
+#include "lz4block.h"
+#include "utils.h"
+
+#define SIM_FLASH_SIZE 0x200000
+#define SIM_BAUDRATE 1000000
+
+// In-process model of the flashing stub (stub/flashstub.c) behind a
+// StubLink. Like the target it drops the first received byte, keeps at most
+// STUB_RING_SIZE unprocessed bytes (more is an overrun and is lost), checks
+// the frame CRCs, decompresses LZ4 blocks and programs a flash model that
+// can only clear bits. Frames are only processed when the host reads, so
+// the host window is what keeps the ring from overflowing.
+class SimStubLink : public StubLink
+{
+public:
+	SimStubLink();
+
+	int write(const void* data, int len);
+	int read(void* data, int len, int timeout);
+	int flush();
+	int setBaudrate(int baudrate);
+
+	uint32_t getOverruns() { return m_overruns; }
+	uint32_t getReceived() { return m_received; }
+
+private:
+	vector<uint8_t> m_flash;
+	deque<uint8_t> m_rx;
+	deque<uint8_t> m_tx;
+	bool m_started;
+	uint32_t m_overruns, m_received;
+
+	bool processFrame();
+	void reply(const stub_cmd_t& cmd, uint8_t status, uint32_t value);
+	uint8_t program(const stub_cmd_t& cmd, const uint8_t* payload);
+	uint8_t erase(uint32_t sector);
+};
+
+SimStubLink::SimStubLink()
+	: m_flash(SIM_FLASH_SIZE, 0x00), m_started(false), m_overruns(0), m_received(0)
+{
+}
+
+int SimStubLink::write(const void* data, int len)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	m_received += len;
+	// the stub picks its USART by the first byte and drops it
+	if (!m_started && len > 0)
+	{
+		m_started = true;
+		p++;
+		len--;
+	}
+	m_rx.insert(m_rx.end(), p, p + len);
+	// the circular DMA overwrites the oldest unprocessed bytes
+	if (m_rx.size() > STUB_RING_SIZE)
+	{
+		m_overruns++;
+		m_rx.erase(m_rx.begin(), m_rx.begin() + (m_rx.size() - STUB_RING_SIZE));
+	}
+	return len;
+}
+int SimStubLink::read(void* data, int len, int timeout)
+{
+	while ((int)m_tx.size() < len && processFrame())
+		;
+	int n = (int)m_tx.size() < len ? m_tx.size() : len;
+	for (int i = 0; i < n; i++)
+	{
+		((uint8_t*)data)[i] = m_tx.front();
+		m_tx.pop_front();
+	}
+	return n;
+}
+int SimStubLink::flush()
+{
+	m_tx.clear();
+	return 0;
+}
+int SimStubLink::setBaudrate(int baudrate)
+{
+	return 0;
+}
+
+bool SimStubLink::processFrame()
+{
+	for (;;)
+	{
+		while (!m_rx.empty() && m_rx.front() != STUB_SOF)
+			m_rx.pop_front();
+		if (m_rx.size() < sizeof(stub_cmd_t))
+			return false;
+
+		stub_cmd_t cmd;
+		copy(m_rx.begin(), m_rx.begin() + sizeof(cmd), (uint8_t*)&cmd);
+		if (cmd.len > STUB_BLOCK_SIZE)
+		{
+			m_rx.erase(m_rx.begin(), m_rx.begin() + sizeof(cmd));
+			continue;
+		}
+		uint32_t padded = sizeof(cmd) + ((cmd.len + 3) & ~3);
+		if (m_rx.size() < padded + 4)
+			return false;
+
+		vector<uint8_t> frame(m_rx.begin(), m_rx.begin() + padded + 4);
+		m_rx.erase(m_rx.begin(), m_rx.begin() + padded + 4);
+		uint32_t crc;
+		memcpy(&crc, frame.data() + padded, 4);
+		if (crc32_stm32(frame.data(), padded) != crc)
+		{
+			reply(cmd, STUB_ERR_CRC, 0);
+			return true;
+		}
+
+		const uint8_t* payload = frame.data() + sizeof(cmd);
+		switch (cmd.cmd)
+		{
+		case STUB_CMD_PING:
+			reply(cmd, STUB_OK, STUB_VERSION);
+			break;
+		case STUB_CMD_BAUD:
+			reply(cmd, STUB_OK, 0);
+			break;
+		case STUB_CMD_ERASE:
+			reply(cmd, erase(cmd.arg), 0);
+			break;
+		case STUB_CMD_WRITE:
+			reply(cmd, program(cmd, payload), 0);
+			break;
+		case STUB_CMD_CRC:
+			if ((cmd.addr & 3) || (cmd.arg & 3) || cmd.addr < FLASH_START ||
+			    cmd.addr - FLASH_START + cmd.arg > SIM_FLASH_SIZE)
+				reply(cmd, STUB_ERR_ARG, 0);
+			else
+				reply(cmd, STUB_OK, crc32_stm32(&m_flash[cmd.addr - FLASH_START], cmd.arg));
+			break;
+		case STUB_CMD_RESET:
+			break;
+		default:
+			reply(cmd, STUB_ERR_CMD, 0);
+			break;
+		}
+		return true;
+	}
+}
+void SimStubLink::reply(const stub_cmd_t& cmd, uint8_t status, uint32_t value)
+{
+	stub_reply_t r;
+	r.sof = STUB_SOF;
+	r.cmd = cmd.cmd;
+	r.seq = cmd.seq;
+	r.status = status;
+	r.value = value;
+	r.crc = crc32_stm32((uint8_t*)&r, 8);
+	m_tx.insert(m_tx.end(), (uint8_t*)&r, (uint8_t*)&r + sizeof(r));
+}
+uint8_t SimStubLink::program(const stub_cmd_t& cmd, const uint8_t* payload)
+{
+	uint32_t len = cmd.arg;
+	if ((cmd.addr & 3) || (len & 3) || len == 0 || len > STUB_BLOCK_SIZE ||
+	    cmd.addr < FLASH_START || cmd.addr - FLASH_START + len > SIM_FLASH_SIZE)
+		return STUB_ERR_ARG;
+
+	vector<uint8_t> block(payload, payload + cmd.len);
+	if (cmd.flags & STUB_FLAG_COMPRESSED)
+	{
+		block.assign(len, 0);
+		if (lz4_decompress_block(payload, cmd.len, block.data(), len) != (int)len)
+			return STUB_ERR_DECOMPRESS;
+	}
+	else if (cmd.len != len)
+	{
+		return STUB_ERR_ARG;
+	}
+
+	// programming can only clear bits, the stub verifies the result
+	uint8_t* dst = &m_flash[cmd.addr - FLASH_START];
+	for (uint32_t i = 0; i < len; i++)
+		dst[i] &= block[i];
+	if (memcmp(dst, block.data(), len) != 0)
+		return STUB_ERR_VERIFY;
+	return STUB_OK;
+}
+uint8_t SimStubLink::erase(uint32_t sector)
+{
+	for (int i = 0; i < flashPages; i++)
+	{
+		if (flashLayout[i].sector_num == sector)
+		{
+			uint32_t offset = flashLayout[i].sector_start - FLASH_START;
+			if (offset + flashLayout[i].sector_size > SIM_FLASH_SIZE)
+				return STUB_ERR_FLASH;
+			memset(&m_flash[offset], 0xff, flashLayout[i].sector_size);
+			return STUB_OK;
+		}
+	}
+	return STUB_ERR_FLASH;
+}
+
+// programs the image through FlashStub into the model and checks it with
+// the stub CRCs, returns 0 if the image was written correctly
+static int runStubSim(THexFile& image)
+{
+	SimStubLink link;
+	FlashStub stub(link);
+
+	set<int> sectors;
+	for (unsigned int i = 0; i < image.parts.size(); i++)
+	{
+		TPart* part = image.parts[i];
+		for (int j = 0; j < flashPages; j++)
+		{
+			uint32_t start = flashLayout[j].sector_start;
+			uint32_t end = start + flashLayout[j].sector_size - 1;
+			if (part->getStartAddr() <= end && part->getEndAddr() >= start)
+				sectors.insert(flashLayout[j].sector_num);
+		}
+	}
+
+	if (stub.connect(1000) || stub.setBaudrate(SIM_BAUDRATE) ||
+	    stub.erase(vector<int>(sectors.begin(), sectors.end())) || stub.program(image, 0))
+	{
+		LOG("stub sim: command failed (%u ring overruns)\r\n", link.getOverruns());
+		return -1;
+	}
+
+	// the CRC covers whole words, bytes outside of the image read as erased
+	int bad = 0;
+	for (unsigned int i = 0; i < image.parts.size(); i++)
+	{
+		uint32_t first = image.parts[i]->getStartAddr() & ~3;
+		uint32_t last = (image.parts[i]->getEndAddr() + 4) & ~3;
+		vector<uint8_t> expected(last - first);
+		image.read(first, last - first, expected.data());
+
+		uint32_t crc;
+		if (stub.crc(first, last - first, crc))
+			return -1;
+		if (crc != crc32_stm32(expected.data(), expected.size()))
+		{
+			LOG("stub sim: CRC mismatch at 0x%08x-0x%08x\r\n", first, last);
+			bad++;
+		}
+	}
+	stub.reset();
+
+	LOG("stub sim: %u image bytes in %u bytes over the link, %u ring overruns, %s\r\n", image.totalLength,
+	    link.getReceived(), link.getOverruns(), bad ? "FAILED" : "OK");
+	return bad || link.getOverruns() ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	int first = 1;
+	if (argc > 1 && strcmp(argv[1], "-v") == 0)
+	{
+		log_debug = 1;
+		first++;
+	}
+	if (first >= argc)
+	{
+		fprintf(stderr, "usage: %s [-v] file.hex [file.bin@addr...]\n", argv[0]);
+		return 1;
+	}
+
+	THexFile image;
+	if (!image.loadImages(vector<string>(argv + first, argv + argc)))
+	{
+		LOG("unable to load hex file\r\n");
+		return 1;
+	}
+	return runStubSim(image) == 0 ? 0 : 1;
+}